@@ -14,25 +14,112 @@
 #include "buf.h"
 #include "pc.h"
 #include "fs.h"
+#include "trace.h"
 
+#ifndef HTABSIZEBITS      ///< can be set at build time, otherwise derived from NBUFFER (about 2 buffers per chain)
+#if NBUFFER <= 8
+#define HTABSIZEBITS 2
+#elif NBUFFER <= 16
+#define HTABSIZEBITS 3
+#elif NBUFFER <= 32
 #define HTABSIZEBITS 4
+#elif NBUFFER <= 64
+#define HTABSIZEBITS 5
+#elif NBUFFER <= 128
+#define HTABSIZEBITS 6
+#else
+#define HTABSIZEBITS 7
+#endif
+#endif
 
 #define HTABSIZE (1 << HTABSIZEBITS)
 #define HTABMASK (HTABSIZE - 1)
-#define HTABVALUE(dev, block) ((block) & HTABMASK)
+/// mixes dev into block, so block n of different devices lands in different chains
+#define HTABVALUE(dev, block) (((block) ^ ((block) >> HTABSIZEBITS) ^ ((dev).ldev * 0x9Du)) & HTABMASK)
 #define HTAB(dev, block) hashtab[HTABVALUE(dev, block)]
 
 bhead_t bufhead[NBUFFER];
 buffer_t buf[NBUFFER];
 
 bhead_t *hashtab[HTABSIZE];
-bhead_t *freelist = NULL;
+bhashstat_t hashstat[HTABSIZE];
+bhead_t *freelist = NULL;       ///< clean free buffers, LRU order, the probationary list with BUFSLRU
+bhead_t *protlist = NULL;       ///< clean free buffers used more than once or metadata, LRU order
+word_t nprot = 0;               ///< number of buffers in protlist
+bhead_t *dirtylist = NULL;      ///< free buffers marked for delayed write, oldest first
+byte_t freewanted = false;      ///< a process sleeps on freelist till a buffer gets free
+byte_t syncwanted = false;      ///< a process sleeps on dirtylist till a write completes
+word_t nmeta = 0;               ///< buffers with a metadata delayed write not taken by a commit yet
+word_t metatime = 0;            ///< ticks when the oldest of them got dirty
+byte_t commitstage = BMNONE;    ///< bmeta_t class the running group commit writes, BMNONE if none runs
+word_t ncommitio = 0;           ///< writes of the current class not completed yet
+byte_t commitwanted = false;    ///< a process sleeps on commitstage till the commit completes
+
+bstat_t bstat;
+bdevstat_t bdevstat[NBSTATDEV];
+
+/// @brief a device with blocks larger than BLOCKSIZE
+typedef struct bdevshift_t {
+  ldev_t dev;
+  byte_t bshift;          ///< 0 if the entry is unused
+} bdevshift_t;
+
+bdevshift_t bdevshift[NBDEVSHIFT];
 
 void sync_buffer_to_disk(bhead_t *b);
 void sync_buffer_from_disk(bhead_t *b);
+void sync_cluster_to_disk(bhead_t **bv, word_t n);
+void sync_cluster_from_disk(bhead_t **bv, word_t n);
+void count_bdevio(ldev_t dev, word_t n, int write);
+void commit_next(void);
+
+/**
+ * @brief unlink b from the circular list *list
+ * 
+ * @param list 
+ * @param b 
+ */
+void blistremove(bhead_t **list, bhead_t *b)
+{
+  if (b == b->fnext)
+    *list = NULL;
+  else {
+    if (b == *list)
+      *list = b->fnext;
+    b->fnext->fprev = b->fprev;
+    b->fprev->fnext = b->fnext;
+  }
+}
+
+
+
+/**
+ * @brief link b into the circular list *list
+ * 
+ * @param list 
+ * @param b 
+ * @param asFirst   true to make it the head (next to be reclaimed) instead of the tail
+ */
+void blistadd(bhead_t **list, bhead_t *b, int asFirst)
+{
+  if (*list) {
+    b->fnext = *list;
+    b->fprev = (*list)->fprev;
+    (*list)->fprev->fnext = b;
+    (*list)->fprev = b;
+    if (asFirst)
+      *list = b;
+  } else {
+    *list = b;
+    b->fnext = b;
+    b->fprev = b;
+  }
+}
+
+
 
 /**
- * @brief remove buffer from free list
+ * @brief remove buffer from free list, or from dirty list if it is marked for delayed write
  * 
  * @param b 
  */
@@ -43,40 +130,199 @@ void remove_buf_from_freelist(bhead_t *b)
   if (!b->infreelist)
     return;
 
-  if (b == b->fnext)
-    freelist = NULL;
-  else {
-    if (b == freelist)
-      freelist = b->fnext;
-    b->fnext->fprev = b->fprev;
-    b->fprev->fnext = b->fnext;
-  }
+  if (b->dwrite)
+    blistremove(&dirtylist, b);
+  else if (b->prot) {
+    blistremove(&protlist, b);
+    b->prot = false;
+    --nprot;
+  } else
+    blistremove(&freelist, b);
 
   b->infreelist = false;
 }
 
 
 
-void add_buf_to_freelist(bhead_t *b, int asFirst)
+/**
+ * @brief add buffer marked for delayed write to dirty list, ordered by the time it got dirty
+ * 
+ * @param b 
+ */
+void add_buf_to_dirtylist(bhead_t *b)
 {
   ASSERT(b);
-  ASSERT(((b->hnext != NULL) ? b->hprev != NULL : b->hprev == NULL));
+  ASSERT(b->dwrite);
   if (b->infreelist)
     return;
-  if (freelist) {
-    b->fnext = freelist;
-    b->fprev = freelist->fprev;
-    freelist->fprev->fnext = b;
-    freelist->fprev = b;
-    if (asFirst)
-      freelist = b;
+  if (dirtylist) {
+    bhead_t *p = dirtylist->fprev;    // usually b is the youngest, search from tail
+    word_t age = ticks - b->dtime;
+    while ((word_t)(ticks - p->dtime) < age) {
+      if (p == dirtylist) {           // b is older than all others
+        p = NULL;
+        break;
+      }
+      p = p->fprev;
+    }
+    if (!p) {
+      p = dirtylist->fprev;
+      dirtylist = b;
+    }
+    b->fprev = p;
+    b->fnext = p->fnext;
+    p->fnext->fprev = b;
+    p->fnext = b;
   } else {
-    freelist = b;
+    dirtylist = b;
     b->fnext = b;
     b->fprev = b;
   }
   b->infreelist = true;
-  wakeall(NOFREEBLOCKS);
+}
+
+
+
+void add_buf_to_freelist(bhead_t *b, int asFirst)
+{
+  ASSERT(b);
+  ASSERT(((b->hnext != NULL) ? b->hprev != NULL : b->hprev == NULL));
+  if (b->infreelist)
+    return;
+#if BUFSLRU
+  if (!asFirst && b->valid && (b->hint != BHSTREAM) && (b->reused || (b->hint == BHMETA))) {
+    blistadd(&protlist, b, false);
+    b->prot = true;
+    ++bstat.promotions;
+    if (++nprot > NBUFPROT) {
+      bhead_t *d = protlist;
+      blistremove(&protlist, d);
+      d->prot = false;
+      d->reused = false;
+      --nprot;
+      blistadd(&freelist, d, false);
+      ++bstat.demotions;
+    }
+  } else
+    blistadd(&freelist, b, asFirst || (b->hint == BHSTREAM));
+#else
+  blistadd(&freelist, b, asFirst || (b->hint == BHSTREAM));
+#endif
+  b->infreelist = true;
+  if (freewanted) {
+    freewanted = false;
+    wakeupon(&freelist);
+  }
+}
+
+
+
+void bhint(bhead_t *b, bhint_t hint)
+{
+  ASSERT(b && b->busy);
+  b->hint = hint;
+}
+
+
+
+/**
+ * @brief start async write of b and the dirty buffers of the blocks adjacent to it
+ * 
+ * The cluster is extended backwards and forwards over free dirty buffers of the
+ * same device, so that up to MAXCLUSTER physically contiguous blocks go to the
+ * driver in one transaction. The buffers are taken from the free list, marked
+ * busy and async, and released again by buffer_synced().
+ * 
+ * @param b           free buffer marked for delayed write
+ * @return bhead_t*   last buffer of the cluster
+ */
+bhead_t *write_cluster(bhead_t *b)
+{
+  bhead_t *bv[MAXCLUSTER];
+  bhead_t *p;
+  word_t n;
+
+  ASSERT(b);
+  ASSERT(b->dwrite && !b->busy);
+  for ( n = 1 ; (n < MAXCLUSTER) && (b->block > 0) ; ++n ) {
+    p = findblk(b->dev, b->block - 1);
+    if (!p || !p->dwrite || p->busy || (p->meta != b->meta))
+      break;
+    b = p;
+  }
+  for ( n = 0 ; n < MAXCLUSTER ; ) {
+    remove_buf_from_freelist(b);
+    b->busy = true;
+    b->async = true;
+    b->written = false;
+    bv[n++] = b;
+    if ((block_t)(b->block + 1) == 0)
+      break;
+    p = findblk(b->dev, b->block + 1);
+    if (!p || !p->dwrite || p->busy || (p->meta != b->meta))
+      break;
+    b = p;
+  }
+  sync_cluster_to_disk(bv, n);
+  return b;
+}
+
+
+
+/**
+ * @brief true while an async write of a buffer of dev (or any device) is in flight
+ * 
+ * @param dev   device or NULL for all devices
+ * @return int 
+ */
+int writeback_pending(ldev_t *dev)
+{
+  for ( int i = 0 ; i < NBUFFER ; ++i ) {
+    bhead_t *b = &bufhead[i];
+    if (b->async && b->valid && (!dev || (b->dev.ldev == dev->ldev)))
+      return true;
+  }
+  return false;
+}
+
+
+
+/**
+ * @brief oldest free buffer with a delayed write of data
+ * 
+ * @param dev     device or NULL for all devices
+ * @return bhead_t*   buffer or NULL if there is none
+ */
+bhead_t *olddata(ldev_t *dev)
+{
+  for ( bhead_t *b = dirtylist ; b ; b = (b->fnext == dirtylist) ? NULL : b->fnext )
+    if (!b->meta && (!dev || (b->dev.ldev == dev->ldev)))
+      return b;
+  return NULL;
+}
+
+
+
+/**
+ * @brief write back dirty buffers of dev (or of all devices), the metadata of all devices with a group commit
+ * 
+ * @param dev     device or NULL for all devices
+ * @param async   if false wait till the buffers are written
+ */
+void flush_dirtylist(ldev_t *dev, int async)
+{
+  bhead_t *b;
+
+  bdevplug();     // let the request queue sort the whole batch
+  while ((b = olddata(dev)) != NULL)
+    write_cluster(b);
+  bdevunplug();
+  bcommit(async);
+  if (!async)
+    while (writeback_pending(dev)) {
+      syncwanted = true;
+      sleepon(&dirtylist, BLOCKWRITE);
+    }
 }
 
 
@@ -84,32 +330,193 @@ void add_buf_to_freelist(bhead_t *b, int asFirst)
 /**
  * @brief sync all buffers
  * 
- * @param async   if true wait for last buffer to be written
+ * @param async   if false wait for the buffers to be written
  */
 void syncall_buffers(int async)
 {
-  bhead_t *b = freelist, *bl = NULL, *bn = NULL;
-  if (!b)
+  flush_dirtylist(NULL, async);
+}
+
+
+
+void syncdev_buffers(ldev_t dev, int async)
+{
+  flush_dirtylist(&dev, async);
+}
+
+
+
+void bflush(void)
+{
+  bhead_t *b;
+  word_t n;
+
+  bdevplug();
+  for ( n = 0 ; (n < BFLUSHBATCH) && ((b = olddata(NULL)) != NULL) ; ++n ) {
+    if ((word_t)(ticks - b->dtime) < BFLUSHAGE)
+      break;
+    write_cluster(b);
+  }
+  bdevunplug();
+  if (nmeta && (((word_t)(ticks - metatime) >= BCOMMITAGE) || (nmeta >= BCOMMITMAX)))
+    bcommit(true);
+}
+
+
+
+/**
+ * @brief held buffer with a metadata delayed write of the first class
+ * 
+ * @return bhead_t*   buffer or NULL if no dirty metadata buffer is held
+ */
+bhead_t *metaheld(void)
+{
+  bhead_t *h = NULL;
+
+  for ( int i = 0 ; i < NBUFFER ; ++i ) {
+    bhead_t *b = &bufhead[i];
+    if (b->meta && b->busy && !b->commit && (!h || (b->meta < h->meta)))
+      h = b;
+  }
+  return h;
+}
+
+
+
+void bcommit(int async)
+{
+  word_t n = 0;
+  bhead_t *h;
+
+  if (!async)
+    while (commitstage != BMNONE) {
+      commitwanted = true;
+      sleepon(&commitstage, BLOCKWRITE);
+    }
+  if ((commitstage != BMNONE) || (nmeta == 0))
     return;
-  freelist = NULL;
-  ASSERT(b->fnext && b->fprev);
-  ASSERT(b->fprev->fnext == b);
-  b->fprev->fnext = NULL;
-  for ( ; b ; b = bn ) {
-    bn = b->fnext;    // remember next buffer, because add_buf_to_freelist will change it
-    ASSERT(b->infreelist == true);
-    ASSERT(b->fnext != b);
-    b->infreelist = false;
-    if (b->dwrite) {
-      sync_buffer_to_disk(b);
-      bl = b;         // remember last buffer if we have to wait for it
-    } else 
-      add_buf_to_freelist(b, false);
+  bmeta_t last = ((h = metaheld()) != NULL) ? h->meta : BMDIR;
+  for ( int i = 0 ; i < NBUFFER ; ++i ) {
+    bhead_t *b = &bufhead[i];
+    if (!b->meta || !b->infreelist || (b->meta > last))
+      continue;       // held buffers and the classes after the first held one go to the next commit
+    remove_buf_from_freelist(b);
+    b->busy = true;
+    b->async = true;
+    b->commit = true;
+    ++n;
+  }
+  nmeta -= n;
+  metatime = ticks;
+  if (n == 0)
+    return;
+  ++bstat.commits;
+  bstat.commitbufs += n;
+  commit_next();
+  if (!async)
+    while (commitstage != BMNONE) {
+      commitwanted = true;
+      sleepon(&commitstage, BLOCKWRITE);
+    }
+}
+
+
+
+/**
+ * @brief write the buffers of the next class of the running group commit
+ * 
+ * The buffers of a class are sorted and written in clusters of contiguous
+ * blocks. The next class is started by buffer_synced() of the last write,
+ * classes without buffers are skipped.
+ * 
+ */
+void commit_next(void)
+{
+  bhead_t *bv[NBUFFER];
+
+  while (++commitstage <= BMDIR) {
+    word_t n = 0;
+    for ( int i = 0 ; i < NBUFFER ; ++i ) {
+      bhead_t *b = &bufhead[i];
+      if (!b->commit || (b->meta != commitstage))
+        continue;
+      word_t j;       // insertion sort by device and block
+      for ( j = n ; (j > 0) && ((bv[j - 1]->dev.ldev > b->dev.ldev) ||
+          ((bv[j - 1]->dev.ldev == b->dev.ldev) && (bv[j - 1]->block > b->block))) ; --j )
+        bv[j] = bv[j - 1];
+      bv[j] = b;
+      ++n;
+    }
+    if (n == 0)
+      continue;
+    TRACE(TRCOMMIT, commitstage, n, 0);
+    ncommitio = n + 1;    // a synchronous driver completes the writes while they are issued
+    bdevplug();
+    for ( word_t i = 0 ; i < n ; ) {
+      word_t k = 1;
+      while ((i + k < n) && (k < MAXCLUSTER) && (bv[i + k]->dev.ldev == bv[i]->dev.ldev) &&
+          (bv[i + k]->block == (block_t)(bv[i]->block + k)))
+        ++k;
+      for ( word_t j = i ; j < i + k ; ++j )
+        bv[j]->written = false;
+      sync_cluster_to_disk(&bv[i], k);
+      i += k;
+    }
+    bdevunplug();
+    if (--ncommitio)
+      return;
+  }
+  commitstage = BMNONE;
+  if (commitwanted) {
+    commitwanted = false;
+    wakeupon(&commitstage);
   }
-  wakeall(NOFREEBLOCKS);
-  if (bl && !async)
-    while (!bl->written)
-      waitfor(BLOCKWRITE);
+}
+
+
+
+int bsetshift(ldev_t dev, byte_t bshift)
+{
+  bdevshift_t *ds = NULL;
+
+  if (bshift > MAXBSHIFT)
+    return -1;
+  for ( int i = 0 ; i < NBDEVSHIFT ; ++i )
+    if (bdevshift[i].bshift && (bdevshift[i].dev.ldev == dev.ldev))
+      ds = &bdevshift[i];
+  if ((ds ? ds->bshift : 0) == bshift)
+    return 0;
+  for ( int i = 0 ; !ds && bshift && (i < NBDEVSHIFT) ; ++i )
+    if (!bdevshift[i].bshift)
+      ds = &bdevshift[i];
+  if (!ds)
+    return -1;
+  flush_dirtylist(&dev, false);
+  for ( int i = 0 ; i < NBUFFER ; ++i ) {
+    bhead_t *b = &bufhead[i];
+    if (!b->hnext || (b->dev.ldev != dev.ldev))
+      continue;
+    ASSERT(!b->busy);
+    remove_buf_from_freelist(b);
+    b->valid = false;
+    b->rahead = false;
+    b->reused = false;
+    b->bshift = bshift;
+    add_buf_to_freelist(b, true);
+  }
+  ds->dev = dev;
+  ds->bshift = bshift;
+  return 0;
+}
+
+
+
+byte_t bgetshift(ldev_t dev)
+{
+  for ( int i = 0 ; i < NBDEVSHIFT ; ++i )
+    if (bdevshift[i].bshift && (bdevshift[i].dev.ldev == dev.ldev))
+      return bdevshift[i].bshift;
+  return 0;
 }
 
 
@@ -124,10 +531,136 @@ void check_bfreelist(void)
 
 
 
+word_t bhashsize(void)
+{
+  return HTABSIZE;
+}
+
+
+
+const bhashstat_t *getbhashstat(word_t chain)
+{
+  ASSERT(chain < HTABSIZE);
+  return &hashstat[chain];
+}
+
+
+
+void dump_bhashstat(void)
+{
+  dword_t lookups = 0, probes = 0;
+
+  kprintf("chain  len   lookups    probes\n");
+  for ( int i = 0 ; i < HTABSIZE ; ++i ) {
+    bhashstat_t *hs = &hashstat[i];
+    kprintf("%5d %4u %9lu %9lu\n", i, hs->len, (unsigned long)hs->lookups, (unsigned long)hs->probes);
+    lookups += hs->lookups;
+    probes += hs->probes;
+  }
+  kprintf("total      %9lu %9lu\n", (unsigned long)lookups, (unsigned long)probes);
+}
+
+
+
+void reset_bhashstat(void)
+{
+  for ( int i = 0 ; i < HTABSIZE ; ++i ) {
+    hashstat[i].lookups = 0;
+    hashstat[i].probes = 0;
+  }
+}
+
+
+
+const bstat_t *getbstat(void)
+{
+  return &bstat;
+}
+
+
+
+const bdevstat_t *getbdevstat(ldev_t dev)
+{
+  for ( int i = 0 ; i < NBSTATDEV ; ++i )
+    if (bdevstat[i].inuse && (bdevstat[i].dev.ldev == dev.ldev))
+      return &bdevstat[i];
+  return NULL;
+}
+
+
+
+/**
+ * @brief add n blocks to the read or write counter of dev
+ * 
+ * @param dev 
+ * @param n 
+ * @param write 
+ */
+void count_bdevio(ldev_t dev, word_t n, int write)
+{
+  bdevstat_t *ds = (bdevstat_t *)getbdevstat(dev);
+  for ( int i = 0 ; !ds && (i < NBSTATDEV) ; ++i )
+    if (!bdevstat[i].inuse) {
+      ds = &bdevstat[i];
+      ds->dev = dev;
+      ds->inuse = true;
+    }
+  if (!ds)
+    return;
+  if (write)
+    ds->writes += n;
+  else
+    ds->reads += n;
+}
+
+
+
+void dump_bstat(void)
+{
+  dword_t lookups = bstat.hits + bstat.misses;
+
+  kprintf("hits %lu misses %lu (%lu%%)\n", (unsigned long)bstat.hits, (unsigned long)bstat.misses,
+    (unsigned long)(lookups ? (100 * bstat.hits) / lookups : 0));
+  kprintf("nofree stalls %lu busy waits %lu forced writes %lu\n", (unsigned long)bstat.nofreestalls,
+    (unsigned long)bstat.busywaits, (unsigned long)bstat.forcedwrites);
+  kprintf("read ahead hits %lu wasted %lu\n", (unsigned long)bstat.rahits, (unsigned long)bstat.rawasted);
+  kprintf("promotions %lu demotions %lu\n", (unsigned long)bstat.promotions, (unsigned long)bstat.demotions);
+  kprintf("commits %lu metadata writes %lu\n", (unsigned long)bstat.commits, (unsigned long)bstat.commitbufs);
+  kprintf("dev      reads    writes\n");
+  for ( int i = 0 ; i < NBSTATDEV ; ++i ) {
+    bdevstat_t *ds = &bdevstat[i];
+    if (ds->inuse)
+      kprintf("%3u,%-3u %7lu %9lu\n", ds->dev.major, ds->dev.minor, (unsigned long)ds->reads, (unsigned long)ds->writes);
+  }
+}
+
+
+
+void reset_bstat(void)
+{
+  mset(&bstat, 0, sizeof(bstat));
+  mset(bdevstat, 0, sizeof(bdevstat));
+}
+
+
+
 void init_buffers(void)
 {
   mset(bufhead, 0, sizeof(bufhead));
   mset(hashtab, 0, sizeof(hashtab));
+  mset(hashstat, 0, sizeof(hashstat));
+  mset(bdevshift, 0, sizeof(bdevshift));
+  freelist = NULL;
+  protlist = NULL;
+  nprot = 0;
+  dirtylist = NULL;
+  freewanted = false;
+  syncwanted = false;
+  nmeta = 0;
+  commitstage = BMNONE;
+  ncommitio = 0;
+  commitwanted = false;
+  reset_bstat();
 
   for ( int i = 0 ; i < NBUFFER ; ++i ) {
     bufhead[i].buf = &buf[i];
@@ -147,7 +680,7 @@ void move_buf_to_hashqueue(bhead_t *b, ldev_t dev, block_t block)
 {
   ASSERT(b);
   ASSERT(((b->hnext != NULL) ? b->hprev != NULL : b->hprev == NULL));
-  bhead_t *p = HTAB(dev, block);
+  bhead_t *p;
 
   b->valid = false;
   b->error = false;
@@ -158,9 +691,13 @@ void move_buf_to_hashqueue(bhead_t *b, ldev_t dev, block_t block)
       HTAB(b->dev, b->block) = b->hnext;
     b->hprev->hnext = b->hnext;
     b->hnext->hprev = b->hprev;
+    hashstat[HTABVALUE(b->dev, b->block)].len--;
   }
   b->dev = dev;
   b->block = block;
+  b->bshift = bgetshift(dev);
+  hashstat[HTABVALUE(dev, block)].len++;
+  p = HTAB(dev, block);   // fetch after unlinking, b may have been head of the same chain
   if (p) {
     b->hprev = p->hprev;
     b->hnext = p;
@@ -174,6 +711,29 @@ void move_buf_to_hashqueue(bhead_t *b, ldev_t dev, block_t block)
 }
 
 
+/**
+ * @brief looks up block from dev in its hash chain
+ * 
+ * @param dev 
+ * @param block 
+ * @return bhead_t* buffer containing block or NULL if block is not in core
+ */
+bhead_t *findblk(ldev_t dev, block_t block)
+{
+  bhashstat_t *hs = &hashstat[HTABVALUE(dev, block)];
+  bhead_t *h = HTAB(dev, block);
+  bhead_t *b;
+
+  hs->lookups++;
+  for ( b = h ; b ; b = (b->hnext == h) ? NULL : b->hnext ) {
+    hs->probes++;
+    if ((b->dev.ldev == dev.ldev) && (b->block == block))
+      break;
+  }
+  return b;
+}
+
+
 /**
  * @brief looks for a buffer containing block from dev in hash or tries to get a free buffer
  * 
@@ -191,16 +751,13 @@ void move_buf_to_hashqueue(bhead_t *b, ldev_t dev, block_t block)
  *     endif
  *   else (no)
  *     if (freelist empty) then (yes)
+ *       : async write oldest\nbuffers of dirty list;
  *       : sleep(event\nany buffer\ngets free);
  *     else (no)
  *       : remove buffer\nfrom free list;
- *       if (buffer marked for\ndelayed write) then (yes)
- *         : async write buffer;
- *       else (no)
- *         : move buffer\nfrom old to\nnew hash queue;
- *         : return buffer;
- *         stop
- *       endif
+ *       : move buffer\nfrom old to\nnew hash queue;
+ *       : return buffer;
+ *       stop
  *     endif
  *   endif
  * repeat while (endless)
@@ -214,29 +771,61 @@ bhead_t *getblk(ldev_t dev, block_t block)
 {
   bhead_t *found = NULL;
   for(;;) {
-    for ( found = HTAB(dev, block) ; found ; found = (found->hnext == HTAB(dev, block)) ? NULL : found->hnext )
-      if ((found->dev.ldev == dev.ldev) && (found->block == block))
-        break;
+    found = findblk(dev, block);
     if (found) {
       if (found->busy) {
-        waitfor(BLOCKBUSY);
+        ++bstat.busywaits;
+        found->wanted = true;
+        sleepon(found, BLOCKBUSY);
         continue;
       }
       found->busy = true;
+      if (!found->dwrite)
+        found->dtime = ticks;
+      if (found->rahead) {      // first use of a read ahead block
+        found->rahead = false;
+        ++bstat.rahits;
+      } else if (found->valid)
+        found->reused = true;
+      found->hint = BHNONE;
       remove_buf_from_freelist(found);
+      ++bstat.hits;
+      TRACE(TRGETBLK, true, dev.ldev, block);
       return found;
     } else {
-      found = freelist;
+      found = (freelist) ? freelist : protlist;
       if (!found) {
-        waitfor(NOFREEBLOCKS);
+        if (dirtylist) {  // no clean buffer left, force out the oldest delayed writes
+          bhead_t *d = dirtylist;
+          ++bstat.forcedwrites;
+          if (d->meta) {
+            dword_t commits = bstat.commits;
+            bcommit(true);  // nothing started if a held buffer stops it, write data instead
+            d = ((bstat.commits == commits) && (commitstage == BMNONE)) ? olddata(NULL) : NULL;
+          }
+          if (d)
+            write_cluster(d);
+        }
+        if (!freelist && !protlist) {
+          ++bstat.nofreestalls;
+          freewanted = true;
+          sleepon(&freelist, NOFREEBLOCKS);
+        }
         continue;
       }
-      remove_buf_from_freelist(found);
-      if (found->dwrite) {
-        sync_buffer_to_disk(found);
-        continue;
+      if (found->rahead) {
+        found->rahead = false;
+        ++bstat.rawasted;
       }
+      ++bstat.misses;
+      TRACE(TRGETBLK, false, dev.ldev, block);
+      if (found->valid)
+        TRACE(TREVICT, found->dev.minor, found->block, block);
+      remove_buf_from_freelist(found);
+      found->reused = false;
+      found->hint = BHNONE;
       found->busy = true;
+      found->dtime = ticks;
       move_buf_to_hashqueue(found, dev, block);
       return found;
     }
@@ -253,9 +842,15 @@ void brelse(bhead_t *b)
 {
   ASSERT(b);
   ASSERT(((b->hnext != NULL) ? b->hprev != NULL : b->hprev == NULL));
-  add_buf_to_freelist(b, !b->valid);
+  if (b->dwrite)
+    add_buf_to_dirtylist(b);
+  else
+    add_buf_to_freelist(b, !b->valid);
   b->busy = false;
-  wakeall(BLOCKBUSY);
+  if (b->wanted) {
+    b->wanted = false;
+    wakeupon(b);
+  }
 }
 
 
@@ -264,17 +859,35 @@ void buffer_synced(bhead_t *b, int err)
 {
   ASSERT(b);
   ASSERT(((b->hnext != NULL) ? b->hprev != NULL : b->hprev == NULL));
+  ldev_t dev = b->dev;
+  int committed = b->commit;
   b->dwrite = false;
+  if (b->commit)
+    b->commit = false;
+  else if (b->meta)
+    --nmeta;
+  b->meta = BMNONE;
   
-  if (!b->busy)
-    add_buf_to_freelist(b, err != 0);
-  
-  if (b->valid)
-    wakeall(BLOCKREAD);
-  else
-    wakeall(BLOCKWRITE);  
+  if (b->wanted) {    // owner waits for the transfer
+    b->wanted = false;
+    wakeupon(b);
+  }
+  if (syncwanted) {
+    syncwanted = false;
+    wakeupon(&dirtylist);
+  }
   
   b->valid = (err == 0);
+
+  if (b->async) {     // nobody waits for this buffer, release it for the initiator
+    b->async = false;
+    brelse(b);
+  } else if (!b->busy)
+    add_buf_to_freelist(b, err != 0);
+
+  bdevdone(dev);
+  if (committed && (--ncommitio == 0))    // last write of the class
+    commit_next();
 }
 
 /**
@@ -289,8 +902,10 @@ void sync_buffer_to_disk(bhead_t *b)
   ASSERT(b->error == false);
   ASSERT(b->valid);
   ASSERT(b->written == false);
-  // ASSERT(b->busy == true);       /// @todo why is this not true?
+  ASSERT(b->busy == true);
   ASSERT(b->infreelist == false);
+  count_bdevio(b->dev, 1, true);
+  TRACE(TRWRITE, 1, b->dev.ldev, b->block);
   bdevstrategy(b->dev, b);
 }
 
@@ -307,10 +922,61 @@ void sync_buffer_from_disk(bhead_t *b)
   ASSERT(b->valid == false);
   ASSERT(b->busy == true);
   ASSERT(b->infreelist == false);
+  count_bdevio(b->dev, 1, false);
+  TRACE(TRREAD, 1, b->dev.ldev, b->block);
   bdevstrategy(b->dev, b);
 }
 
 
+/**
+ * @brief trigger async write of n buffers of contiguous blocks in one driver transaction
+ * 
+ * @param bv  buffers ordered by block number
+ * @param n   number of buffers
+ */
+void sync_cluster_to_disk(bhead_t **bv, word_t n)
+{
+  ASSERT(bv);
+  ASSERT(n > 0 && n <= MAXCLUSTER);
+  for ( word_t i = 0 ; i < n ; ++i ) {
+    ASSERT(bv[i]->valid && !bv[i]->error && !bv[i]->written);
+    ASSERT(bv[i]->busy && !bv[i]->infreelist);
+    ASSERT(bv[i]->dev.ldev == bv[0]->dev.ldev);
+    ASSERT(bv[i]->block == bv[0]->block + i);
+  }
+  count_bdevio(bv[0]->dev, n, true);
+  TRACE(TRWRITE, n, bv[0]->dev.ldev, bv[0]->block);
+  if (n == 1)
+    bdevstrategy(bv[0]->dev, bv[0]);
+  else
+    bdevstrategyv(bv[0]->dev, bv, n);
+}
+
+/**
+ * @brief trigger async load of n buffers of contiguous blocks in one driver transaction
+ * 
+ * @param bv  buffers ordered by block number
+ * @param n   number of buffers
+ */
+void sync_cluster_from_disk(bhead_t **bv, word_t n)
+{
+  ASSERT(bv);
+  ASSERT(n > 0 && n <= MAXCLUSTER);
+  for ( word_t i = 0 ; i < n ; ++i ) {
+    ASSERT(!bv[i]->valid && !bv[i]->error);
+    ASSERT(bv[i]->busy && !bv[i]->infreelist);
+    ASSERT(bv[i]->dev.ldev == bv[0]->dev.ldev);
+    ASSERT(bv[i]->block == bv[0]->block + i);
+  }
+  count_bdevio(bv[0]->dev, n, false);
+  TRACE(TRREAD, n, bv[0]->dev.ldev, bv[0]->block);
+  if (n == 1)
+    bdevstrategy(bv[0]->dev, bv[0]);
+  else
+    bdevstrategyv(bv[0]->dev, bv, n);
+}
+
+
 /**
  * @brief read block into a buffer
  * 
@@ -326,8 +992,10 @@ bhead_t *bread(ldev_t dev, block_t block)
     return b;
 
   sync_buffer_from_disk(b);
-  while (!b->valid && !b->error)
-    waitfor(BLOCKREAD);
+  while (!b->valid && !b->error) {
+    b->wanted = true;
+    sleepon(b, BLOCKREAD);
+  }
 
   return b;
 }
@@ -335,29 +1003,129 @@ bhead_t *bread(ldev_t dev, block_t block)
 
 
 /**
- * @brief reads bl1 and pre loads bl2
+ * @brief true if getblk() can claim a clean free buffer for a read ahead block
+ * 
+ * The buffer it would reclaim must not hold a read ahead block nobody asked
+ * for yet, else a read-ahead evicts the window read ahead before.
+ * 
+ * @return int 
+ */
+int rafree(void)
+{
+  return freelist && !freelist->rahead;
+}
+
+
+
+/**
+ * @brief read block and up to n - 1 following blocks in one driver transaction
+ * 
+ * The cluster ends at the first following block which is already in core or
+ * when no free buffer is left for it, @see rafree. Only the buffer of block
+ * is returned, the others are read asynchronously and released into the cache
+ * when they complete.
+ * 
+ * @param dev 
+ * @param block       first block
+ * @param n           number of contiguous blocks wanted, clipped to MAXCLUSTER
+ * @return bhead_t*   buffer of block
+ */
+bhead_t *breadn(ldev_t dev, block_t block, word_t n)
+{
+  bhead_t *bv[MAXCLUSTER];
+  bhead_t *b = getblk(dev, block);
+  word_t nv = 0;
+
+  if (b->valid)
+    return b;
+
+  bv[nv++] = b;
+  n = MIN(n, MAXCLUSTER);
+  while ((nv < n) && ((block_t)(block + nv) != 0)) {
+    if (findblk(dev, block + nv) || !rafree())
+      break;
+    bhead_t *ba = getblk(dev, block + nv);
+    ba->async = true;
+    ba->rahead = true;
+    bv[nv++] = ba;
+  }
+  sync_cluster_from_disk(bv, nv);
+  while (!b->valid && !b->error) {
+    b->wanted = true;
+    sleepon(b, BLOCKREAD);
+  }
+
+  return b;
+}
+
+
+
+/**
+ * @brief start async read of n blocks from block on without waiting for them
+ * 
+ * Blocks already in core are skipped, the others are clustered into as few
+ * driver transactions as possible. The read-ahead stops as soon as no clean
+ * buffer is free or the next one to reclaim holds an unused read ahead block,
+ * so the caller never blocks and the window is not evicted by itself.
+ * The buffers are released into the cache when the driver completes them.
+ * 
+ * @param dev 
+ * @param block   first block to read ahead
+ * @param n       number of blocks
+ * @return word_t number of blocks from block on in core or being read, less than n if it stopped
+ */
+word_t breadahead(ldev_t dev, block_t block, word_t n)
+{
+  bhead_t *bv[MAXCLUSTER];
+  word_t nv = 0;
+  word_t done;
+
+  for ( done = 0 ; done < n ; ++done ) {
+    if (!findblk(dev, block + done)) {
+      if (!rafree())
+        break;
+      bhead_t *b = getblk(dev, block + done);
+      b->async = true;
+      b->rahead = true;
+      bv[nv++] = b;
+      if ((nv < MAXCLUSTER) && (done + 1 < n))
+        continue;
+    }
+    if (nv) {
+      sync_cluster_from_disk(bv, nv);
+      nv = 0;
+    }
+  }
+  if (nv)
+    sync_cluster_from_disk(bv, nv);
+  return done;
+}
+
+
+
+/**
+ * @brief reads bl1 and starts read-ahead of bl2
  * 
  * @param dev 
  * @param bl1 
- * @param bl2 
+ * @param bl2         block to read ahead, 0 for none
  * @return bhead_t*   buffer for bl1
  */
 bhead_t *breada(ldev_t dev, block_t bl1, block_t bl2)
 {
-  bhead_t *b1, *b2;
+  bhead_t *b1;
 
   b1 = getblk(dev, bl1);
   if (!b1->valid)
     sync_buffer_from_disk(b1);
 
-  b2 = getblk(dev, bl2);
-  if (!b2->valid)
-    sync_buffer_from_disk(b2);
+  if (bl2 && (bl2 != bl1))
+    breadahead(dev, bl2, 1);
 
-  while (!b1->valid && !b1->error)
-    waitfor(BLOCKREAD);
-
-  brelse(b2);   /// @bug potential race condition
+  while (!b1->valid && !b1->error) {
+    b1->wanted = true;
+    sleepon(b1, BLOCKREAD);
+  }
 
   return b1;
 }
@@ -374,10 +1142,123 @@ void bwrite(bhead_t *b)
   ASSERT(b);
   ASSERT(((b->hnext != NULL) ? b->hprev != NULL : b->hprev == NULL));
   ASSERT(b->valid);     /// buffer must be valid
+  ASSERT(b->busy);
   b->written = false;
   if (!b->dwrite) {
     sync_buffer_to_disk(b);
-    while (!b->written && !b->error)
-      waitfor(BLOCKWRITE); 
+    while (!b->written && !b->error) {
+      b->wanted = true;
+      sleepon(b, BLOCKWRITE);
+    }
+  }
+}
+
+
+
+void bdwrite(bhead_t *b, bmeta_t meta)
+{
+  ASSERT(b);
+  ASSERT(b->valid);
+  ASSERT(b->busy && !b->commit);
+  if (meta && !b->meta && (nmeta++ == 0))
+    metatime = ticks;
+  if (meta)
+    b->meta = meta;
+  b->dwrite = true;
+  b->written = false;
+  if (nmeta >= BCOMMITMAX)
+    bcommit(true);
+}
+
+
+
+/**
+ * @brief make the cache consistent with a raw transfer of n blocks from block on
+ * 
+ * Delayed writes of the range are written first. Before a raw write the cached
+ * copies are invalidated, their delayed writes are dropped as they get overwritten.
+ * 
+ * @param dev 
+ * @param block 
+ * @param n 
+ * @param drop    true to invalidate the cached copies
+ */
+void brawsync(ldev_t dev, block_t block, word_t n, int drop)
+{
+  for ( word_t i = 0 ; i < n ; ++i ) {
+    bhead_t *b;
+    while ((b = findblk(dev, block + i)) != NULL) {
+      if (b->busy) {
+        b->wanted = true;
+        sleepon(b, BLOCKBUSY);
+        continue;
+      }
+      if (drop) {
+        remove_buf_from_freelist(b);
+        if (b->meta)
+          --nmeta;
+        b->meta = BMNONE;
+        b->dwrite = false;
+        b->valid = false;
+        b->rahead = false;
+        b->reused = false;
+        add_buf_to_freelist(b, true);
+        break;
+      }
+      if (!b->dwrite)
+        break;
+      if (b->meta) {      // keep the order of the metadata
+        bhead_t *h;
+        bcommit(false);
+        if (b->meta && !b->busy && ((h = metaheld()) != NULL)) {  // an earlier class is held
+          h->wanted = true;
+          sleepon(h, BLOCKBUSY);
+        }
+      } else
+        write_cluster(b);
+    }
+  }
+}
+
+
+
+word_t physio(ldev_t dev, block_t block, byte_t *mem, word_t n, int iswrite)
+{
+  bhead_t bh[MAXCLUSTER];
+  bhead_t *bv[MAXCLUSTER];
+  word_t done = 0;
+  byte_t bshift = bgetshift(dev);
+  sizem_t bsize = (sizem_t)BLOCKSIZE << bshift;
+
+  ASSERT(mem);
+  while (done < n) {
+    word_t nv = MIN((word_t)(n - done), (word_t)MAXCLUSTER);
+    brawsync(dev, block, nv, iswrite);
+    mset(bh, 0, sizeof(bh));
+    for ( word_t i = 0 ; i < nv ; ++i ) {
+      bh[i].buf = (buffer_t *)(mem + i * bsize);
+      bh[i].dev = dev;
+      bh[i].block = block + i;
+      bh[i].bshift = bshift;
+      bh[i].busy = true;
+      bh[i].valid = iswrite;
+      bv[i] = &bh[i];
+    }
+    if (iswrite)
+      sync_cluster_to_disk(bv, nv);
+    else
+      sync_cluster_from_disk(bv, nv);
+    for ( word_t i = 0 ; i < nv ; ++i )
+      while (!(iswrite ? bh[i].written : bh[i].valid) && !bh[i].error) {
+        bh[i].wanted = true;
+        sleepon(&bh[i], iswrite ? BLOCKWRITE : BLOCKREAD);
+      }
+    for ( word_t i = 0 ; i < nv ; ++i )
+      if (bh[i].error)
+        return done + i;
+    done += nv;
+    block += nv;
+    mem += nv * bsize;
   }
+  return done;
 }
@@ -100,9 +100,6 @@
 #include "clist.h"
 #include "utils.h"
 
-#define MAXNODES 100    ///< max number of nodes
-#define MAXCLISTS 20    ///< max number of clists
-
 clist_node_t nodes[MAXNODES];
 byte_t freenode = 0;
 clist_t clists[MAXCLISTS];
@@ -161,9 +158,9 @@ void clist_destroy(byte_t clisti)
   ASSERT(list->head <= MAXNODES);
   ASSERT(list->tail <= MAXNODES);
   ASSERT((list->head == 0) ? (list->tail == 0) : (list->tail != 0));
-  if (list->head != 0) {  // free all referenced nodes
-    nodes[list->tail - 1].next = freenode;
-    freenode = list->head;
+  if (list->head != 0) {  // free all referenced nodes, they are chained from tail to head
+    nodes[list->head - 1].next = freenode;
+    freenode = list->tail;
   }
   list->head = freeclist;
   freeclist = clisti;
@@ -322,3 +319,143 @@ int clist_pop(byte_t clisti, char *data, sizem_t size)
   return 0;
 }
 
+
+
+
+/**
+ * @brief move all data of clist srci to the end of clist dsti, nodes are relinked and not copied
+ * 
+ * @param dsti    clist index of destination
+ * @param srci    clist index of source, empty afterwards
+ * @return int    number of bytes moved
+ */
+int clist_splice(byte_t dsti, byte_t srci)
+{
+  ASSERT(dsti <= MAXCLISTS);
+  ASSERT(srci <= MAXCLISTS);
+  ASSERT(dsti != srci);
+  clist_t *dst = &clists[dsti - 1];
+  clist_t *src = &clists[srci - 1];
+  ASSERT((dst->head == 0) ? (dst->tail == 0) : (dst->tail != 0));
+  ASSERT((src->head == 0) ? (src->tail == 0) : (src->tail != 0));
+  if (src->tail == 0)
+    return 0;
+  if (dst->tail == 0)
+    dst->tail = src->tail;
+  else
+    nodes[dst->head - 1].next = src->tail;
+  dst->head = src->head;
+  int n = src->size;
+  dst->size += n;
+  src->head = src->tail = 0;
+  src->size = 0;
+  return n;
+}
+
+
+
+/**
+ * @brief copy data from clist without removing it
+ * 
+ * @param clisti  clist index
+ * @param offset  number of bytes to skip
+ * @param data    buffer
+ * @param size    size of buffer
+ * @return int    number of bytes copied
+ */
+int clist_peek(byte_t clisti, sizem_t offset, char *data, sizem_t size)
+{
+  ASSERT(clisti <= MAXCLISTS);
+  ASSERT(data);
+  clist_t *list = &clists[clisti - 1];
+  int copied = 0;
+  for ( byte_t i = list->tail ; i && (size > 0) ; i = nodes[i - 1].next ) {
+    clist_node_t *node = &nodes[i - 1];
+    sizem_t len = node->head - node->tail;
+    if (offset >= len) {
+      offset -= len;
+      continue;
+    }
+    sizem_t n = MIN(size, len - offset);
+    mcpy(data, node->data + node->tail + offset, n);
+    offset = 0;
+    size -= n;
+    data += n;
+    copied += n;
+  }
+  return copied;
+}
+
+
+
+/**
+ * @brief position of first character c in clist
+ * 
+ * @param clisti  clist index
+ * @param c       character to search for
+ * @return int    number of bytes before c, -1 if c is not in clist
+ */
+int clist_find(byte_t clisti, char c)
+{
+  ASSERT(clisti <= MAXCLISTS);
+  clist_t *list = &clists[clisti - 1];
+  int pos = 0;
+  for ( byte_t i = list->tail ; i ; i = nodes[i - 1].next ) {
+    clist_node_t *node = &nodes[i - 1];
+    for ( byte_t j = node->tail ; j < node->head ; ++j, ++pos )
+      if (node->data[j] == c)
+        return pos;
+  }
+  return -1;
+}
+
+
+
+/**
+ * @brief contiguous data at the front of clist, for drivers to transfer without copying
+ * 
+ * @param clisti  clist index
+ * @param data    set to the first byte of data in the first node
+ * @return int    number of contiguous bytes at data, 0 if clist is empty
+ */
+int clist_getblock(byte_t clisti, char **data)
+{
+  ASSERT(clisti <= MAXCLISTS);
+  ASSERT(data);
+  clist_t *list = &clists[clisti - 1];
+  if (list->tail == 0)
+    return 0;
+  clist_node_t *node = &nodes[list->tail - 1];
+  *data = node->data + node->tail;
+  return node->head - node->tail;
+}
+
+
+
+/**
+ * @brief remove size bytes from the front of clist, emptied nodes are freed
+ * 
+ * @param clisti  clist index
+ * @param size    number of bytes, at most clist_size()
+ */
+void clist_drop(byte_t clisti, sizem_t size)
+{
+  ASSERT(clisti <= MAXCLISTS);
+  clist_t *list = &clists[clisti - 1];
+  ASSERT(size <= list->size);
+  while (size > 0) {
+    clist_node_t *node = &nodes[list->tail - 1];
+    sizem_t n = MIN(size, (sizem_t)(node->head - node->tail));
+    node->tail += n;
+    size -= n;
+    list->size -= n;
+    if (node->tail == node->head) {
+      byte_t i = node->next;
+      putnode(list->tail);
+      if (i == 0)
+        list->head = list->tail = 0;
+      else
+        list->tail = i;
+    }
+  }
+}
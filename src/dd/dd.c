@@ -19,6 +19,19 @@ extern cdev_t *cdevtable[];
 int nbdeventries = 0;
 int ncdeventries = 0;
 
+bqueue_t bqueue[NBQUEUES];
+byte_t bqplugged = 0;
+
+/// @brief open count of a block device
+typedef struct bdevopen_t {
+  ldev_t dev;
+  byte_t count;         ///< 0 for a free entry
+} bdevopen_t;
+
+bdevopen_t bdevopens[NBDEVOPEN];
+
+#define BQKEY(bh) (((dword_t)(bh)->dev.minor << 16) | (bh)->block)   ///< sort key of a request
+
 
 
 /**
@@ -33,6 +46,10 @@ void init_dd(void)
     if (bdevtable[i]->init)
       bdevtable[i]->init();
   nbdeventries = i;
+  ASSERT(nbdeventries <= NBQUEUES);
+  mset(bqueue, 0, sizeof(bqueue));
+  bqplugged = 0;
+  mset(bdevopens, 0, sizeof(bdevopens));
 
   for (i = 0; cdevtable[i] ; i++)
     if (cdevtable[i]->init)
@@ -41,31 +58,232 @@ void init_dd(void)
 }
 
 
-void bdevopen(ldev_t ldev)
+/**
+ * @brief true if ldev has a block device driver
+ * 
+ * @param ldev  device
+ * @return int 
+ */
+int bdevvalid(ldev_t ldev)
 {
-  ASSERT(ldev.major < nbdeventries);
-  ASSERT(bdevtable[ldev.major]);
+  return (ldev.major < nbdeventries) && bdevtable[ldev.major];
+}
+
 
+/**
+ * @brief open block device ldev, the driver is opened by the first open only
+ * 
+ * @param ldev  device
+ * @return int  0 on success, -1 if ldev has no driver or too many devices are open
+ */
+int bdevopen(ldev_t ldev)
+{
+  bdevopen_t *o = NULL;
+
+  if (!bdevvalid(ldev))
+    return -1;    /// @todo error ENXIO
+  for ( int i = 0 ; i < NBDEVOPEN ; ++i )
+    if (bdevopens[i].count && (bdevopens[i].dev.ldev == ldev.ldev)) {
+      ++bdevopens[i].count;
+      return 0;
+    } else if (!o && !bdevopens[i].count)
+      o = &bdevopens[i];
+  if (!o)
+    return -1;    /// @todo error ENFILE
+  o->dev = ldev;
+  o->count = 1;
   bdevtable[ldev.major]->open(ldev.minor);
+  return 0;
 }
 
 
+/**
+ * @brief close block device ldev, the driver is closed by the last close
+ * 
+ * @param ldev  device, opened by bdevopen()
+ */
 void bdevclose(ldev_t ldev)
 {
-  ASSERT(ldev.major < nbdeventries);
-  ASSERT(bdevtable[ldev.major]);
+  bdevopen_t *o = NULL;
+
+  ASSERT(bdevvalid(ldev));
+  for ( int i = 0 ; i < NBDEVOPEN ; ++i )
+    if (bdevopens[i].count && (bdevopens[i].dev.ldev == ldev.ldev))
+      o = &bdevopens[i];
+  ASSERT(o);
+  if (--o->count == 0)
+    bdevtable[ldev.major]->close(ldev.minor);
+}
 
-  bdevtable[ldev.major]->close(ldev.minor);
+
+/**
+ * @brief insert request into queue of major, ordered by minor and block
+ * 
+ * @param q   request queue
+ * @param bh  buffer to transfer
+ */
+void bqinsert(bqueue_t *q, bhead_t *bh)
+{
+  ASSERT(q);
+  ASSERT(bh);
+  ASSERT(bh->busy && !bh->infreelist);
+  bhead_t *prev = NULL, *p = q->head;
+  while (p && (BQKEY(p) <= BQKEY(bh))) {
+    prev = p;
+    p = p->fnext;
+  }
+  bh->fnext = p;
+  if (prev)
+    prev->fnext = bh;
+  else
+    q->head = bh;
+}
+
+
+/**
+ * @brief take next request from queue, C-LOOK order, merged with adjacent blocks
+ * 
+ * @param q       request queue, not empty
+ * @param bv      receives the buffers of the request
+ * @param max     maximum number of buffers to merge
+ * @return word_t number of buffers in bv
+ */
+word_t bqpull(bqueue_t *q, bhead_t **bv, word_t max)
+{
+  ASSERT(q && q->head);
+  bhead_t *prev = NULL, *b = q->head;
+  word_t n = 0;
+
+  while (b && (BQKEY(b) < q->pos)) {
+    prev = b;
+    b = b->fnext;
+  }
+  if (!b) {                     // nothing above the head position, sweep from lowest
+    prev = NULL;
+    b = q->head;
+  }
+  for (;;) {
+    bv[n++] = b;
+    bhead_t *nx = b->fnext;
+    if ((n >= max) || !nx || (nx->dev.ldev != b->dev.ldev) || 
+        (nx->block != (block_t)(b->block + 1)) || (nx->valid != b->valid))
+      break;
+    b = nx;
+  }
+  if (prev)
+    prev->fnext = b->fnext;
+  else
+    q->head = b->fnext;
+  b->fnext = NULL;
+  q->pos = BQKEY(b) + 1;
+  return n;
 }
 
 
+/**
+ * @brief hand queued requests of major to its driver while it is idle
+ * 
+ * A driver completing synchronously comes back through bdevdone() while the
+ * request is issued, so the queue is drained in this loop without recursion.
+ * 
+ * @param major   block device major
+ */
+void bqrun(ldevmajor_t major)
+{
+  bqueue_t *q = &bqueue[major];
+  bdev_t *bd = bdevtable[major];
+  bhead_t *bv[MAXCLUSTER];
+
+  if (q->running || bqplugged)
+    return;
+  q->running = true;
+  while (q->head && (q->ninflight == 0)) {
+    word_t n = bqpull(q, bv, (bd->strategyv) ? MAXCLUSTER : 1);
+    q->ninflight = n;
+    if (n > 1)
+      bd->strategyv(bv[0]->dev.minor, bv, n);
+    else
+      bd->strategy(bv[0]->dev.minor, bv[0]);
+  }
+  q->running = false;
+}
+
+
+/**
+ * @brief queue buffer bh for transfer by the driver of ldev
+ * 
+ * @param ldev  device
+ * @param bh    buffer, a write if bh->valid is set, otherwise a read
+ */
 void bdevstrategy(ldev_t ldev, bhead_t *bh)
 {
   ASSERT(ldev.major < nbdeventries);
   ASSERT(bh);
   ASSERT(bdevtable[ldev.major]);
 
-  bdevtable[ldev.major]->strategy(ldev.minor, bh);
+  bqinsert(&bqueue[ldev.major], bh);
+  bqrun(ldev.major);
+}
+
+
+/**
+ * @brief queue n buffers of physically contiguous blocks for transfer
+ * 
+ * The queue merges them again, drivers without a vectored strategy get them one by one.
+ * 
+ * @param ldev  device
+ * @param bhv   buffers ordered by block number, all reads or all writes
+ * @param n     number of buffers
+ */
+void bdevstrategyv(ldev_t ldev, bhead_t **bhv, word_t n)
+{
+  ASSERT(ldev.major < nbdeventries);
+  ASSERT(bhv);
+  ASSERT(n > 0);
+  ASSERT(bdevtable[ldev.major]);
+
+  for ( word_t i = 0 ; i < n ; ++i )
+    bqinsert(&bqueue[ldev.major], bhv[i]);
+  bqrun(ldev.major);
+}
+
+
+/**
+ * @brief a buffer of the current request of ldev completed, start next request when all did
+ * 
+ * @param ldev  device
+ */
+void bdevdone(ldev_t ldev)
+{
+  ASSERT(ldev.major < nbdeventries);
+  bqueue_t *q = &bqueue[ldev.major];
+  ASSERT(q->ninflight > 0);
+  if (--q->ninflight == 0)
+    bqrun(ldev.major);
+}
+
+
+/**
+ * @brief hold back requests in the queues, so a batch can be sorted and merged
+ * 
+ */
+void bdevplug(void)
+{
+  ++bqplugged;
+}
+
+
+/**
+ * @brief release requests held back by bdevplug()
+ * 
+ */
+void bdevunplug(void)
+{
+  ASSERT(bqplugged > 0);
+  if (--bqplugged)
+    return;
+  for ( int i = 0 ; i < nbdeventries ; ++i )
+    bqrun(i);
 }
 
 
@@ -13,6 +13,8 @@
 #include "buf.h"
 #include "fs.h"
 #include "pc.h"
+#include "dnlc.h"
+#include "trace.h"
 #include "utils.h"
 
 
@@ -26,9 +28,122 @@ isuperblock_t *getisblock(fsnum_t fs)
   return &isblock[fs - 1];
 }
 
-#define BMAPBLOCK(idx)  (idx / (BLOCKSIZE * 8))
-#define BMAPIDX(idx)    ((idx % (BLOCKSIZE * 8)) / 8)
-#define BMAPMASK(idx)   (byte_t)(1 << (idx % 8))
+
+
+void slock(isuperblock_t *isbk)
+{
+  ASSERT(isbk);
+  while (isbk->locked) {
+    isbk->wanted = true;
+    sleepon(isbk, SBLOCKBUSY);
+  }
+  isbk->locked = true;
+}
+
+
+
+void sunlock(isuperblock_t *isbk)
+{
+  ASSERT(isbk);
+  isbk->locked = false;
+  if (isbk->wanted) {
+    isbk->wanted = false;
+    wakeupon(isbk);
+  }
+}
+
+#define BMAPBITS(isbk)        ((dword_t)SBBSIZE(isbk) * 8)     ///< blocks covered by one bitmap block
+#define BMAPBLOCK(isbk, idx)  ((idx) / BMAPBITS(isbk))
+#define BMAPIDX(isbk, idx)    (((idx) % BMAPBITS(isbk)) / 8)
+#define BMAPMASK(idx)         (byte_t)(1 << ((idx) % 8))
+#define NBMAPBLOCKS(isbk)     (((isbk)->dsblock.nblocks + BMAPBITS(isbk) - 1) / BMAPBITS(isbk))
+#define BMAPFREE(isbk, bh, idx) (!((bh)->buf->mem[BMAPIDX(isbk, idx)] & BMAPMASK(idx)))  ///< free in the bitmap, it may be reserved by an inode
+#define BMAPWORDBITS    (sizeof(dword_t) * 8)
+#define BMAPWORDFULL    ((dword_t)0xFFFFFFFFul)
+
+
+
+/**
+ * @brief count free blocks and set free summary of bitmap blocks from the bitmap
+ * 
+ * @param isbk 
+ */
+void count_free_blocks(isuperblock_t *isbk)
+{
+  isbk->dsblock.nfreeblocks = 0;
+  isbk->dsblock.bmapfree = 0;
+  for ( word_t b = 0 ; b < NBMAPBLOCKS(isbk) ; ++b ) {
+    bhead_t *bh = breadn(isbk->dev, b + isbk->dsblock.bbitmap, NBMAPBLOCKS(isbk) - b);
+    bhint(bh, BHSTREAM);
+    dword_t last = MIN((dword_t)BMAPBITS(isbk), (dword_t)isbk->dsblock.nblocks - (dword_t)b * BMAPBITS(isbk));
+    block_t n = 0;
+    for ( dword_t bit = 0 ; bit < last ; ++bit )
+      if (!(bh->buf->mem[bit / 8] & (1 << (bit % 8))))
+        ++n;
+    brelse(bh);
+    if (n)
+      isbk->dsblock.bmapfree |= 1 << b;
+    isbk->dsblock.nfreeblocks += n;
+  }
+  isbk->modified = true;
+}
+
+
+
+/**
+ * @brief refill fblocks from the bitmap starting at lastfblock and wrapping around
+ * 
+ * Only bitmap blocks marked in bmapfree are read. Fully allocated words and
+ * bytes are skipped at once, bitmap blocks found to be full are cleared in
+ * bmapfree.
+ * 
+ * @param isbk    locked superblock
+ */
+void fill_fblocks(isuperblock_t *isbk)
+{
+  word_t nbmap = NBMAPBLOCKS(isbk);
+  block_t start = (isbk->lastfblock < isbk->dsblock.nblocks) ? isbk->lastfblock : 0;
+  word_t b = BMAPBLOCK(isbk, start);
+  dword_t startbit = start % BMAPBITS(isbk);
+  int n = 0;
+
+  mset(isbk->fblocks, 0, sizeof(isbk->fblocks));
+  for ( word_t i = 0 ; (i <= nbmap) && (n < NFREEBLOCKS) ; ++i, b = (b + 1) % nbmap ) {
+    dword_t first = (i == 0) ? startbit : 0;
+    dword_t last = (i == nbmap) ? startbit : BMAPBITS(isbk);    // last round wraps into start block
+    last = MIN(last, (dword_t)isbk->dsblock.nblocks - (dword_t)b * BMAPBITS(isbk));
+    if ((first >= last) || !(isbk->dsblock.bmapfree & (1 << b)))
+      continue;
+    bhead_t *bh = bread(isbk->dev, b + isbk->dsblock.bbitmap);
+    byte_t *mem = bh->buf->mem;
+    int nfound = 0;
+    for ( dword_t bit = first ; (bit < last) && (n < NFREEBLOCKS) ; ) {
+      if (((bit % BMAPWORDBITS) == 0) && (last - bit >= BMAPWORDBITS) && (((dword_t *)mem)[bit / BMAPWORDBITS] == BMAPWORDFULL)) {
+        bit += BMAPWORDBITS;
+        continue;
+      }
+      if (((bit % 8) == 0) && (last - bit >= 8) && (mem[bit / 8] == 0xFF)) {
+        bit += 8;
+        continue;
+      }
+      if (!(mem[bit / 8] & (1 << (bit % 8)))) {
+        isbk->fblocks[n++] = (dword_t)b * BMAPBITS(isbk) + bit;
+        ++nfound;
+      }
+      ++bit;
+    }
+    if (!nfound)        // full, the scan need not keep it
+      bhint(bh, BHSTREAM);
+    brelse(bh);
+    if (!nfound && (first == 0) && (last == MIN((dword_t)BMAPBITS(isbk), (dword_t)isbk->dsblock.nblocks - (dword_t)b * BMAPBITS(isbk)))) {
+      isbk->dsblock.bmapfree &= ~(1 << b);
+      isbk->modified = true;
+    }
+  }
+  if (n)
+    isbk->lastfblock = isbk->fblocks[n - 1] + 1;
+  isbk->nfblocks = 0;
+}
 
 
 
@@ -51,21 +166,62 @@ fsnum_t init_isblock(ldev_t dev)
   }
   ++fs;
   isuperblock_t *isbk = getisblock(fs);
-  bhead_t *bh = bread(dev, 1);  // read superblock
+  byte_t bshift = bgetshift(dev);
+  bhead_t *bh = bread(dev, SBBLOCK(bshift));  // read superblock
+  bhint(bh, BHMETA);
   if (bh->error) {
+    brelse(bh);
     /// @todo set error reading superblock
     return 0;
   }
   mset(isbk, 0, sizeof(isuperblock_t));
   isbk->fs = fs;
   isbk->dev = dev;
-  mcpy(&isbk->dsblock, bh->buf->mem, sizeof(superblock_t));
+  mcpy(&isbk->dsblock, &bh->buf->mem[SBOFFSET(bshift)], sizeof(superblock_t));
   brelse(bh);
+  if (isbk->dsblock.version < 5)    // bshift field did not exist yet
+    isbk->dsblock.bshift = 0;
+  if ((isbk->dsblock.bshift != bshift) && (bsetshift(dev, isbk->dsblock.bshift) < 0)) {
+    /// @todo set error block size not supported
+    return 0;
+  }
+  ASSERT((sizem_t)NBMAPBLOCKS(isbk) <= sizeof(isbk->dsblock.bmapfree) * 8);
+  if ((isbk->dsblock.version < SBVERSION) || isbk->dsblock.notclean) {
+    count_free_blocks(isbk);
+    count_free_inodes(isbk);
+  }
+  if (isbk->dsblock.version < 4)    // features field did not exist yet
+    isbk->dsblock.features = 0;
+  isbk->dsblock.version = SBVERSION;
+  isbk->dsblock.notclean = true;    // till unmount
+  update_sblock_on_disk(isbk);
   isbk->inuse = true;
   return fs;
 }
 
 
+
+void update_sblock_on_disk(isuperblock_t *isbk)
+{
+  ASSERT(isbk);
+  bhead_t *bh = bread(isbk->dev, SBBLOCK(isbk->dsblock.bshift));
+  bhint(bh, BHMETA);
+  mcpy(&bh->buf->mem[SBOFFSET(isbk->dsblock.bshift)], &isbk->dsblock, sizeof(superblock_t));
+  bdwrite(bh, BMBITMAP);
+  brelse(bh);
+  isbk->modified = false;
+}
+
+
+
+void sync_sblocks(void)
+{
+  for ( fsnum_t fs = 0 ; fs < MAXFS ; ++fs )
+    if (isblock[fs].inuse && isblock[fs].modified)
+      update_sblock_on_disk(&isblock[fs]);
+}
+
+
 /**
  * @brief allocate a block from fs 
  * 
@@ -77,21 +233,23 @@ fsnum_t init_isblock(ldev_t dev)
  * else (no)
  * endif
  * :lock superblock;
- * if (free list empty) then (yes)
- *   :try to refill free list;
- * else (no)
- * endif
- * if (free list empty) then (yes)
- *   :unlock superblock\nwake all unlock superblock\nreturn NULL;
- *   stop
- * else (no)
+ * repeat
+ *   if (free count is 0) then (yes)
+ *     :unlock superblock\nwake all unlock superblock\nreturn NULL;
+ *     stop
+ *   else (no)
+ *   endif
+ *   if (free list empty) then (yes)
+ *     :refill free list from bitmap;
+ *   else (no)
+ *   endif
  *   :get block from free list;
- *   :unlock superblock\nwake all unlock superblock;
- *   :mark block as used in bitmap;
- *   :get buffer for block\nzero buffer\nset buffer as valid;
- *   :return buffer;
- *   stop
- * endif
+ * repeat while (block already marked as used in bitmap)
+ * :mark block as used in bitmap\ndecrement free count;
+ * :unlock superblock\nwake all unlock superblock;
+ * :get buffer for block\nzero buffer\nset buffer as valid;
+ * :return buffer;
+ * stop
  * @enduml
  * 
  * @param fs        file system number
@@ -99,62 +257,184 @@ fsnum_t init_isblock(ldev_t dev)
  */
 bhead_t *balloc(fsnum_t fs)
 {
-  ASSERT(fs < MAXFS);
-
-  block_t bidx, b = 0;
-  int n = 0;
-  bhead_t *bh = NULL;
-  isuperblock_t *isbk = getisblock(fs);
-  while (isbk->locked) {
-    waitfor(SBLOCKBUSY);
+  word_t n = 1;
+  block_t bidx = brun(fs, 0, &n);
+  if (bidx == 0) {
+    /// @todo set error no free blocks in fs
+    return NULL;
   }
-  isbk->locked = true;
+  return bclear(fs, bidx);
+}
 
-  if ((isbk->nfblocks >= NFREEBLOCKS) || (isbk->fblocks[isbk->nfblocks] == 0)) {
-    mset(isbk->fblocks, 0, sizeof(isbk->fblocks));
-    for ( bidx = isbk->lastfblock ; bidx < isbk->dsblock.nblocks ; ++bidx ) {
-      if (!bh || (b != BMAPBLOCK(bidx))) {
-        if (bh) 
-          brelse(bh);
-        b = BMAPBLOCK(bidx);
-        bh = breada(isbk->dev, b + isbk->dsblock.bbitmap, b + 1 + isbk->dsblock.bbitmap);
-      }
-      if (!(bh->buf->mem[BMAPIDX(bidx)] & BMAPMASK(bidx))) {
-        isbk->fblocks[n++] = bidx;
-        if (n >= NFREEBLOCKS)
-          break;
+
+
+/**
+ * @brief take the next free block from the free list of the superblock, caller holds the superblock lock
+ * 
+ * Blocks reserved by inodes are skipped. Once more were skipped than there are
+ * reserved blocks and free list entries, the whole bitmap was gone through and
+ * only reserved blocks are free.
+ * 
+ * @param isbk 
+ * @param pbh       set to the bitmap block of the free block, held
+ * @return block_t  free block, still marked free in the bitmap, 0 if no unreserved block is left
+ */
+block_t bnextfree(isuperblock_t *isbk, bhead_t **pbh)
+{
+  block_t skipped = 0;
+
+  for (;;) {
+    if (isbk->dsblock.nfreeblocks <= isbk->nreserved)
+      return 0;
+    if ((isbk->nfblocks >= NFREEBLOCKS) || (isbk->fblocks[isbk->nfblocks] == 0))
+      fill_fblocks(isbk);
+    block_t bidx = isbk->fblocks[isbk->nfblocks];
+    if (bidx == 0) {    // bitmap has no free bit left, free count was wrong
+      isbk->dsblock.nfreeblocks = 0;
+      isbk->modified = true;
+      continue;
+    }
+    ++isbk->nfblocks;
+    bhead_t *bh = bread(isbk->dev, BMAPBLOCK(isbk, bidx) + isbk->dsblock.bbitmap);
+    bhint(bh, BHMETA);
+    int reserved = false;
+    if (BMAPFREE(isbk, bh, bidx)) {
+      if (iunreserved(isbk->fs, bidx, 1)) {
+        *pbh = bh;
+        return bidx;
       }
+      reserved = true;
     }
-    if (bh) 
+    brelse(bh);         // stale entry of free list
+    if (reserved && (++skipped > isbk->nreserved + NFREEBLOCKS))
+      return 0;
+  }
+}
+
+
+
+/**
+ * @brief find a block of the free list of the superblock followed by n - 1 free blocks, caller holds the superblock lock
+ * 
+ * The entry is left in the free list, it is skipped there as stale once allocated.
+ * 
+ * @param isbk 
+ * @param n 
+ * @param pbh       set to the bitmap block of the run, held
+ * @return block_t  first block of the run, 0 if the free list has no such run
+ */
+block_t bfindrun(isuperblock_t *isbk, word_t n, bhead_t **pbh)
+{
+  bhead_t *bh = NULL;
+  for ( int i = isbk->nfblocks ; (i < NFREEBLOCKS) && isbk->fblocks[i] ; ++i ) {
+    block_t start = isbk->fblocks[i];
+    if ((start + n > isbk->dsblock.nblocks) || (BMAPBLOCK(isbk, start) != BMAPBLOCK(isbk, start + n - 1)))
+      continue;
+    if (bh && (bh->block != BMAPBLOCK(isbk, start) + isbk->dsblock.bbitmap)) {
       brelse(bh);
-    isbk->nfblocks = 0;
+      bh = NULL;
+    }
+    if (!bh) {
+      bh = bread(isbk->dev, BMAPBLOCK(isbk, start) + isbk->dsblock.bbitmap);
+      bhint(bh, BHMETA);
+    }
+    word_t k = 0;
+    while ((k < n) && BMAPFREE(isbk, bh, start + k))
+      ++k;
+    if ((k == n) && (iunreserved(isbk->fs, start, n) == n)) {
+      *pbh = bh;
+      return start;
+    }
   }
+  if (bh)
+    brelse(bh);
+  return 0;
+}
 
-  bidx = isbk->fblocks[isbk->nfblocks];
 
-  if (bidx == 0) {
-    isbk->locked = false;
-    wakeall(SBLOCKBUSY);
-    /// @todo set error no free blocks in fs
-    return NULL;
+
+block_t brun(fsnum_t fs, block_t goal, word_t *n)
+{
+  ASSERT(fs < MAXFS);
+  ASSERT(n && (*n > 0));
+
+  block_t start = 0;
+  bhead_t *bh = NULL;
+  isuperblock_t *isbk = getisblock(fs);
+  slock(isbk);
+
+  if ((goal >= isbk->dsblock.firstblock) && (goal < isbk->dsblock.nblocks) && (isbk->dsblock.nfreeblocks > isbk->nreserved)) {
+    bh = bread(isbk->dev, BMAPBLOCK(isbk, goal) + isbk->dsblock.bbitmap);
+    bhint(bh, BHMETA);
+    if (BMAPFREE(isbk, bh, goal) && iunreserved(fs, goal, 1))
+      start = goal;     // left in the free list of the superblock, it is skipped there as stale
+    else
+      brelse(bh);
   }
+  if (!start && (*n > 1))
+    start = bfindrun(isbk, *n, &bh);
+  if (!start)
+    start = bnextfree(isbk, &bh);
+  if (!start && isbk->nreserved) {    // only reserved blocks are left, take them back
+    idropprealloc(fs);
+    start = bnextfree(isbk, &bh);
+  }
+  if (!start) {
+    sunlock(isbk);
+    *n = 0;
+    return 0;
+  }
+  word_t k = 1;
+  while ((k < *n) && ((block_t)(start + k) < isbk->dsblock.nblocks) &&
+      (BMAPBLOCK(isbk, start + k) == BMAPBLOCK(isbk, start)) && BMAPFREE(isbk, bh, start + k))
+    ++k;
+  k = 1 + iunreserved(fs, start + 1, k - 1);    // free in the bitmap, cut at the run of another inode
+  bh->buf->mem[BMAPIDX(isbk, start)] |= BMAPMASK(start);
+  bdwrite(bh, BMBITMAP);
+  brelse(bh);
+  TRACE(TRBALLOC, k, fs, start);
+  --isbk->dsblock.nfreeblocks;
+  isbk->nreserved += k - 1;
+  if (isbk->dsblock.nfreeblocks == 0)
+    isbk->dsblock.bmapfree = 0;
+  isbk->modified = true;
+  sunlock(isbk);
+  *n = k;
+  return start;
+}
 
-  ++isbk->nfblocks;
-  isbk->lastfblock = bidx;
-  isbk->locked = false;
-  wakeall(SBLOCKBUSY);
 
-  bh = bread(isbk->dev, BMAPBLOCK(bidx) + isbk->dsblock.bbitmap);
-  bh->buf->mem[BMAPIDX(bidx)] |= BMAPMASK(bidx);
-  bh->dwrite = true;
-  bwrite(bh);
+
+int bclaim(fsnum_t fs, block_t bl)
+{
+  isuperblock_t *isbk = getisblock(fs);
+  int rtn = -1;
+
+  slock(isbk);
+  bhead_t *bh = bread(isbk->dev, BMAPBLOCK(isbk, bl) + isbk->dsblock.bbitmap);
+  bhint(bh, BHMETA);
+  if (BMAPFREE(isbk, bh, bl) && iunreserved(fs, bl, 1)) {
+    bh->buf->mem[BMAPIDX(isbk, bl)] |= BMAPMASK(bl);
+    bdwrite(bh, BMBITMAP);
+    TRACE(TRBALLOC, 1, fs, bl);
+    if (--isbk->dsblock.nfreeblocks == 0)
+      isbk->dsblock.bmapfree = 0;
+    isbk->modified = true;
+    rtn = 0;
+  }
   brelse(bh);
+  sunlock(isbk);
+  return rtn;
+}
+
+
 
-  bh = getblk(isbk->dev, bidx);
+bhead_t *bclear(fsnum_t fs, block_t bl)
+{
+  bhead_t *bh = getblk(getisblock(fs)->dev, bl);
   mset(bh->buf->mem, 0, sizeof(bh->buf->mem));
   bh->valid = true;
   bh->dwrite = true;
-
   return bh;
 }
 
@@ -167,45 +447,98 @@ bhead_t *balloc(fsnum_t fs)
  */
 void bfree(fsnum_t fs, block_t  bl)
 {
+  bfreeq_t q;
+  bfreeq_init(&q, fs);
+  bfreeq_add(&q, bl);
+  bfreeq_flush(&q);
+}
+
+
+
+void bfreeq_init(bfreeq_t *q, fsnum_t fs)
+{
+  ASSERT(q);
   ASSERT(fs < MAXFS);
+  q->fs = fs;
+  q->n = 0;
+}
+
+
+
+void bfreeq_add(bfreeq_t *q, block_t bl)
+{
+  ASSERT(q);
   ASSERT(bl > 0);
+  ASSERT(bl < getisblock(q->fs)->dsblock.nblocks);
+  if (q->n >= NBFREEQ)
+    bfreeq_flush(q);
+  q->bl[q->n++] = bl;
+}
 
-  isuperblock_t *isbk = getisblock(fs);
-  int i;
-  ASSERT(bl < isbk->dsblock.nblocks);
-  while (isbk->locked) {
-    waitfor(SBLOCKBUSY);
+
+
+/**
+ * @brief free the queued blocks, every bitmap block is read and written once
+ * 
+ * @startuml
+ * start
+ * :sort queued blocks;
+ * :lock superblock;
+ * while (queued blocks left)
+ *   :read bitmap block of next block;
+ *   :clear bits of all queued blocks in this bitmap block
+increment free count;
+ *   :write bitmap block;
+ * endwhile
+ * :unlock superblock
+wake all unlock superblock;
+ * stop
+ * @enduml
+ * 
+ * @param q 
+ */
+void bfreeq_flush(bfreeq_t *q)
+{
+  ASSERT(q);
+  if (q->n == 0)
+    return;
+  for ( word_t i = 1 ; i < q->n ; ++i ) {     // insertion sort, groups blocks by bitmap block
+    block_t bl = q->bl[i];
+    word_t j;
+    for ( j = i ; (j > 0) && (q->bl[j - 1] > bl) ; --j )
+      q->bl[j] = q->bl[j - 1];
+    q->bl[j] = bl;
   }
-  isbk->locked = true;
 
-  if (isbk->nfblocks >= NFREEBLOCKS) {
-    isbk->nfblocks = NFREEBLOCKS - 1;
-    isbk->fblocks[isbk->nfblocks] = bl;
-  } if (isbk->nfblocks > 0) {
-    if (isbk->fblocks[isbk->nfblocks] > bl) {
-      isbk->fblocks[--isbk->nfblocks] = bl;
-    } else {
-      for ( i = isbk->nfblocks + 1 ; i < NFREEBLOCKS ; ++i )
-        if ((isbk->fblocks[i] > bl) || (isbk->fblocks[i] == 0)) {
-          isbk->fblocks[i] = bl;
-          break;
-        }
+  isuperblock_t *isbk = getisblock(q->fs);
+  slock(isbk);
+
+  for ( word_t i = 0 ; i < q->n ; ) {
+    word_t b = BMAPBLOCK(isbk, q->bl[i]);
+    bhead_t *bh = bread(isbk->dev, b + isbk->dsblock.bbitmap);
+    bhint(bh, BHMETA);
+    int freed = false;
+    for ( ; (i < q->n) && (BMAPBLOCK(isbk, q->bl[i]) == b) ; ++i ) {
+      block_t bl = q->bl[i];
+      if (!(bh->buf->mem[BMAPIDX(isbk, bl)] & BMAPMASK(bl)))
+        continue;     // already free
+      bh->buf->mem[BMAPIDX(isbk, bl)] &= ~BMAPMASK(bl);
+      TRACE(TRBFREE, 0, isbk->fs, bl);
+      ++isbk->dsblock.nfreeblocks;
+      if (isbk->nfblocks > 0)     // reuse it first
+        isbk->fblocks[--isbk->nfblocks] = bl;
+      freed = true;
     }
-  } else {
-      for ( i = 0 ; i < NFREEBLOCKS ; ++i )
-        if ((isbk->fblocks[i] > bl) || (isbk->fblocks[i] == 0)) {
-          isbk->fblocks[i] = bl;
-          break;
-        }
+    if (freed) {
+      bdwrite(bh, BMBITMAP);
+      isbk->dsblock.bmapfree |= 1 << b;
+      isbk->modified = true;
+    }
+    brelse(bh);
   }
-  isbk->locked = false;
-  wakeall(SBLOCKBUSY);
+  q->n = 0;
 
-  bhead_t *bh = bread(isbk->dev, BMAPBLOCK(bl) + isbk->dsblock.bbitmap);
-  bh->buf->mem[BMAPIDX(bl)] &= ~BMAPMASK(bl);
-  bh->dwrite = true;
-  bwrite(bh);
-  brelse(bh);
+  sunlock(isbk);
 }
 
 
@@ -238,6 +571,7 @@ int mounti(ldev_t dev, iinode_t *ii, ninode_t pino, int mflags)
   isbk->pfs = ii->fs;
   isbk->pino = pino;
   isbk->mflags = mflags;
+  ++nsgen;
   return 0;
 }
 
@@ -312,12 +646,17 @@ int unmount(fsnum_t fs)
     /// @todo set error file system still in use
     return -1;
   }
+  isbk->dsblock.notclean = false;
+  update_sblock_on_disk(isbk);
+  syncdev_buffers(isbk->dev, false);
+  dnlc_purgefs(fs);
   isbk->mounted->fsmnt = 0;
   iput(isbk->mounted);
   isbk->mounted = NULL;
   isbk->pfs = 0;
   isbk->pino = 0;
   isbk->inuse = false;
+  ++nsgen;
   return 0;
 }
 
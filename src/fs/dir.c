@@ -0,0 +1,349 @@
+/**
+ * @file dir.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief iterating over directory entries block by block
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "fs.h"
+#include "blocks.h"
+#include "inode.h"
+#include "buf.h"
+#include "utils.h"
+
+#define DIRBSIZE(dir) ((fsize_t)FSBSIZE((dir)->fs))               ///< bytes per block of directory dir
+#define NDIRENTBLOCK(dir) (DIRBSIZE(dir) / sizeof(dirent_t))      ///< directory entries per block
+
+
+
+/**
+ * @brief start iteration over entries of directory dir, the first dirnext() returns the first entry
+ *
+ * @param it
+ * @param dir   directory inode, held by caller
+ */
+void diropen(diriter_t *it, iinode_t *dir)
+{
+  ASSERT(it);
+  ASSERT(dir);
+  ASSERT(dir->dinode.ftype == DIRECTORY);
+  ASSERT(dir->dinode.fsize % sizeof(dirent_t) == 0);
+  it->dir = dir;
+  it->pos = DIRNOFREE;
+  it->bh = NULL;
+  it->de = NULL;
+  it->freepos = DIRNOFREE;
+}
+
+
+
+/**
+ * @brief true if dir uses the hashed layout
+ */
+#define DIRHASHED(dir) ((dir)->dinode.fmode & FHASHDIR)
+
+#define DIRTAILPOS(dir, pos) (((pos) / DIRBSIZE(dir)) * DIRBSIZE(dir) + DIRBSIZE(dir) - sizeof(dirent_t))   ///< position of tail of block of pos
+
+
+
+/**
+ * @brief bucket hash of name
+ *
+ * @param name    name, need not be 0 terminated
+ * @param nlen    length of name
+ * @return word_t
+ */
+word_t dirhash(const char *name, int nlen)
+{
+  word_t h = 0;
+  for ( int i = 0 ; i < nlen ; ++i )
+    h = (h << 5) ^ (h >> 11) ^ (byte_t)name[i];
+  return h;
+}
+
+
+
+/**
+ * @brief position the iterator at the entry at pos, pinning its block
+ *
+ * @param it
+ * @param pos
+ * @return dirent_t*  entry or NULL if no block is assigned to pos
+ */
+dirent_t *dirat(diriter_t *it, fsize_t pos)
+{
+  fsize_t bsize = DIRBSIZE(it->dir);
+  if (!it->bh || (it->pos / bsize != pos / bsize)) {
+    if (it->bh)
+      brelse(it->bh);
+    it->bh = NULL;
+    bmap_t bm = bmaplookup(it->dir, pos);
+    if (bm.fsblock == 0) {
+      it->pos = pos;
+      it->de = NULL;
+      return NULL;
+    }
+    it->bh = breada(LDEVFROMINODE(it->dir), bm.fsblock, bm.rdablock);
+    bhint(it->bh, BHMETA);
+  }
+  it->pos = pos;
+  it->de = &((dirent_t *)it->bh->buf->mem)[(pos % bsize) / sizeof(dirent_t)];
+  return it->de;
+}
+
+
+
+/**
+ * @brief advance to next entry, used and unused ones
+ *
+ * The block of the entry stays pinned till the iterator leaves it or is closed,
+ * so walking a block costs one bmap and one buffer lookup. In hashed directories
+ * block tails and unallocated buckets are skipped.
+ *
+ * @param it
+ * @return dirent_t*  entry or NULL at end of directory
+ */
+dirent_t *dirnext(diriter_t *it)
+{
+  ASSERT(it);
+  int hashed = DIRHASHED(it->dir);
+  for (;;) {
+    fsize_t pos = (it->pos == DIRNOFREE) ? 0 : it->pos + sizeof(dirent_t);
+    if (hashed && (pos == DIRTAILPOS(it->dir, pos)))
+      pos += sizeof(dirent_t);
+    if (pos >= it->dir->dinode.fsize) {
+      dirclose(it);
+      return NULL;
+    }
+    if (dirat(it, pos))
+      break;
+    if (!hashed)      // no block assigned, directory is damaged
+      return NULL;
+    it->pos = DIRTAILPOS(it->dir, pos);    // bucket not allocated yet, continue with next block
+  }
+  if (!hashed && (it->de->inum == 0) && (it->freepos == DIRNOFREE))
+    it->freepos = it->pos;
+  return it->de;
+}
+
+
+
+/**
+ * @brief true if entry de is the used entry named name
+ */
+#define DIRMATCH(de, name, nlen) (((de)->inum > 0) && (sncmp((de)->name, (name), (nlen)) == 0) && (((nlen) == DIRNAMEENTRY) || ((de)->name[(nlen)] == 0)))
+
+
+
+/**
+ * @brief walk the bucket chain of name in a hashed directory
+ *
+ * @param it
+ * @param name
+ * @param nlen
+ * @return dirent_t*  entry or NULL if not found
+ */
+dirent_t *dirfindhashed(diriter_t *it, const char *name, int nlen)
+{
+  dirent_t *de;
+
+  if (((nlen == 1) && (name[0] == '.')) || ((nlen == 2) && (name[0] == '.') && (name[1] == '.'))) {
+    for ( fsize_t pos = 0 ; pos < 2 * sizeof(dirent_t) ; pos += sizeof(dirent_t) )
+      if (((de = dirat(it, pos)) != NULL) && DIRMATCH(de, name, nlen))
+        return de;
+    return NULL;
+  }
+  dirtail_t *t = (dirtail_t *)dirat(it, DIRTAILPOS(it->dir, 0));
+  if (!t || (t->nbuckets == 0))
+    return NULL;
+  dword_t lblock = 1 + dirhash(name, nlen) % t->nbuckets;
+  while (lblock) {
+    fsize_t base = lblock * DIRBSIZE(it->dir);
+    for ( fsize_t pos = base ; pos < DIRTAILPOS(it->dir, base) ; pos += sizeof(dirent_t) ) {
+      if ((de = dirat(it, pos)) == NULL)    // bucket not allocated
+        return NULL;
+      if (DIRMATCH(de, name, nlen))
+        return de;
+      if ((de->inum == 0) && (it->freepos == DIRNOFREE))
+        it->freepos = pos;
+    }
+    lblock = ((dirtail_t *)dirat(it, DIRTAILPOS(it->dir, base)))->next;
+  }
+  return NULL;
+}
+
+
+
+/**
+ * @brief advance to the used entry named name
+ *
+ * If the name is not found freepos is the position a new entry can be
+ * written to, the end of the directory if there is no unused entry.
+ * In hashed directories only the bucket chain of name is searched and
+ * freepos is DIRNOFREE if the chain is full, @see dirslot.
+ *
+ * @param it
+ * @param name    name, need not be 0 terminated
+ * @param nlen    length of name
+ * @return dirent_t*  entry or NULL if not found
+ */
+dirent_t *dirfind(diriter_t *it, const char *name, int nlen)
+{
+  dirent_t *de;
+
+  ASSERT(it && name);
+  if ((nlen <= 0) || (nlen > DIRNAMEENTRY))
+    return NULL;
+  if (DIRHASHED(it->dir))
+    return dirfindhashed(it, name, nlen);
+  while ((de = dirnext(it)) != NULL)
+    if (DIRMATCH(de, name, nlen))
+      return de;
+  if (it->freepos == DIRNOFREE)
+    it->freepos = it->dir->dinode.fsize;
+  return NULL;
+}
+
+
+
+/**
+ * @brief allocate and clear logical block lblock of directory dir
+ *
+ * @param dir
+ * @param lblock
+ * @return int    true on success, false if no blocks are left
+ */
+int dirnewblock(iinode_t *dir, dword_t lblock)
+{
+  bmap_t b = bmap(dir, lblock * DIRBSIZE(dir));
+  if (b.fsblock == 0)
+    return false;
+  bhead_t *bh = getblk(LDEVFROMINODE(dir), b.fsblock);
+  bhint(bh, BHMETA);
+  mset(bh->buf->mem, 0, sizeof(bh->buf->mem));
+  bh->error = false;
+  bh->valid = true;
+  bdwrite(bh, BMDIR);
+  brelse(bh);
+  return true;
+}
+
+
+
+/**
+ * @brief make room for a new entry name in a hashed directory with a full bucket chain
+ *
+ * Allocates the bucket of name or appends an overflow block to its chain.
+ *
+ * @param dir     hashed directory, held by caller
+ * @param name    0 terminated name
+ * @return fsize_t  position of an unused entry or DIRNOFREE if no blocks are left
+ */
+fsize_t dirslot(iinode_t *dir, const char *name)
+{
+  diriter_t it;
+  fsize_t pos = DIRNOFREE;
+  fsize_t bsize = DIRBSIZE(dir);
+
+  ASSERT(dir && name);
+  ASSERT(DIRHASHED(dir));
+  diropen(&it, dir);
+  dirtail_t *t = (dirtail_t *)dirat(&it, DIRTAILPOS(dir, 0));
+  if (!t || (t->nbuckets == 0)) {
+    dirclose(&it);
+    return DIRNOFREE;
+  }
+  dword_t lblock = 1 + dirhash(name, snlen(name, DIRNAMEENTRY)) % t->nbuckets;
+  if (dirat(&it, lblock * bsize) == NULL) {     // first name of bucket
+    if (dirnewblock(dir, lblock))
+      pos = lblock * bsize;
+    dirclose(&it);
+    return pos;
+  }
+  while ((t = (dirtail_t *)dirat(&it, DIRTAILPOS(dir, lblock * bsize)))->next)
+    lblock = t->next;
+  dword_t newlblock = (dir->dinode.fsize + bsize - 1) / bsize;
+  dirclose(&it);      // bmap may need the buffer
+  if (!dirnewblock(dir, newlblock))
+    return DIRNOFREE;
+  t = (dirtail_t *)dirat(&it, DIRTAILPOS(dir, lblock * bsize));
+  t->next = newlblock;
+  dirdirty(&it);
+  dirclose(&it);
+  dir->dinode.fsize = (newlblock + 1) * bsize;
+  dir->modified = true;
+  return newlblock * bsize;
+}
+
+
+
+/**
+ * @brief set up the hashed layout in directory dir, whose block 0 is block0
+ *
+ * @param dir       new directory, held by caller
+ * @param block0    contents of block 0, . and .. are written by the caller
+ */
+void dirinithash(iinode_t *dir, dirent_t *block0)
+{
+  ASSERT(dir && block0);
+  mset(block0, 0, DIRBSIZE(dir));
+  dirtail_t *t = (dirtail_t *)&block0[NDIRENTBLOCK(dir) - 1];
+  t->nbuckets = DIRHASHBUCKETS;
+  dir->dinode.fmode |= FHASHDIR;
+  dir->dinode.fsize = (1 + DIRHASHBUCKETS) * DIRBSIZE(dir);
+}
+
+
+
+/**
+ * @brief write back the block of the current entry after it was modified
+ *
+ * @param it
+ */
+void dirdirty(diriter_t *it)
+{
+  ASSERT(it && it->bh);
+  bdwrite(it->bh, BMDIR);
+}
+
+
+
+/**
+ * @brief release pinned block, may be called more than once
+ *
+ * @param it
+ */
+void dirclose(diriter_t *it)
+{
+  ASSERT(it);
+  if (it->bh)
+    brelse(it->bh);
+  it->bh = NULL;
+  it->de = NULL;
+}
+
+
+
+/**
+ * @brief true if directory dir has no entries but . and ..
+ *
+ * @param dir
+ * @return int
+ */
+int dirempty(iinode_t *dir)
+{
+  diriter_t it;
+  dirent_t *de;
+  int empty = true;
+
+  diropen(&it, dir);
+  while (empty && ((de = dirnext(&it)) != NULL))
+    if ((de->inum > 0) && (sncmp(de->name, ".", DIRNAMEENTRY) != 0) && (sncmp(de->name, "..", DIRNAMEENTRY) != 0))
+      empty = false;
+  dirclose(&it);
+  return empty;
+}
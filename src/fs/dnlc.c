@@ -0,0 +1,208 @@
+/**
+ * @file dnlc.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief directory name lookup cache, maps (fs, directory inode, name) to inode
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "dnlc.h"
+#include "utils.h"
+
+#define DNLCHASHSIZE (1 << DNLCHASHBITS)
+#define DNLCHASHMASK (DNLCHASHSIZE - 1)
+
+dnlcent_t dnlcent[NDNLC];
+dnlcent_t *dnlchash[DNLCHASHSIZE];
+dnlcent_t *dnlclru = NULL;      ///< least recently used entry
+dnlcstat_t dnlcstat;
+
+
+
+/**
+ * @brief hash chain index of name in directory pinum
+ *
+ * @param fs
+ * @param pinum
+ * @param name
+ * @param nlen
+ * @return word_t
+ */
+word_t dnlc_hash(fsnum_t fs, ninode_t pinum, const char *name, int nlen)
+{
+  word_t h = pinum ^ (fs << 5);
+  for ( int i = 0 ; i < nlen ; ++i )
+    h = (h << 3) ^ (h >> 13) ^ (byte_t)name[i];
+  return h & DNLCHASHMASK;
+}
+
+
+
+/**
+ * @brief remove entry from its hash chain and mark it unused
+ *
+ * @param e
+ */
+void dnlc_unhash(dnlcent_t *e)
+{
+  if (!e->fs)
+    return;
+  dnlcent_t *p = dnlchash[dnlc_hash(e->fs, e->pinum, e->name, e->nlen)];
+  if (p == e)
+    dnlchash[dnlc_hash(e->fs, e->pinum, e->name, e->nlen)] = e->hnext;
+  else {
+    while (p->hnext != e)
+      p = p->hnext;
+    p->hnext = e->hnext;
+  }
+  e->hnext = NULL;
+  e->fs = 0;
+}
+
+
+
+/**
+ * @brief move entry to the least or most recently used end of the LRU list
+ *
+ * @param e
+ * @param asFirst   true to make it the next one to be replaced
+ */
+void dnlc_touch(dnlcent_t *e, int asFirst)
+{
+  if (e == dnlclru) {
+    dnlclru = e->lnext;
+  } else {
+    e->lprev->lnext = e->lnext;
+    e->lnext->lprev = e->lprev;
+    e->lnext = dnlclru;
+    e->lprev = dnlclru->lprev;
+    dnlclru->lprev->lnext = e;
+    dnlclru->lprev = e;
+  }
+  if (asFirst)
+    dnlclru = e;
+}
+
+
+
+void init_dnlc(void)
+{
+  mset(dnlcent, 0, sizeof(dnlcent));
+  mset(dnlchash, 0, sizeof(dnlchash));
+  mset(&dnlcstat, 0, sizeof(dnlcstat));
+  for ( int i = 0 ; i < NDNLC ; ++i ) {
+    dnlcent[i].lnext = &dnlcent[(i + 1) % NDNLC];
+    dnlcent[i].lprev = &dnlcent[(i + NDNLC - 1) % NDNLC];
+  }
+  dnlclru = &dnlcent[0];
+}
+
+
+
+/**
+ * @brief find entry of name in directory pinum
+ *
+ * @param fs
+ * @param pinum
+ * @param name
+ * @param nlen
+ * @return dnlcent_t*   entry or NULL
+ */
+dnlcent_t *dnlc_find(fsnum_t fs, ninode_t pinum, const char *name, int nlen)
+{
+  dnlcent_t *e;
+  for ( e = dnlchash[dnlc_hash(fs, pinum, name, nlen)] ; e ; e = e->hnext )
+    if ((e->fs == fs) && (e->pinum == pinum) && (e->nlen == nlen) && (sncmp(e->name, name, nlen) == 0))
+      break;
+  return e;
+}
+
+
+
+int dnlc_lookup(fsnum_t fs, ninode_t pinum, const char *name, int nlen, ninode_t *inum)
+{
+  ASSERT(fs && name && inum);
+  dnlcent_t *e = dnlc_find(fs, pinum, name, nlen);
+  if (!e) {
+    ++dnlcstat.misses;
+    return false;
+  }
+  if (e->inum)
+    ++dnlcstat.hits;
+  else
+    ++dnlcstat.neghits;
+  dnlc_touch(e, false);
+  *inum = e->inum;
+  return true;
+}
+
+
+
+void dnlc_enter(fsnum_t fs, ninode_t pinum, const char *name, int nlen, ninode_t inum)
+{
+  ASSERT(fs && name);
+  if ((nlen <= 0) || (nlen > DIRNAMEENTRY))
+    return;
+  dnlcent_t *e = dnlc_find(fs, pinum, name, nlen);
+  if (!e) {
+    e = dnlclru;
+    dnlc_unhash(e);
+    e->fs = fs;
+    e->pinum = pinum;
+    e->nlen = nlen;
+    sncpy(e->name, name, nlen);
+    word_t h = dnlc_hash(fs, pinum, name, nlen);
+    e->hnext = dnlchash[h];
+    dnlchash[h] = e;
+  }
+  e->inum = inum;
+  dnlc_touch(e, false);
+}
+
+
+
+void dnlc_remove(fsnum_t fs, ninode_t pinum, const char *name)
+{
+  ASSERT(name);
+  dnlcent_t *e = dnlc_find(fs, pinum, name, snlen(name, DIRNAMEENTRY));
+  if (e) {
+    dnlc_unhash(e);
+    dnlc_touch(e, true);
+  }
+}
+
+
+
+void dnlc_purgedir(fsnum_t fs, ninode_t pinum)
+{
+  for ( int i = 0 ; i < NDNLC ; ++i ) {
+    dnlcent_t *e = &dnlcent[i];
+    if ((e->fs == fs) && (e->pinum == pinum)) {
+      dnlc_unhash(e);
+      dnlc_touch(e, true);
+    }
+  }
+}
+
+
+
+void dnlc_purgefs(fsnum_t fs)
+{
+  for ( int i = 0 ; i < NDNLC ; ++i ) {
+    dnlcent_t *e = &dnlcent[i];
+    if (e->fs == fs) {
+      dnlc_unhash(e);
+      dnlc_touch(e, true);
+    }
+  }
+}
+
+
+
+const dnlcstat_t *getdnlcstat(void)
+{
+  return &dnlcstat;
+}
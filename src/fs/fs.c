@@ -17,6 +17,8 @@
 #include "utils.h"
 #include "buf.h"
 #include "pc.h"
+#include "dnlc.h"
+#include "dd.h"
 
 
 
@@ -28,6 +30,8 @@ typedef struct {    ///< @see igetpdir
 
 
 filetab_t filetab[MAXFILETAB];  ///< file table
+filetab_t *ftabfree = NULL;     ///< free file table entries, last freed first
+word_t nsgen = 0;
 
 
 
@@ -38,6 +42,11 @@ filetab_t filetab[MAXFILETAB];  ///< file table
 void init_fs()
 {
   mset(filetab, 0, sizeof(filetab));
+  ftabfree = NULL;
+  for ( int i = MAXFILETAB - 1 ; i >= 0 ; --i ) {
+    filetab[i].fnext = ftabfree;
+    ftabfree = &filetab[i];
+  }
 }
 
 
@@ -45,20 +54,27 @@ void init_fs()
 /**
  * @brief get empty file system entry and assign inode
  * 
+ * Taken from the free list, fails at once if the table is full (ENFILE).
+ * 
  * @param ii inode
- * @return int file system number
+ * @return int file system number or -1 if no entry is free
  */
 int getftabent(iinode_t* ii)
 {
   ASSERT(ii != NULL);
-  for (int i = 0; i < MAXFILETAB; i++) {
-    if (filetab[i].inode == NULL) {
-      filetab[i].inode = ii;
-      filetab[i].refs = 1;
-      return i;
-    }
-  }
-  return -1;
+  filetab_t *ft = ftabfree;
+  if (!ft)
+    return -1;    /// @todo error ENFILE
+  ASSERT(ft->inode == NULL);
+  ftabfree = ft->fnext;
+  ft->fnext = NULL;
+  ft->inode = ii;
+  ft->refs = 1;
+  ft->raoffset = 0;
+  ft->ralblock = 0;
+  ft->rawin = 0;
+  ft->flags = 0;
+  return ft - filetab;
 }
 
 
@@ -74,27 +90,75 @@ void putftabent(int f)
   ASSERT(filetab[f].inode != NULL);
   filetab[f].refs--;
   if (filetab[f].refs == 0) {
+    if (filetab[f].inode->dinode.ftype == FIFO)
+      fifoclose(filetab[f].inode, filetab[f].flags);
+    else if (filetab[f].inode->dinode.ftype == BLOCK)
+      bdevclose(filetab[f].inode->dinode.ldev);
     iput(filetab[f].inode);
     filetab[f].inode = NULL;
-    /// @todo potentional race condition if another process is waiting for a free filetab entry
+    filetab[f].fnext = ftabfree;    // nobody waits, getftabent() does not sleep
+    ftabfree = &filetab[f];
   }
 } 
 
 
 
+#if MAXOPENFILES > 16
+#error fdused has a bit per file descriptor
+#endif
+
+#define FDALL ((word_t)((1ul << MAXOPENFILES) - 1))   ///< fdused with all descriptors in use
+
+
+
 /**
- * @brief get free file descriptor
+ * @brief get free file descriptor, the lowest one
  * 
- * @return int  file descriptor
+ * @return int  file descriptor or -1 if all are in use (EMFILE)
  */
 int freefdesc(void)
 {
-  for (int i = 0; i < MAXOPENFILES; i++) {
-    if (active->u->fdesc[i].ftabent == NULL) {
-      return i;
-    }
-  }
-  return -1;
+  static const byte_t lowbit[16] = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };  ///< lowest set bit of a nibble
+  word_t freefd = ~active->u->fdused & FDALL;
+  int fdesc = 0;
+
+  if (!freefd)
+    return -1;
+  for ( ; !(freefd & 0xf) ; freefd >>= 4 )
+    fdesc += 4;
+  return fdesc + lowbit[freefd & 0xf];
+}
+
+
+
+/**
+ * @brief install file table entry ft as file descriptor fdesc of the active process
+ * 
+ * @param fdesc   free file descriptor
+ * @param ft 
+ * @param omode 
+ */
+void setfdesc(int fdesc, filetab_t *ft, omode_t omode)
+{
+  ASSERT(fdesc >= 0 && fdesc < MAXOPENFILES);
+  ASSERT(!active->u->fdesc[fdesc].ftabent);
+  active->u->fdesc[fdesc].ftabent = ft;
+  active->u->fdesc[fdesc].omode = omode;
+  active->u->fdused |= 1 << fdesc;
+}
+
+
+
+/**
+ * @brief free file descriptor fdesc of the active process, its file table entry is not released
+ * 
+ * @param fdesc 
+ */
+void clearfdesc(int fdesc)
+{
+  ASSERT(fdesc >= 0 && fdesc < MAXOPENFILES);
+  active->u->fdesc[fdesc].ftabent = NULL;
+  active->u->fdused &= ~(1 << fdesc);
 }
 
 
@@ -130,37 +194,25 @@ int unlinki(iinode_t *ipdir, const char *bname)
   ASSERT(ipdir);
   ASSERT(bname);
   ASSERT(ipdir->dinode.ftype == DIRECTORY);
-  ASSERT(ipdir->dinode.fsize % sizeof(dirent_t) == 0);
-  int n = ipdir->dinode.fsize / sizeof(dirent_t);
-  int bl = snlen(bname, sizeof(DIRNAMEENTRY));
-  for (int i = 0; i < n; i++) {
-    bmap_t b = bmap(ipdir, i * sizeof(dirent_t));
-    ASSERT(b.fsblock > 0);
-    bhead_t *bh = bread(LDEVFROMINODE(ipdir), b.fsblock);
-    dirent_t *de = (dirent_t *)&bh->buf->mem[b.offblock];
-    if (sncmp(de->name, bname, bl) == 0) {
-      iinode_t *ii = iget(ipdir->fs, de->inum);
-      if (ii == NULL) {
-        brelse(bh);
-        return -1;   // error already set by iget
-      }
-      while(ii->locked) {
-        waitfor(INODELOCKED);
-      }
-      ii->locked = true;
-      ii->dinode.nlinks--;
-      ii->modified = true;
-      ii->locked = false;
-      wakeall(INODELOCKED);
-      iput(ii);
-      de->inum = 0;
-      bh->dwrite = true;
-      bwrite(bh);
-      brelse(bh);
-      break;
+  diriter_t it;
+  dnlc_remove(ipdir->fs, ipdir->inum, bname);
+  diropen(&it, ipdir);
+  dirent_t *de = dirfind(&it, bname, snlen(bname, DIRNAMEENTRY));
+  if (de) {
+    iinode_t *ii = iget(ipdir->fs, de->inum);
+    if (ii == NULL) {
+      dirclose(&it);
+      return -1;   // error already set by iget
     }
-    brelse(bh);
+    ilock(ii);
+    ii->dinode.nlinks--;
+    ii->modified = true;
+    iunlock(ii);
+    iput(ii);
+    de->inum = 0;
+    dirdirty(&it);
   }
+  dirclose(&it);
   return 0;
 }
 
@@ -228,44 +280,45 @@ int linki(iinode_t *ii, const char *newpath)
   ASSERT(pi != NULL);
   ASSERT(pi->dinode.ftype == DIRECTORY);
   ASSERT(pi->dinode.fsize % sizeof(dirent_t) == 0);
-  int n = pi->dinode.fsize / sizeof(dirent_t);
-  for (int i = 0; i <= n; i++) {  // find free entry, therefore <= n, if no unused entry found, i == n and bmap will allocate a new block if necessary
-    bmap_t b = bmap(pi, i * sizeof(dirent_t));
-    if (b.fsblock == 0) {  // no new blocks left on device
-      iput(pi);
-      return -1;
-    }
-    bhead_t *bh = bread(LDEVFROMINODE(pi), b.fsblock);
-    dirent_t *de = (dirent_t *)&bh->buf->mem[b.offblock];
-    if (de->inum == 0) {
-      de->inum = ii->inum;
-      sncpy(de->name, basename(newpath), DIRNAMEENTRY);
-      while (ii->locked) {
-        waitfor(INODELOCKED);
-      }
-      ii->locked = true;      
-      ii->dinode.nlinks++;
-      ii->modified = true;
-      ii->locked = false;
-      wakeall(INODELOCKED);
-      bh->dwrite = true;
-      bwrite(bh);
-      brelse(bh);
-      if (i == n) { // new directory entry
-        while(pi->locked) {
-          waitfor(INODELOCKED);
-        }
-        pi->locked = true;
-        pi->dinode.fsize += sizeof(dirent_t);
-        pi->modified = true;
-        pi->locked = false;
-        wakeall(INODELOCKED);
-      }
-      /// @todo reset error if necessary
-      break;
-    }
-    brelse(bh);
+  dnlc_remove(pi->fs, pi->inum, basename(newpath));   // drop negative entry
+  fsize_t pos = in.pfree;
+  if (pos == DIRNOFREE) {     // namei answered from name cache, search free entry
+    diriter_t it;
+    diropen(&it, pi);
+    dirfind(&it, basename(newpath), snlen(basename(newpath), DIRNAMEENTRY));
+    dirclose(&it);
+    pos = it.freepos;
+  }
+  if (pos == DIRNOFREE)       // bucket chain of hashed directory is full
+    pos = dirslot(pi, basename(newpath));
+  if (pos == DIRNOFREE) {
+    iput(pi);
+    return -1;
+  }
+  bmap_t b = bmap(pi, pos);   // allocates a new block if entry is appended at block boundary
+  if (b.fsblock == 0) {  // no new blocks left on device
+    iput(pi);
+    return -1;
   }
+  bhead_t *bh = bread(LDEVFROMINODE(pi), b.fsblock);
+  bhint(bh, BHMETA);
+  dirent_t *de = (dirent_t *)&bh->buf->mem[b.offblock];
+  ASSERT((pos >= pi->dinode.fsize) || (de->inum == 0));
+  de->inum = ii->inum;
+  sncpy(de->name, basename(newpath), DIRNAMEENTRY);
+  ilock(ii);
+  ii->dinode.nlinks++;
+  ii->modified = true;
+  iunlock(ii);
+  bdwrite(bh, BMDIR);
+  brelse(bh);
+  if (pos >= pi->dinode.fsize) { // new directory entry
+    ilock(pi);
+    pi->dinode.fsize = pos + sizeof(dirent_t);
+    pi->modified = true;
+    iunlock(pi);
+  }
+  /// @todo reset error if necessary
   iput(pi);
   return 0;
 }
@@ -313,11 +366,31 @@ int link(const char *path, const char *newpath)
  * @return int    0 on success, -1 on error
  */
 int mknode(const char *path, ftype_t ftype, fmode_t fmode)
+{
+  return mknodedev(path, ftype, fmode, (ldev_t){{0, 0}});
+}
+
+
+
+/**
+ * @brief make node, a special file refers to device dev
+ * 
+ * @param path    path
+ * @param ftype   file type
+ * @param fmode   file mode
+ * @param dev     device of a CHARACTER or BLOCK file, ignored otherwise
+ * @return int    0 on success, -1 on error
+ */
+int mknodedev(const char *path, ftype_t ftype, fmode_t fmode, ldev_t dev)
 {
   if (!path || (ftype != REGULAR && ftype != DIRECTORY && ftype != CHARACTER && ftype != BLOCK && ftype != FIFO)) {
     /// @todo error invalid parameters
     return -1;
   }
+  if ((ftype == BLOCK) && !bdevvalid(dev)) {
+    /// @todo error ENXIO
+    return -1;
+  }
   namei_t in = namei(path);
   if (in.i != NULL) {
     iput(in.i);
@@ -330,11 +403,15 @@ int mknode(const char *path, ftype_t ftype, fmode_t fmode)
   if (pi == NULL)
     return -1;   // error already set by iget
 
-  iinode_t *ii = ialloc(in.fs, ftype, fmode);
+  iinode_t *ii = ialloc(in.fs, ftype, fmode & ~FHASHDIR);
   if (ii == NULL) {
     iput(pi);
     return -1;   // error already set by ialloc
   }
+  if ((ftype == CHARACTER) || (ftype == BLOCK)) {
+    ii->dinode.ldev = dev;
+    ii->modified = true;
+  }
 
   int rtn = linki(ii, path);
   iput(ii);
@@ -377,30 +454,25 @@ int mkdir(const char *path, fmode_t fmode)
     return -1;
   }
   bhead_t *bh = bread(LDEVFROMINODE(in.i), b.fsblock);
+  bhint(bh, BHMETA);
   dirent_t *de = (dirent_t *)bh->buf->mem;
+  if (getisblock(in.fs)->dsblock.features & SBFHASHDIR)
+    dirinithash(in.i, de);
   de[0].inum = in.i->inum;
   sncpy(de[0].name, ".", sizeof(DIRNAMEENTRY));
   de[1].inum = pi->inum;
   sncpy(de[1].name, "..", sizeof(DIRNAMEENTRY));
-  while(in.i->locked) {
-    waitfor(INODELOCKED);
-  }
-  in.i->locked = true;
-  in.i->dinode.fsize = 2 * sizeof(dirent_t);
+  ilock(in.i);
+  if (!(in.i->dinode.fmode & FHASHDIR))
+    in.i->dinode.fsize = 2 * sizeof(dirent_t);
   in.i->dinode.nlinks++;
   in.i->modified = true;
-  in.i->locked = false;
-  wakeall(INODELOCKED);
-  while(pi->locked) {
-    waitfor(INODELOCKED);
-  }
-  pi->locked = true;
+  iunlock(in.i);
+  ilock(pi);
   pi->dinode.nlinks++;
   pi->modified = true;
-  pi->locked = false;
-  wakeall(INODELOCKED);
-  bh->dwrite = true;
-  bwrite(bh);
+  iunlock(pi);
+  bdwrite(bh, BMDIR);
   brelse(bh);
   iput(in.i);
   iput(pi);
@@ -432,7 +504,7 @@ int rmdir(const char *path)
     iput(in.i);
     return -1;
   }
-  if (in.i->dinode.nlinks > 3) {
+  if (!dirempty(in.i)) {
     /// @todo error directory not empty
     iput(in.i);
     return -1;
@@ -444,6 +516,8 @@ int rmdir(const char *path)
   }
   unlinki(in.i, ".");
   unlinki(in.i, "..");
+  dnlc_purgedir(in.i->fs, in.i->inum);
+  ++nsgen;
   iput(in.i);
   int rtn = unlinki(pi, basename(path));
   iput(pi);
@@ -468,7 +542,7 @@ int open(const char *fname, omode_t omode, fmode_t fmode)
   }
   int fdesc = freefdesc();
   if (fdesc < 0) {
-    /// @todo error no free filetab entry
+    /// @todo error EMFILE
     return -1;
   }
   namei_t in = namei(fname);
@@ -489,24 +563,30 @@ int open(const char *fname, omode_t omode, fmode_t fmode)
     iput(in.i);
     return -1;
   }
+  if ((in.i->dinode.ftype == BLOCK) && (bdevopen(in.i->dinode.ldev) < 0)) {
+    iput(in.i);
+    return -1;   // error already set by bdevopen
+  }
   int f = getftabent(in.i);
   if (f < 0) {
+    if (in.i->dinode.ftype == BLOCK)
+      bdevclose(in.i->dinode.ldev);
     iput(in.i);
-    /// @todo error no free filetab entry
+    /// @todo error ENFILE
     /// @todo remove node if created
     return -1;
   }
+  filetab[f].flags = omode;
+  if ((in.i->dinode.ftype == FIFO) && (fifoopen(in.i, omode) < 0)) {
+    filetab[f].flags = 0;
+    putftabent(f);
+    return -1;
+  }
   if (in.i->dinode.ftype == REGULAR) {
     if (omode & OTRUNC) {
-      while(in.i->locked) {
-        waitfor(INODELOCKED);
-      }
-      in.i->locked = true;
-      free_all_blocks(in.i);
-      in.i->dinode.fsize = 0;
-      in.i->modified = true;
-      in.i->locked = false;
-      wakeall(INODELOCKED);
+      ilock(in.i);
+      itrunc(in.i, 0);
+      iunlock(in.i);
     }
     if (omode & OAPPEND) {
       filetab[f].offset = in.i->dinode.fsize;
@@ -514,8 +594,7 @@ int open(const char *fname, omode_t omode, fmode_t fmode)
       filetab[f].offset = 0;
     }
   }
-  active->u->fdesc[fdesc].ftabent = &filetab[f];
-  active->u->fdesc[fdesc].omode = omode;
+  setfdesc(fdesc, &filetab[f], omode);
   return fdesc;
 }
 
@@ -533,146 +612,303 @@ int close(int fdesc)
     /// @todo error invalid file descriptor
     return -1;
   }
-  putftabent(fdesc);
-  active->u->fdesc[fdesc].ftabent = NULL;
+  putftabent(active->u->fdesc[fdesc].ftabent - filetab);
+  clearfdesc(fdesc);
   return 0;
 }
 
 
 
 /**
- * @brief write buf to file
+ * @brief number of blocks from file position pos on, which follow fsblock physically
  * 
- * @param fdesc   file descriptor  
- * @param buf     buffer   
- * @param nbytes  number of bytes to write
- * @return int    number of bytes written, -1 on error
+ * @param ii        inode
+ * @param pos       file position mapped to fsblock
+ * @param fsblock   block in fs pos is mapped to
+ * @param nbytes    number of bytes which will be accessed from pos on
+ * @return word_t   number of contiguous blocks including fsblock, at most MAXCLUSTER
  */
-int write(int fdesc, byte_t *buf, fsize_t nbytes)
+word_t contigblocks(iinode_t *ii, fsize_t pos, block_t fsblock, fsize_t nbytes)
 {
-  int written = 0;
-  if (fdesc < 0 || fdesc >= MAXOPENFILES || !active->u->fdesc[fdesc].ftabent) {
-    /// @todo error invalid file descriptor
-    return -1;
-  }
-  if (buf == NULL) {
-    /// @todo error invalid buffer
-    return -1;
+  ASSERT(ii);
+  word_t n = 1;
+  fsize_t end = pos + nbytes;
+  fsize_t bsize = FSBSIZE(ii->fs);
+
+  for ( pos = (pos / bsize + 1) * bsize ; (n < MAXCLUSTER) && (pos < end) ; pos += bsize, ++n )
+    if (bmaplookup(ii, pos).fsblock != (block_t)(fsblock + n))
+      break;
+  return n;
+}
+
+
+
+/**
+ * @brief start async read-ahead of the window behind a sequential read ending at end
+ * 
+ * The window is mapped with bmaplookup() ahead of time and physically contiguous
+ * runs are handed to breadahead() as clusters. Blocks read ahead before are skipped.
+ * When the cache has no buffer left for the window, the rest of it is tried
+ * again by the next read.
+ * 
+ * @param ft    file table entry of the read
+ * @param end   file position the read ends at
+ */
+void readahead(filetab_t *ft, fsize_t end)
+{
+  ASSERT(ft);
+  iinode_t *ii = ft->inode;
+  fsize_t bsize = FSBSIZE(ii->fs);
+  dword_t lb = (end + bsize - 1) / bsize;
+  dword_t last = MIN(lb + ft->rawin, (ii->dinode.fsize + bsize - 1) / bsize);
+  dword_t startlb = 0;    // logical block of start
+  block_t start = 0;
+  word_t n = 0;
+  word_t got;
+
+  for ( lb = MAX(lb, ft->ralblock) ; lb < last ; ++lb ) {
+    block_t fsblock = bmaplookup(ii, lb * bsize).fsblock;
+    if (fsblock && n && (fsblock == (block_t)(start + n)) && (n < MAXCLUSTER)) {
+      ++n;
+      continue;
+    }
+    if (n && ((got = breadahead(LDEVFROMINODE(ii), start, n)) < n)) {
+      ft->ralblock = MAX(ft->ralblock, startlb + got);
+      return;
+    }
+    startlb = lb;
+    start = fsblock;
+    n = (fsblock) ? 1 : 0;
   }
-  if (!(active->u->fdesc[fdesc].omode & OWRITE)) {
-    /// @todo error file not open for writing
-    return -1;
+  if (n && ((got = breadahead(LDEVFROMINODE(ii), start, n)) < n))
+    last = startlb + got;
+  ft->ralblock = MAX(ft->ralblock, last);
+}
+
+
+
+/**
+ * @brief copy between segments and the blocks of regular file ii from offset on, caller locks ii
+ * 
+ * @param ft      file table entry, keeps read-ahead state
+ * @param iov     segments
+ * @param iovcnt  number of segments
+ * @param offset  file position, advanced by the number of bytes copied
+ * @param iswrite true to write the segments to the file, false to read into them
+ * @param sync    write through instead of delayed write
+ * @param fptr    true for a transfer at the file pointer, false for a positional one
+ *                which neither uses nor changes the read-ahead state of ft
+ * @return int    number of bytes copied
+ */
+int rwblocks(filetab_t *ft, const iovec_t *iov, int iovcnt, fsize_t *offset, int iswrite, int sync, int fptr)
+{
+  iinode_t *ii = ft->inode;
+  fsize_t bsize = FSBSIZE(ii->fs);
+  int done = 0;
+  fsize_t pos = *offset;
+  fsize_t end = pos;      // end of read, read-ahead starts behind it
+  int first = true;
+  int seq = false;        // sequential read at the file pointer
+
+  if (!iswrite && fptr) {
+    for ( int v = 0 ; v < iovcnt ; ++v )
+      end += iov[v].len;
+    end = MIN(end, MAX(pos, ii->dinode.fsize));
+    if (pos == ft->raoffset) {    // sequential, widen read-ahead window
+      ft->rawin = (ft->rawin) ? MIN(2 * ft->rawin, MAXREADAHEAD) : 1;
+      seq = true;
+    } else {
+      ft->rawin = 0;
+      ft->ralblock = 0;
+    }
   }
-  iinode_t *ii = active->u->fdesc[fdesc].ftabent->inode;
-  switch(ii->dinode.ftype) {
-    case REGULAR:
-      while(ii->locked) {
-        waitfor(INODELOCKED);
-      }
-      ii->locked = true;
-      while(nbytes) {
-        bmap_t b = bmap(ii, active->u->fdesc[fdesc].ftabent->offset);
-        if (b.fsblock == 0) {  // no new blocks left on device
-          ii->locked = false;
-          wakeall(INODELOCKED);
-          return written;
-        }
-        bhead_t *bh = bread(LDEVFROMINODE(ii), b.fsblock);
-        sizem_t n = MIN(nbytes, b.nbytesleft);
+  for ( int v = 0 ; v < iovcnt ; ++v ) {
+    byte_t *buf = iov[v].base;
+    fsize_t nbytes = iov[v].len;
+    if (!iswrite)
+      nbytes = (pos < ii->dinode.fsize) ? MIN(nbytes, ii->dinode.fsize - pos) : 0;
+    while(nbytes) {
+      bmap_t b = iswrite ? bmap(ii, pos) : bmaplookup(ii, pos);
+      sizem_t n = MIN(nbytes, b.nbytesleft);
+      bhead_t *bh;
+      if (b.fsblock == 0) {
+        if (iswrite)        // no new blocks left on device
+          break;
+        mset(buf, 0, n);    // hole, reads as zeros
+      } else if (iswrite) {
+        if (b.newblock || (n == bsize) || ((b.offblock == 0) && (pos >= ii->dinode.fsize))) {
+          bh = getblk(LDEVFROMINODE(ii), b.fsblock);    // nothing worth reading in the block
+          if (!bh->valid) {
+            if (n < bsize)
+              mset(bh->buf->mem, 0, sizeof(bh->buf->mem));
+            bh->error = false;
+            bh->valid = true;
+          }
+        } else
+          bh = bread(LDEVFROMINODE(ii), b.fsblock);
+        if (n == bsize)     // written in one go, not likely used again soon
+          bhint(bh, BHSTREAM);
         mcpy(&bh->buf->mem[b.offblock], buf, n);
-        bh->dwrite = !(active->u->fdesc[fdesc].omode & OSYNC);
+        bh->dwrite = !sync;
         bwrite(bh);
         brelse(bh);
-        nbytes -= n;
-        buf += n;
-        written += n;
-        active->u->fdesc[fdesc].ftabent->offset += n;
-        if (active->u->fdesc[fdesc].ftabent->offset > ii->dinode.fsize) {
-          ii->dinode.fsize = active->u->fdesc[fdesc].ftabent->offset;
-          ii->modified = true;
-        }
+      } else {
+        if (n < nbytes)   // request continues in next block, cluster the contiguous part
+          bh = breadn(LDEVFROMINODE(ii), b.fsblock, contigblocks(ii, pos, b.fsblock, nbytes));
+        else
+          bh = bread(LDEVFROMINODE(ii), b.fsblock);
+        if (seq)                  // sequential read
+          bhint(bh, BHSTREAM);
+        if (seq && first)         // overlap read-ahead with copy-out
+          readahead(ft, end);
+        first = false;
+        mcpy(buf, &bh->buf->mem[b.offblock], n);
+        brelse(bh);
       }
+      nbytes -= n;
+      buf += n;
+      done += n;
+      pos += n;
+    }
+    if (nbytes)
+      break;
+  }
+  if (iswrite) {
+    if (pos > ii->dinode.fsize)
+      ii->dinode.fsize = pos;
+    if (done)
       ii->modified = true;
-      ii->locked = false;
-      wakeall(INODELOCKED);
-      return written;
-    case CHARACTER:
-      /// @todo error is character device
-      return -1;
-    case BLOCK:
-      /// @todo error is block device
-      return -1;
-    case FIFO:
-      /// @todo error fifo
-      return -1;
-    default:
-      /// @todo error invalid file type
-      return -1;
+  } else if (fptr)
+    ft->raoffset = pos;
+  *offset = pos;
+  return done;
+}
+
+
+
+/**
+ * @brief transfer between the segments of iov and block device dev from offset on
+ * 
+ * Whole blocks go straight between the caller's memory and the driver, @see physio,
+ * partial blocks at the ends of a segment through the buffer cache.
+ * 
+ * @param dev     device
+ * @param iov     segments
+ * @param iovcnt  number of segments
+ * @param offset  position on the device, advanced by the bytes transferred
+ * @param iswrite true to write, false to read
+ * @return int    number of bytes transferred, -1 if nothing could be transferred
+ */
+int rwdev(ldev_t dev, const iovec_t *iov, int iovcnt, fsize_t *offset, int iswrite)
+{
+  int total = 0;
+  fsize_t bsize = (fsize_t)BLOCKSIZE << bgetshift(dev);
+  const dword_t nblocks = (dword_t)(block_t)~0 + 1;   // block numbers a device can have
+
+  for ( int v = 0 ; v < iovcnt ; ++v ) {
+    byte_t *p = iov[v].base;
+    fsize_t len = iov[v].len;
+    while (len > 0) {
+      dword_t bl = *offset / bsize;
+      fsize_t off = *offset % bsize;
+      fsize_t n;
+      if (bl >= nblocks)                // would wrap to the start of the device
+        return total ? total : -1;      /// @todo error ENXIO
+      if ((off == 0) && (len >= bsize)) {
+        word_t nbl = (word_t)MIN(MIN(len / bsize, (fsize_t)MAXCLUSTER), nblocks - bl);
+        word_t ndone = physio(dev, bl, p, nbl, iswrite);
+        n = (fsize_t)ndone * bsize;
+        if (ndone < nbl) {
+          total += n;
+          *offset += n;
+          return total ? total : -1;    /// @todo error device error
+        }
+      } else {
+        n = MIN(bsize - off, len);
+        bhead_t *bh = bread(dev, bl);
+        if (bh->error) {
+          bh->error = false;
+          brelse(bh);
+          return total ? total : -1;    /// @todo error device error
+        }
+        if (iswrite) {
+          mcpy(bh->buf->mem + off, p, n);
+          bh->dwrite = true;
+          bwrite(bh);
+        } else
+          mcpy(p, bh->buf->mem + off, n);
+        brelse(bh);
+      }
+      p += n;
+      len -= n;
+      total += n;
+      *offset += n;
+    }
   }
+  return total;
 }
 
 
 
 /**
- * @brief read file to buf
+ * @brief common part of read(), write() and their positional and vectored variants
  * 
- * @param fdesc   file descriptor  
- * @param buf     buffer   
- * @param nbytes  number of bytes to read
- * @return int    number of bytes read, -1 on error
+ * The descriptor is resolved and the inode locked once for all segments.
+ * 
+ * @param fdesc   file descriptor
+ * @param iov     segments
+ * @param iovcnt  number of segments
+ * @param poffset file position to use, NULL to use and advance the file pointer
+ * @param iswrite true to write, false to read
+ * @return int    number of bytes transferred, -1 on error
  */
-int read(int fdesc, byte_t *buf, fsize_t nbytes)
+int rdwr(int fdesc, const iovec_t *iov, int iovcnt, fsize_t *poffset, int iswrite)
 {
-  int read = 0;
   if (fdesc < 0 || fdesc >= MAXOPENFILES || !active->u->fdesc[fdesc].ftabent) {
     /// @todo error invalid file descriptor
     return -1;
   }
-  if (buf == NULL) {
+  if (!iov || (iovcnt < 0) || (iovcnt > MAXIOV)) {
     /// @todo error invalid buffer
     return -1;
   }
-  if (!(active->u->fdesc[fdesc].omode & OREAD)) {
-    /// @todo error file not open for reading
+  for ( int v = 0 ; v < iovcnt ; ++v )
+    if (iov[v].base == NULL) {
+      /// @todo error invalid buffer
+      return -1;
+    }
+  if (!(active->u->fdesc[fdesc].omode & (iswrite ? OWRITE : OREAD))) {
+    /// @todo error file not open for reading or writing
     return -1;
   }
-  iinode_t *ii = active->u->fdesc[fdesc].ftabent->inode;
-  sizem_t maxleft = ii->dinode.fsize - active->u->fdesc[fdesc].ftabent->offset;
-  nbytes = MIN(nbytes, maxleft);
+  filetab_t *ft = active->u->fdesc[fdesc].ftabent;
+  iinode_t *ii = ft->inode;
+  fsize_t offset = poffset ? *poffset : ft->offset;
+  int rtn;
   switch(ii->dinode.ftype) {
     case REGULAR:
-      while(ii->locked) {
-        waitfor(INODELOCKED);
-      }
-      ii->locked = true;
-      while(nbytes) {
-        bmap_t b = bmap(ii, active->u->fdesc[fdesc].ftabent->offset);
-        if (b.fsblock == 0) {  // no new blocks left on device
-          ii->locked = false;
-          wakeall(INODELOCKED);
-          return read;
-        }
-        bhead_t *bh = bread(LDEVFROMINODE(ii), b.fsblock);
-        sizem_t n = MIN(nbytes, b.nbytesleft);
-        mcpy(buf, &bh->buf->mem[b.offblock], n);
-        brelse(bh);
-        nbytes -= n;
-        buf += n;
-        read += n;
-        active->u->fdesc[fdesc].ftabent->offset += n;
-      }
-      ii->locked = false;
-      wakeall(INODELOCKED);
-      return read;
+      ilock(ii);
+      rtn = rwblocks(ft, iov, iovcnt, &offset, iswrite, active->u->fdesc[fdesc].omode & OSYNC, !poffset);
+      if (!poffset)
+        ft->offset = offset;
+      iunlock(ii);
+      return rtn;
     case CHARACTER:
       /// @todo error is character device
       return -1;
     case BLOCK:
-      /// @todo error is block device
-      return -1;
+      if (!bdevvalid(ii->dinode.ldev)) {
+        /// @todo error ENXIO
+        return -1;
+      }
+      rtn = rwdev(ii->dinode.ldev, iov, iovcnt, &offset, iswrite);
+      if (!poffset)
+        ft->offset = offset;
+      return rtn;
     case FIFO:
-      /// @todo error fifo
-      return -1;
+      if (iswrite)
+        return fifowrite(ii, iov, iovcnt, active->u->fdesc[fdesc].omode & ONONBLOCK);
+      return fiforead(ii, iov, iovcnt, active->u->fdesc[fdesc].omode & ONONBLOCK);
     default:
       /// @todo error invalid file type
       return -1;
@@ -681,6 +917,102 @@ int read(int fdesc, byte_t *buf, fsize_t nbytes)
 
 
 
+/**
+ * @brief read file to buf
+ * 
+ * @param fdesc   file descriptor  
+ * @param buf     buffer   
+ * @param nbytes  number of bytes to read
+ * @return int    number of bytes read, -1 on error
+ */
+int read(int fdesc, byte_t *buf, fsize_t nbytes)
+{
+  iovec_t iov = {buf, nbytes};
+  return rdwr(fdesc, &iov, 1, NULL, false);
+}
+
+
+
+/**
+ * @brief write buf to file
+ * 
+ * @param fdesc   file descriptor  
+ * @param buf     buffer   
+ * @param nbytes  number of bytes to write
+ * @return int    number of bytes written, -1 on error
+ */
+int write(int fdesc, byte_t *buf, fsize_t nbytes)
+{
+  iovec_t iov = {buf, nbytes};
+  return rdwr(fdesc, &iov, 1, NULL, true);
+}
+
+
+
+/**
+ * @brief read file at offset to buf, the file pointer is not moved
+ * 
+ * @param fdesc   file descriptor  
+ * @param buf     buffer   
+ * @param nbytes  number of bytes to read
+ * @param offset  file position
+ * @return int    number of bytes read, -1 on error
+ */
+int pread(int fdesc, byte_t *buf, fsize_t nbytes, fsize_t offset)
+{
+  iovec_t iov = {buf, nbytes};
+  return rdwr(fdesc, &iov, 1, &offset, false);
+}
+
+
+
+/**
+ * @brief write buf to file at offset, the file pointer is not moved
+ * 
+ * @param fdesc   file descriptor  
+ * @param buf     buffer   
+ * @param nbytes  number of bytes to write
+ * @param offset  file position
+ * @return int    number of bytes written, -1 on error
+ */
+int pwrite(int fdesc, byte_t *buf, fsize_t nbytes, fsize_t offset)
+{
+  iovec_t iov = {buf, nbytes};
+  return rdwr(fdesc, &iov, 1, &offset, true);
+}
+
+
+
+/**
+ * @brief read file to iovcnt buffers one after the other
+ * 
+ * @param fdesc   file descriptor  
+ * @param iov     buffers
+ * @param iovcnt  number of buffers, at most MAXIOV
+ * @return int    number of bytes read, -1 on error
+ */
+int readv(int fdesc, const iovec_t *iov, int iovcnt)
+{
+  return rdwr(fdesc, iov, iovcnt, NULL, false);
+}
+
+
+
+/**
+ * @brief write iovcnt buffers one after the other to file
+ * 
+ * @param fdesc   file descriptor  
+ * @param iov     buffers
+ * @param iovcnt  number of buffers, at most MAXIOV
+ * @return int    number of bytes written, -1 on error
+ */
+int writev(int fdesc, const iovec_t *iov, int iovcnt)
+{
+  return rdwr(fdesc, iov, iovcnt, NULL, true);
+}
+
+
+
 /**
  * @brief seek in file
  * 
@@ -699,10 +1031,8 @@ int lseek(int fdesc, fsize_t offset, seek_t whence)
   iinode_t *ii = active->u->fdesc[fdesc].ftabent->inode;
   switch(ii->dinode.ftype) {
     case REGULAR:
-      while(ii->locked) {
-        waitfor(INODELOCKED);
-      }
-      ii->locked = true;
+    case BLOCK:
+      ilock(ii);
       switch(whence) {
         case SEEKSET:
           active->u->fdesc[fdesc].ftabent->offset = offset;
@@ -715,19 +1045,14 @@ int lseek(int fdesc, fsize_t offset, seek_t whence)
           break;
         default:
           /// @todo error invalid whence
-          ii->locked = false;
-          wakeall(INODELOCKED);
+          iunlock(ii);
           return -1;
       }
-      ii->locked = false;
-      wakeall(INODELOCKED);
+      iunlock(ii);
       return active->u->fdesc[fdesc].ftabent->offset;
     case CHARACTER:
       /// @todo error is character device
       return -1;
-    case BLOCK:
-      /// @todo error is block device
-      return -1;
     case FIFO:
       /// @todo error fifo
       return -1;
@@ -799,7 +1124,7 @@ void _stat(iinode_t *i, stat_t *statbuf)
   ASSERT(statbuf);
   statbuf->ftype = i->dinode.ftype;
   statbuf->fsize = i->dinode.fsize;
-  statbuf->fmode = i->dinode.fmode;
+  statbuf->fmode = i->dinode.fmode & ~FHASHDIR;
   statbuf->nlinks = i->dinode.nlinks;
   statbuf->uid = i->dinode.uid;
   statbuf->gid = i->dinode.gid;
@@ -877,15 +1202,73 @@ int chown(const char *path, user_t uid, group_t gid)
     /// @todo error link does not exists
     return -1;
   }
-  while(in.i->locked) {
-    waitfor(INODELOCKED);
-  }
-  in.i->locked = true;
+  ilock(in.i);
   in.i->dinode.uid = uid;
   in.i->dinode.gid = gid;
   in.i->modified = true;
-  in.i->locked = false;
-  wakeall(INODELOCKED);
+  iunlock(in.i);
+  iput(in.i);
+  return 0;
+}
+
+
+
+/**
+ * @brief truncate or extend open file to length
+ * 
+ * @param fdesc   file descriptor, open for writing
+ * @param length  new file size
+ * @return int    0 on success, -1 on error
+ */
+int ftruncate(int fdesc, fsize_t length)
+{
+  if (fdesc < 0 || fdesc >= MAXOPENFILES || !active->u->fdesc[fdesc].ftabent) {
+    /// @todo error invalid file descriptor
+    return -1;
+  }
+  if (!(active->u->fdesc[fdesc].omode & OWRITE)) {
+    /// @todo error file not open for writing
+    return -1;
+  }
+  iinode_t *ii = active->u->fdesc[fdesc].ftabent->inode;
+  if (ii->dinode.ftype != REGULAR) {
+    /// @todo error not a regular file
+    return -1;
+  }
+  ilock(ii);
+  itrunc(ii, length);
+  iunlock(ii);
+  return 0;
+}
+
+
+
+/**
+ * @brief truncate or extend file path to length
+ * 
+ * @param path    path
+ * @param length  new file size
+ * @return int    0 on success, -1 on error
+ */
+int truncate(const char *path, fsize_t length)
+{
+  if (!path) {
+    /// @todo error invalid path
+    return -1;
+  }
+  namei_t in = namei(path);
+  if (in.i == NULL) {
+    /// @todo error link does not exists
+    return -1;
+  }
+  if (in.i->dinode.ftype != REGULAR) {
+    /// @todo error not a regular file
+    iput(in.i);
+    return -1;
+  }
+  ilock(in.i);
+  itrunc(in.i, length);
+  iunlock(in.i);
   iput(in.i);
   return 0;
 }
@@ -910,20 +1293,59 @@ int chmod(const char *path, fmode_t fmode)
     /// @todo error link does not exists
     return -1;
   }
-  while(in.i->locked) {
-    waitfor(INODELOCKED);
-  }
-  in.i->locked = true;
-  in.i->dinode.fmode = fmode;
+  ilock(in.i);
+  in.i->dinode.fmode = (fmode & ~FHASHDIR) | (in.i->dinode.fmode & FHASHDIR);
   in.i->modified = true;
-  in.i->locked = false;
-  wakeall(INODELOCKED);
+  iunlock(in.i);
   iput(in.i);
   return 0;
 }
 
 
 
+/**
+ * @brief apply path to the cached working directory path cwd, . and .. are resolved textually
+ * 
+ * @param cwd     absolute path without . and .., updated in place
+ * @param path    absolute or relative path
+ * @return int    0 on success, -1 if the result does not fit
+ */
+int cwdjoin(char *cwd, const char *path)
+{
+  char res[MAXPATH];
+  sizem_t len = 0;
+
+  if (*path != '/') {
+    len = snlen(cwd, MAXPATH);
+    if ((len == 1) && (cwd[0] == '/'))
+      len = 0;
+    mcpy(res, cwd, len);
+  }
+  while (*path) {
+    while (*path == '/')
+      ++path;
+    sizem_t ps;
+    for ( ps = 0 ; path[ps] && (path[ps] != '/') ; ++ps );
+    if ((ps == 2) && (path[0] == '.') && (path[1] == '.')) {
+      while ((len > 0) && (res[--len] != '/'));
+    } else if ((ps > 0) && !((ps == 1) && (path[0] == '.'))) {
+      if (len + 1 + ps >= MAXPATH)
+        return -1;
+      res[len++] = '/';
+      mcpy(&res[len], (void *)path, ps);
+      len += ps;
+    }
+    path += ps;
+  }
+  if (len == 0)
+    res[len++] = '/';
+  res[len] = 0;
+  mcpy(cwd, res, len + 1);
+  return 0;
+}
+
+
+
 /**
  * @brief change directory
  * 
@@ -948,6 +1370,11 @@ int chdir(const char *path)
   }
   iput(active->u->workdir);
   active->u->workdir = in.i;
+  if ((*path != '/') && (!active->u->cwd[0] || (active->u->cwdgen != nsgen)))
+    active->u->cwd[0] = 0;    // relative to an unknown path
+  else if (cwdjoin(active->u->cwd, path) < 0)
+    active->u->cwd[0] = 0;
+  active->u->cwdgen = nsgen;
   return 0;
 }
 
@@ -977,6 +1404,7 @@ int chroot(const char *path)
   }
   iput(active->u->fsroot);
   active->u->fsroot = in.i;
+  active->u->cwd[0] = 0;      // workdir relative to the new root is not known
   return 0;
 }
 
@@ -996,15 +1424,69 @@ int dup(int fdesc)
   }
   int fdesc2 = freefdesc();
   if (fdesc2 < 0) {
-    /// @todo error no free filetab entry
+    /// @todo error EMFILE
     return -1;
   }
-  active->u->fdesc[fdesc2] = active->u->fdesc[fdesc];
+  setfdesc(fdesc2, active->u->fdesc[fdesc].ftabent, active->u->fdesc[fdesc].omode);
   active->u->fdesc[fdesc2].ftabent->refs++;
   return fdesc2;
 }
 
 
+
+/**
+ * @brief create a pipe, fdesc[0] is the end to read from, fdesc[1] the end to write to
+ *
+ * The pipe is an unnamed FIFO inode on the root file system of the process.
+ *
+ * @param fdesc
+ * @return int    0 on success, -1 on error
+ */
+int pipe(int fdesc[2])
+{
+  ASSERT(fdesc);
+  iinode_t *ii = ialloc(active->u->fsroot->fs, FIFO, 0600);
+  if (ii == NULL)
+    return -1;    // error already set by ialloc
+  int r = getftabent(ii);
+  if (r < 0) {
+    /// @todo error ENFILE
+    iput(ii);
+    return -1;
+  }
+  ++ii->nref;     // second file table entry
+  int w = getftabent(ii);
+  if (w < 0) {
+    /// @todo error ENFILE
+    --ii->nref;
+    putftabent(r);
+    return -1;
+  }
+  if (fifoopen(ii, ORDWR) < 0) {
+    putftabent(w);
+    putftabent(r);
+    return -1;
+  }
+  filetab[r].flags = OREAD;
+  filetab[w].flags = OWRITE;
+  fdesc[0] = freefdesc();
+  if (fdesc[0] >= 0)
+    setfdesc(fdesc[0], &filetab[r], OREAD);
+  fdesc[1] = freefdesc();
+  if ((fdesc[0] < 0) || (fdesc[1] < 0)) {
+    /// @todo error EMFILE
+    if (fdesc[0] >= 0)
+      clearfdesc(fdesc[0]);
+    putftabent(w);
+    putftabent(r);
+    return -1;
+  }
+  setfdesc(fdesc[1], &filetab[w], OWRITE);
+  return 0;
+}
+
+
+
 /**
  * @brief get parent inode of directory (another directory)
  * 
@@ -1031,14 +1513,14 @@ pdir_t igetpdir(iinode_t *ii)
       return rtn;
     } 
   }
-  bmap_t b = bmap(ii, 1 * sizeof(dirent_t));    // 2nd entry in directory
-  ASSERT(b.fsblock > 0);
-  bhead_t *bh = bread(LDEVFROMINODE(ii), b.fsblock);
-  dirent_t *de = (dirent_t *)&bh->buf->mem[b.offblock];
-  ASSERT(de->inum > 0);
+  diriter_t it;
+  diropen(&it, ii);
+  dirnext(&it);
+  dirent_t *de = dirnext(&it);    // 2nd entry in directory
+  ASSERT(de && (de->inum > 0));
   ASSERT(sncmp(de->name, "..", DIRNAMEENTRY) == 0);
   rtn.pi = iget(ii->fs, de->inum);
-  brelse(bh);
+  dirclose(&it);
   ASSERT(rtn.pi);
   rtn.child = ii->inum;
   return rtn;
@@ -1059,6 +1541,16 @@ char *getcwd(char *buf, sizem_t len)
     /// @todo error invalid buffer
     return NULL;
   }
+  u_t *u = active->u;
+  if (u->cwd[0] && (u->cwdgen == nsgen)) {
+    sizem_t n = snlen(u->cwd, MAXPATH);
+    if (n >= len) {
+      /// @todo error buffer too small
+      return NULL;
+    }
+    mcpy(buf, u->cwd, n + 1);
+    return buf;
+  }
   iinode_t *ii = iget(active->u->workdir->fs, active->u->workdir->inum);
   ASSERT(ii);
   buf[--len] = '\0';
@@ -1073,30 +1565,27 @@ char *getcwd(char *buf, sizem_t len)
     ASSERT(p.child > 0);
     iput(ii);
     ii = p.pi;
-    int n = ii->dinode.fsize / sizeof(dirent_t);
-    ASSERT(n >= 2);
+    ASSERT(ii->dinode.fsize >= 2 * sizeof(dirent_t));
     int found = false;
-    for (int i = 0; i < n; i++) {
-      bmap_t b = bmap(ii, i * sizeof(dirent_t));
-      ASSERT(b.fsblock > 0);
-      bhead_t *bh = bread(LDEVFROMINODE(ii), b.fsblock);    /// @todo can be optimized 
-      dirent_t *de = (dirent_t *)&bh->buf->mem[b.offblock];
-      if (de->inum == p.child) {
+    diriter_t it;
+    dirent_t *de;
+    diropen(&it, ii);
+    while (!found && ((de = dirnext(&it)) != NULL)) {
+      if ((de->inum == p.child) && (sncmp(de->name, ".", DIRNAMEENTRY) != 0) && (sncmp(de->name, "..", DIRNAMEENTRY) != 0)) {
         sizem_t bl = snlen(de->name, DIRNAMEENTRY);
         if (len < bl + 1) {
           /// @todo error buffer too small
+          dirclose(&it);
           iput(ii);
           return NULL;
         }
         mcpy(&buf[len - bl], de->name, bl);
         len -= bl;
         buf[--len] = '/';
-        brelse(bh);
         found = true;
-        break;
       }
-      brelse(bh);
     }
+    dirclose(&it);
     if (!found) {
       /// @todo error parent directory not found
       iput(ii);
@@ -1111,6 +1600,10 @@ char *getcwd(char *buf, sizem_t len)
       buf[1] = '\0';
     }
   }
+  if (snlen(buf, MAXPATH) < MAXPATH) {
+    sncpy(u->cwd, buf, MAXPATH);
+    u->cwdgen = nsgen;
+  }
   return buf;
 }
 
@@ -1123,6 +1616,31 @@ char *getcwd(char *buf, sizem_t len)
  */
 int sync(void)
 {
+  sync_sblocks();
   syncall_buffers(false);
   return 0;
 }
+
+
+
+/**
+ * @brief sync file to disk
+ * 
+ * Buffers do not know the inode they belong to, so all delayed writes of the
+ * file's device are written and waited for.
+ * 
+ * @param fdesc   file descriptor
+ * @return int    0 on success, -1 on error
+ */
+int fsync(int fdesc)
+{
+  if (fdesc < 0 || fdesc >= MAXOPENFILES || !active->u->fdesc[fdesc].ftabent) {
+    /// @todo error invalid file descriptor
+    return -1;
+  }
+  iinode_t *ii = active->u->fdesc[fdesc].ftabent->inode;
+  if (ii->modified)
+    update_inode_on_disk(ii);
+  syncdev_buffers(LDEVFROMFS(ii->fs), false);
+  return 0;
+}
@@ -15,69 +15,162 @@
 #include "buf.h"
 #include "pc.h"
 #include "fs.h"
+#include "dnlc.h"
+#include "trace.h"
 #include "utils.h"
 
 #define SUPERBLOCKINODE(fs)  (getisblock(fs)->dsblock.inodes)   ///< first block with inodes in fs
 
-#define HTABSIZEBITS 4
+#if NINODES <= 64
+#define HTABSIZEBITS 6
+#elif NINODES <= 128
+#define HTABSIZEBITS 7
+#else
+#define HTABSIZEBITS 8
+#endif
 
 #define HTABSIZE (1 << HTABSIZEBITS)
 #define HTABMASK (HTABSIZE - 1)
-#define HTABVALUE(fs, inum) ((inum) & HTABMASK)
-#define HTAB(fs, inum) ihashtab[HTABVALUE(dev, inum)]
+#define HTABVALUE(fs, inum) (((inum) ^ ((inum) >> HTABSIZEBITS) ^ ((fs) << (HTABSIZEBITS - 2))) & HTABMASK)
+#define HTAB(fs, inum) ihashtab[HTABVALUE(fs, inum)]
 
-#define INODEBLOCK(fs, inum) (((inum - 1) / NINODESBLOCK) + SUPERBLOCKINODE(fs))
-#define INODEOFFSET(inum) (((inum - 1) % NINODESBLOCK) * sizeof(dinode_t))
+#if HTABSIZE < NINODES
+#error inode hash table is smaller than NINODES
+#endif
 
-#define NREFSPERBLOCK ((block_t)(BLOCKSIZE / sizeof(block_t)))
+#define NINODESFSBLOCK(isbk) ((dword_t)NINODESBLOCK << (isbk)->dsblock.bshift)   ///< inodes per block of the fs of isbk
+
+#define INODEBLOCK(fs, inum) (((inum - 1) / NINODESFSBLOCK(getisblock(fs))) + SUPERBLOCKINODE(fs))
+#define INODEOFFSET(fs, inum) (((inum - 1) % NINODESFSBLOCK(getisblock(fs))) * sizeof(dinode_t))
+
+#define NREFSPERBLOCK(fs) ((block_t)(FSBSIZE(fs) / sizeof(block_t)))
+
+#define IMAPBITS (IMAPBYTES * 8)
+#define NINODEBLOCKS(isbk) (((isbk)->dsblock.ninodes + NINODESFSBLOCK(isbk) - 1) / NINODESFSBLOCK(isbk))
+#define IGROUPINODES(isbk) ((dword_t)((NINODEBLOCKS(isbk) + IMAPBITS - 1) / IMAPBITS) * NINODESFSBLOCK(isbk))   ///< inodes per summary bit
+#define IMAPISSET(isbk, g) ((isbk)->dsblock.imapfree[(g) / 8] & (1 << ((g) % 8)))
 
 iinode_t iinode[NINODES];
 
 iinode_t *ihashtab[HTABSIZE];
 iinode_t *ifreelist = NULL;
+istat_t istat;
 
 
 
 /**
  * @brief recursively iterates over the levels of indirection of block references
  * 
+ * @param q     queue the blocks are freed with
  * @param level current level
- * @param fs    working fs
  * @param bl    referenced block
  */
-void freeblocklevel(int level, fsnum_t fs, block_t bl)
+void freeblocklevel(bfreeq_t *q, int level, block_t bl)
 {
   if (level) {
     --level;
-    bhead_t *b = bread(LDEVFROMFS(fs), bl);
+    bhead_t *b = bread(LDEVFROMFS(q->fs), bl);
+    bhint(b, BHSTREAM);     // freed with the blocks it refers to
     block_t *brefs = (block_t *)b->buf->mem;
-    for ( int i = 0 ; (i < NREFSPERBLOCK) ; ++i )
+    for ( int i = 0 ; (i < NREFSPERBLOCK(q->fs)) ; ++i )
       if (brefs[i])
-        freeblocklevel(level, fs, brefs[i]);
+        freeblocklevel(q, level, brefs[i]);
     brelse(b);
   }
-  bfree(fs, bl);
+  bfreeq_add(q, bl);
 }
 
 
+
 /**
- * @brief free all blocks assigned to this inode
+ * @brief free the blocks below bl which map logical blocks from keep on
  * 
- * @param inode the inode with block references
+ * @param q       queue the blocks are freed with
+ * @param level   level of indirection of bl
+ * @param bl      referenced block
+ * @param base    first logical block mapped by bl
+ * @param keep    first logical block to be freed
+ * @return int    true if bl itself was freed
  */
-void free_all_blocks(iinode_t *inode)
+int truncblocklevel(bfreeq_t *q, int level, block_t bl, dword_t base, dword_t keep)
 {
-  int level = 0;
+  if (base >= keep) {
+    freeblocklevel(q, level, bl);
+    return true;
+  }
+  if (level == 0)
+    return false;
+  block_t nrefs = NREFSPERBLOCK(q->fs);
+  dword_t span = 1;       // logical blocks mapped by one entry of bl
+  for ( int l = 1 ; l < level ; ++l )
+    span *= nrefs;
+  bhead_t *b = bread(LDEVFROMFS(q->fs), bl);
+  bhint(b, BHMETA);
+  block_t *brefs = (block_t *)b->buf->mem;
+  int modified = false;
+  for ( int i = 0 ; (i < nrefs) ; ++i )
+    if (brefs[i] && truncblocklevel(q, level - 1, brefs[i], base + i * span, keep)) {
+      brefs[i] = 0;
+      modified = true;
+    }
+  if (modified)
+    bdwrite(b, BMINODE);
+  brelse(b);
+  return false;
+}
+
+
 
+void itrunc(iinode_t *inode, fsize_t length)
+{
   ASSERT(inode);
+  if ((inode->dinode.ftype == CHARACTER) || (inode->dinode.ftype == BLOCK))
+    return;     // blockrefs hold the device
+  bmapinvalidate(inode);
+  fsize_t bsize = FSBSIZE(inode->fs);
+  fsize_t z = MIN(length, inode->dinode.fsize);
+  if ((z % bsize) && (z < MAX(length, inode->dinode.fsize))) {    // clear the bytes past the shorter end
+    bmap_t bm = bmaplookup(inode, z);
+    if (bm.fsblock) {
+      bhead_t *bh = bread(LDEVFROMINODE(inode), bm.fsblock);
+      mset(&bh->buf->mem[bm.offblock], 0, bm.nbytesleft);
+      bh->dwrite = true;
+      bwrite(bh);
+      brelse(bh);
+    }
+  }
+  ifreeprealloc(inode);
+  bfreeq_t q;
+  bfreeq_init(&q, inode->fs);
+  dword_t keep = (length + bsize - 1) / bsize;
+  dword_t base = 0;       // first logical block mapped by reference i
+  dword_t cover = 1;      // logical blocks mapped by reference i
+  int level = 0;
   for ( int i = 0 ; i < NBLOCKREFS ; ++i ) {
-    block_t bl = inode->dinode.blockrefs[i];
-    if (i >= STARTREFSLEVEL)
+    if (i >= STARTREFSLEVEL) {
       ++level;
-    if (bl == 0)
-      continue;
-    freeblocklevel(level, inode->fs, bl);
+      cover *= NREFSPERBLOCK(inode->fs);
+    }
+    block_t bl = inode->dinode.blockrefs[i];
+    if (bl && (base + cover > keep) && truncblocklevel(&q, level, bl, base, keep))
+      inode->dinode.blockrefs[i] = 0;
+    base += cover;
   }
+  bfreeq_flush(&q);
+  inode->dinode.fsize = length;
+  inode->modified = true;
+}
+
+
+
+/**
+ * @brief free all blocks assigned to this inode, its size becomes 0
+ * 
+ * @param inode the inode with block references
+ */
+void free_all_blocks(iinode_t *inode)
+{
+  itrunc(inode, 0);
 }
 
 
@@ -91,9 +184,9 @@ void update_inode_on_disk(iinode_t *inode)
 {
   ASSERT(inode);
   bhead_t *b = bread(LDEVFROMFS(inode->fs), INODEBLOCK(inode->fs, inode->inum));
-  mcpy(&b->buf->mem[INODEOFFSET(inode->inum)], &inode->dinode, sizeof(dinode_t));
-  b->dwrite = true;
-  bwrite(b);
+  bhint(b, BHMETA);
+  mcpy(&b->buf->mem[INODEOFFSET(inode->fs, inode->inum)], &inode->dinode, sizeof(dinode_t));
+  bdwrite(b, BMINODE);
   brelse(b);
   inode->modified = false;
 }
@@ -161,18 +254,20 @@ void move_inode_to_hashqueue(iinode_t *inode, fsnum_t fs, ninode_t inum)
   ASSERT(inode);
   ASSERT(fs < MAXFS);
   ASSERT(inum < getisblock(fs)->dsblock.ninodes);
-  iinode_t *p = HTAB(fs, inum);
   if (inode->hnext) {
     if (inode->hnext == inode)
       HTAB(inode->fs, inode->inum) = NULL;
-    else
+    else if (HTAB(inode->fs, inode->inum) == inode)
       HTAB(inode->fs, inode->inum) = inode->hnext;
     inode->hprev->hnext = inode->hnext;
     inode->hnext->hprev = inode->hprev;
   }
   inode->fs = fs;
   inode->inum = inum;
+  iinode_t *p = HTAB(fs, inum);
   if (p) {
+    inode->hprev = p->hprev;
+    inode->hnext = p;
     p->hprev->hnext = inode;
     p->hprev = inode;
   } else {
@@ -184,6 +279,95 @@ void move_inode_to_hashqueue(iinode_t *inode, fsnum_t fs, ninode_t inum)
 
 
 
+/**
+ * @brief scan the inodes of group g from index first to last - 1 (inode number - 1)
+ * 
+ * @param isbk 
+ * @param g 
+ * @param first 
+ * @param last 
+ * @param n       number of free inodes in finode, found ones are appended up to NFREEINODES, NULL to count only
+ * @return int    number of free inodes found
+ */
+int scan_inode_group(isuperblock_t *isbk, word_t g, dword_t first, dword_t last, int *n)
+{
+  dword_t gsize = IGROUPINODES(isbk);
+  bhead_t *bh = NULL;
+  block_t currblk = 0;
+  int nfound = 0;
+
+  for ( dword_t j = g * gsize + first ; (j < g * gsize + last) && (!n || (*n < NFREEINODES)) ; ++j ) {
+    ninode_t iidx = j + 1;
+    if (!bh || (currblk != INODEBLOCK(isbk->fs, iidx))) {
+      if (bh)
+        brelse(bh);
+      currblk = INODEBLOCK(isbk->fs, iidx);
+      bh = breadn(isbk->dev, currblk, (g * gsize + last - j + NINODESFSBLOCK(isbk) - 1) / NINODESFSBLOCK(isbk));
+      bhint(bh, BHSTREAM);    // scan, do not push out the inodes in use
+    }
+    if (((dinode_t *)bh->buf->mem)[j % NINODESFSBLOCK(isbk)].ftype == IFREE) {
+      if (n)
+        isbk->finode[(*n)++] = iidx;
+      ++nfound;
+    }
+  }
+  if (bh)
+    brelse(bh);
+  return nfound;
+}
+
+
+
+void count_free_inodes(isuperblock_t *isbk)
+{
+  dword_t ninum = isbk->dsblock.ninodes - 1;    // inodes 1 .. ninodes - 1
+  dword_t gsize = IGROUPINODES(isbk);
+
+  isbk->dsblock.nfreeinodes = 0;
+  mset(isbk->dsblock.imapfree, 0, sizeof(isbk->dsblock.imapfree));
+  for ( word_t g = 0 ; g * gsize < ninum ; ++g ) {
+    int nfound = scan_inode_group(isbk, g, 0, MIN(gsize, ninum - g * gsize), NULL);
+    if (nfound)
+      isbk->dsblock.imapfree[g / 8] |= 1 << (g % 8);
+    isbk->dsblock.nfreeinodes += nfound;
+  }
+  isbk->modified = true;
+}
+
+
+
+/**
+ * @brief refill finode from inode groups marked in imapfree, starting after lastfinode and wrapping around
+ * 
+ * @param isbk    locked superblock
+ */
+void fill_finodes(isuperblock_t *isbk)
+{
+  dword_t ninum = isbk->dsblock.ninodes - 1;
+  dword_t gsize = IGROUPINODES(isbk);
+  word_t ngroups = (ninum + gsize - 1) / gsize;
+  dword_t start = (isbk->lastfinode < ninum) ? isbk->lastfinode : 0;
+  word_t g = start / gsize;
+  int n = 0;
+
+  mset(isbk->finode, 0, sizeof(isbk->finode));
+  for ( word_t i = 0 ; (i <= ngroups) && (n < NFREEINODES) ; ++i, g = (g + 1) % ngroups ) {
+    dword_t first = (i == 0) ? start % gsize : 0;
+    dword_t last = (i == ngroups) ? start % gsize : gsize;    // last round wraps into start group
+    dword_t full = MIN(gsize, ninum - g * gsize);
+    last = MIN(last, full);
+    if ((first >= last) || !IMAPISSET(isbk, g))
+      continue;
+    if (!scan_inode_group(isbk, g, first, last, &n) && (first == 0) && (last == full)) {
+      isbk->dsblock.imapfree[g / 8] &= ~(1 << (g % 8));
+      isbk->modified = true;
+    }
+  }
+  isbk->nfinodes = 0;
+}
+
+
+
 /**
  * @brief init inodes
  * 
@@ -192,13 +376,47 @@ void init_inodes(void)
 {
   mset(iinode, 0, sizeof(iinode));
   mset(ihashtab, 0, sizeof(ihashtab));
+  mset(&istat, 0, sizeof(istat));
+  ifreelist = NULL;
 
-  for ( int i = 0 ; i < NBUFFER ; ++i ) 
+  for ( int i = 0 ; i < NINODES ; ++i ) 
     add_inode_to_freelist(&iinode[i], 0);
 }
 
 
 
+/**
+ * @brief choose the free inode to be reused, the least recently used one
+ * 
+ * With IKEEPDIRS cached directory inodes are passed over while another free
+ * inode is left, so path walks keep finding their directories in core.
+ * 
+ * @return iinode_t*  inode or NULL if no inode is free
+ */
+iinode_t *ivictim(void)
+{
+  iinode_t *i = ifreelist;
+#if IKEEPDIRS
+  if (i) {
+    do {
+      if (!i->fs || (i->dinode.ftype != DIRECTORY))
+        return i;
+      i = i->fnext;
+    } while (i != ifreelist);
+  }
+#endif
+  return i;
+}
+
+
+
+const istat_t *getistat(void)
+{
+  return &istat;
+}
+
+
+
 /**
  * @brief allocates an inode from the fs
  * 
@@ -209,75 +427,51 @@ void init_inodes(void)
 iinode_t *ialloc(fsnum_t fs, ftype_t ftype, fmode_t fmode)
 {
   iinode_t *ii = NULL;
-  bhead_t *bhead = NULL;
-  dinode_t *dinode = NULL;
 
   ASSERT(fs < MAXFS);
 
   isuperblock_t *isbk = getisblock(fs);
-  // block_t firstinodeblock = SUPERBLOCKINODE(fs);
-  block_t currblk = 0;
 
   for(;;) {
-    if (isbk->locked) {
-      waitfor(SBLOCKBUSY);
-      continue;
-    }
-    isbk->locked = true;
-    if ((isbk->nfinodes >= NFREEINODES) || (isbk->finode[isbk->nfinodes] == 0)) {
-      mset(&isbk->finode, 0, sizeof(isbk->finode));
-      ninode_t iidx = isbk->lastfinode;
-      int i = 0;
-      do {
-        if (++iidx >= isbk->dsblock.ninodes)
-          break;
-        if (!bhead || (currblk != INODEBLOCK(fs, iidx))) {
-          currblk = INODEBLOCK(fs, iidx);
-          if (bhead)
-            brelse(bhead);
-          bhead = breada(LDEVFROMFS(fs), currblk, currblk + 1);
-          dinode = (dinode_t*)bhead->buf->mem;
-        }
-        if (dinode[(iidx - 1) % NINODESBLOCK].ftype == IFREE)
-          isbk->finode[i++] = iidx;
-      } while (i < NFREEINODES);
-      if (bhead)
-        brelse(bhead);
-      isbk->nfinodes = 0;
-      if (isbk->finode[isbk->nfinodes] == 0) {
-        isbk->locked = false;
-        wakeall(SBLOCKBUSY);
-        /// @todo set error no free inodes in fs
-        return NULL;
+    slock(isbk);
+    if ((isbk->dsblock.nfreeinodes > 0) && ((isbk->nfinodes >= NFREEINODES) || (isbk->finode[isbk->nfinodes] == 0))) {
+      fill_finodes(isbk);
+      if (isbk->finode[0] == 0) {   // no free inode left, free count was wrong
+        isbk->dsblock.nfreeinodes = 0;
+        isbk->modified = true;
       }
     }
+    if (isbk->dsblock.nfreeinodes == 0) {
+      sunlock(isbk);
+      /// @todo set error no free inodes in fs
+      return NULL;
+    }
     ii = iget(fs, isbk->finode[isbk->nfinodes]);
     if (!ii) {
-      isbk->locked = false;
-      wakeall(SBLOCKBUSY);
+      sunlock(isbk);
       /// @todo set error no free inodes in fs
       return NULL;
     }
     isbk->lastfinode = isbk->finode[isbk->nfinodes++];
-    isbk->locked = false;
-    wakeall(SBLOCKBUSY);
+    --isbk->dsblock.nfreeinodes;    // under the lock, ifree() counts up meanwhile
+    isbk->modified = true;
+    sunlock(isbk);
     if ((ii->dinode.ftype != IFREE) || (ii->nref > 1) || (ii->dinode.nlinks > 0) || (ii->locked)) {
+      slock(isbk);                  // stale entry, the inode was not free
+      ++isbk->dsblock.nfreeinodes;
+      sunlock(isbk);
       update_inode_on_disk(ii);
       iput(ii);
       continue;
     }
-    while (ii->locked) {
-      waitfor(INODELOCKED);   /// @todo check if this is necessary
-    }
-    ii->locked = true;
+    ilock(ii);
     mset(&ii->dinode, 0, sizeof(dinode_t));
     ii->dinode.ftype = ftype;
     ii->dinode.fmode = fmode;
     // ii->dinode.nlinks = 0;      // will be incremented by linki
     /// @todo set uid, gid, ...
     ii->modified = true;
-    ii->locked = false;
-    wakeall(INODELOCKED);
+    iunlock(ii);
     update_inode_on_disk(ii);
     return ii;
   }
@@ -297,33 +491,21 @@ void ifree(iinode_t *inode)
 
   inode->dinode.ftype = IUNSPEC;
 
-  while (isbk->locked) {
-    waitfor(SBLOCKBUSY);
-  }
-  isbk->locked = true;
-
-  if (isbk->nfinodes >= NFREEINODES) {
-    isbk->nfinodes = NFREEINODES - 1;
-    isbk->finode[isbk->nfinodes] = inode->inum;
-  } else if ((isbk->nfinodes == 0) || (isbk->finode[isbk->nfinodes] < inode->inum)) {
-    int d = 0, j = 0;
-    for ( int i = isbk->nfinodes + 1 ; i < NFREEINODES ; ++i ) {
-      if (isbk->finode[i] > (inode->inum + d)) {
-        j = i;
-        d = isbk->finode[i] - inode->inum;
-      }
-    }
-    if (j)
-      isbk->finode[j] = inode->inum;
-  } else
+  slock(isbk);
+
+  if (isbk->nfinodes > 0)     // reuse it first
     isbk->finode[--isbk->nfinodes] = inode->inum;
+  ++isbk->dsblock.nfreeinodes;
+  word_t g = (inode->inum - 1) / IGROUPINODES(isbk);
+  isbk->dsblock.imapfree[g / 8] |= 1 << (g % 8);
+  isbk->modified = true;
 
   mset(&inode->dinode, 0, sizeof(dinode_t));
+  bmapinvalidate(inode);
   inode->dinode.ftype = IFREE;
   update_inode_on_disk(inode);
 
-  isbk->locked = false;
-  wakeall(SBLOCKBUSY);
+  sunlock(isbk);
 }
 
 
@@ -350,7 +532,8 @@ iinode_t *iget(fsnum_t fs, ninode_t inum)
         break;
     if (found) {
       if (found->locked) {
-        waitfor(INODELOCKED);
+        found->wanted = true;
+        sleepon(found, INODELOCKED);
         continue;
       }
       if (found->fsmnt) {
@@ -360,17 +543,25 @@ iinode_t *iget(fsnum_t fs, ninode_t inum)
       }
       remove_inode_from_freelist(found);
       found->nref++;
+      ++istat.hits;
+      TRACE(TRIGET, true, fs, inum);
       return found;
     }
-    found = ifreelist;
+    found = ivictim();
     if (!found) {
       /// @todo error no free inodes
       return NULL;
     }
+    ++istat.misses;
+    TRACE(TRIGET, false, fs, inum);
+    if (found->fs)
+      ++istat.evictions;
     remove_inode_from_freelist(found);
     move_inode_to_hashqueue(found, fs, inum);
+    bmapinvalidate(found);
     bhead = bread(LDEVFROMFS(found->fs), INODEBLOCK(fs, inum));
-    mcpy(&found->dinode, &bhead->buf->mem[INODEOFFSET(inum)], sizeof(dinode_t));
+    bhint(bhead, BHMETA);
+    mcpy(&found->dinode, &bhead->buf->mem[INODEOFFSET(fs, inum)], sizeof(dinode_t));
     brelse(bhead);
     found->nref = 1;
     return found;
@@ -379,6 +570,30 @@ iinode_t *iget(fsnum_t fs, ninode_t inum)
 
 
 
+void ilock(iinode_t *inode)
+{
+  ASSERT(inode);
+  while (inode->locked) {
+    inode->wanted = true;
+    sleepon(inode, INODELOCKED);
+  }
+  inode->locked = true;
+}
+
+
+
+void iunlock(iinode_t *inode)
+{
+  ASSERT(inode);
+  inode->locked = false;
+  if (inode->wanted) {
+    inode->wanted = false;
+    wakeupon(inode);
+  }
+}
+
+
+
 /**
  * @brief releases inode
  * 
@@ -390,6 +605,7 @@ void iput(iinode_t *inode)
   inode->locked = true;
   inode->nref--;
   if (inode->nref == 0) {
+    ifreeprealloc(inode);
     if (inode->dinode.nlinks == 0) {
       free_all_blocks(inode);
       ifree(inode);
@@ -398,93 +614,231 @@ void iput(iinode_t *inode)
       update_inode_on_disk(inode);
     add_inode_to_freelist(inode, false);
   }
-  inode->locked = false;
-  wakeall(INODELOCKED);
+  iunlock(inode);
+}
+
+
+
+bhead_t *iballoc(iinode_t *inode, block_t goal)
+{
+  ASSERT(inode);
+  if (inode->nprealloc && goal && (inode->prealloc != goal))
+    ifreeprealloc(inode);       // not sequential, the run is of no use
+  while (inode->nprealloc) {
+    block_t bl = inode->prealloc++;
+    --inode->nprealloc;
+    --getisblock(inode->fs)->nreserved;
+    if (bclaim(inode->fs, bl) == 0)
+      return bclear(inode->fs, bl);
+  }
+  word_t n = (inode->dinode.ftype == REGULAR) ? NPREALLOC : 1;
+  block_t bl = brun(inode->fs, goal, &n);
+  if (bl == 0)
+    return NULL;    /// @todo set error no free blocks in fs
+  inode->prealloc = bl + 1;
+  inode->nprealloc = n - 1;
+  return bclear(inode->fs, bl);
+}
+
+
+
+void ifreeprealloc(iinode_t *inode)
+{
+  ASSERT(inode);
+  if (!inode->nprealloc)
+    return;
+  getisblock(inode->fs)->nreserved -= inode->nprealloc;
+  inode->nprealloc = 0;
+}
+
+
+
+void idropprealloc(fsnum_t fs)
+{
+  for ( int i = 0 ; i < NINODES ; ++i )
+    if (iinode[i].nprealloc && (iinode[i].fs == fs))
+      ifreeprealloc(&iinode[i]);
+}
+
+
+
+block_t iunreserved(fsnum_t fs, block_t bl, block_t n)
+{
+  if (!getisblock(fs)->nreserved)
+    return n;
+  for ( int i = 0 ; i < NINODES ; ++i ) {
+    iinode_t *ii = &iinode[i];
+    if (!ii->nprealloc || (ii->fs != fs) || ((block_t)(ii->prealloc + ii->nprealloc) <= bl))
+      continue;
+    if (ii->prealloc <= bl)
+      return 0;
+    n = MIN(n, (block_t)(ii->prealloc - bl));
+  }
+  return n;
 }
 
 
 
 /**
- * @brief mapping from file position to block in fs and allocates new blocks if necessary
+ * @brief mapping from file position to block in fs
+ * 
+ * The last indirect mapping and the last leaf indirect block are cached in the
+ * inode, so sequential access reads one indirect block per block instead of
+ * walking all levels, and repeated lookups in the same block read none.
  * 
  * @param inode 
  * @param pos 
+ * @param alloc   if true allocate missing blocks, otherwise return fsblock 0 for holes
  * @return bmap_t 
  */
-bmap_t bmap(iinode_t *inode, fsize_t pos)
+bmap_t bmapi(iinode_t *inode, fsize_t pos, int alloc)
 {
   ASSERT(inode);
   bmap_t bm;
-  block_t lblock = pos / BLOCKSIZE;
+  word_t bsize = FSBSIZE(inode->fs);
+  block_t nrefs = bsize / sizeof(block_t);
+  dword_t lblock = pos / bsize;
   bm.fsblock = 0;
-  bm.offblock = pos % BLOCKSIZE;
-  bm.nbytesleft = BLOCKSIZE - bm.offblock;
+  bm.offblock = pos % bsize;
+  bm.nbytesleft = bsize - bm.offblock;
   bm.rdablock = 0;
+  bm.newblock = false;
 
   if (lblock < STARTREFSLEVEL) {
     bm.fsblock = inode->dinode.blockrefs[lblock];
     if (bm.fsblock == 0) {    // allocate new block
-      bhead_t *bh = balloc(inode->fs);
+      if (!alloc)
+        return bm;
+      block_t prev = (lblock > 0) ? inode->dinode.blockrefs[lblock - 1] : 0;
+      bhead_t *bh = iballoc(inode, prev ? prev + 1 : 0);
       if (bh == NULL)
         return bm;      
       bm.fsblock = inode->dinode.blockrefs[lblock] = bh->block;
+      bm.newblock = true;
       inode->modified = true;
       brelse(bh);
     }
-    bm.rdablock = inode->dinode.blockrefs[lblock + 1];
+    if (lblock + 1 < STARTREFSLEVEL)
+      bm.rdablock = inode->dinode.blockrefs[lblock + 1];
+    return bm;
+  }
+
+  if (inode->bmfsblock && (inode->bmlblock == lblock)) {    // same block as last time
+    bm.fsblock = inode->bmfsblock;
+    bm.rdablock = inode->bmrdablock;
     return bm;
   }
 
-  lblock -= STARTREFSLEVEL;
-  dword_t d = 1;
+  dword_t ref = lblock - STARTREFSLEVEL;    // index of reference in the indirect levels
+  dword_t base = 0;                         // first reference index of level l
+  dword_t d = 1;                            // blocks referenced by one entry of the top block of level l
   int l;
-  for ( l = 0 ; l < 5; ++l ) {
-    if (lblock < NREFSPERBLOCK) {
-      break;
-    }
-    d *= NREFSPERBLOCK;
-    lblock -= d;
+  for ( l = 0 ; ref - base >= d * nrefs ; ++l ) {
+    if (STARTREFSLEVEL + l + 1 >= NBLOCKREFS)
+      return bm;    /// @todo error file too large
+    base += d * nrefs;
+    d *= nrefs;
   }
 
-  block_t b = inode->dinode.blockrefs[STARTREFSLEVEL + l];
-  if (b == 0) {    // allocate new block
-    bhead_t *bh = balloc(inode->fs);
-    if (bh == NULL)
-      return bm;      
-    b = inode->dinode.blockrefs[STARTREFSLEVEL + l] = bh->block;
-    inode->modified = true;
-    brelse(bh);
+  block_t b;
+  dword_t off;
+  if (inode->bmleaf && (ref - inode->bmleafbase < nrefs)) {    // skip the upper levels
+    b = inode->bmleaf;
+    off = ref - inode->bmleafbase;
+    d = 1;
+  } else {
+    b = inode->dinode.blockrefs[STARTREFSLEVEL + l];
+    off = ref - base;
+    if (b == 0) {    // allocate new block
+      if (!alloc)
+        return bm;
+      bhead_t *bh = balloc(inode->fs);
+      if (bh == NULL)
+        return bm;      
+      b = inode->dinode.blockrefs[STARTREFSLEVEL + l] = bh->block;
+      inode->modified = true;
+      brelse(bh);
+    }
   }
   do {
     bhead_t *bh = bread(LDEVFROMFS(inode->fs), b);
+    bhint(bh, BHMETA);
     block_t *refs = (block_t *)bh->buf->mem;
-    int idx = lblock / d;
-    ASSERT(idx < NREFSPERBLOCK);
+    word_t idx = off / d;
+    ASSERT(idx < nrefs);
+    if (d == 1) {
+      inode->bmleaf = b;
+      inode->bmleafbase = ref - idx;
+    }
     b = refs[idx];
     if (b == 0) {    // allocate new block
-      bhead_t *bha = balloc(inode->fs);
+      if (!alloc) {
+        brelse(bh);
+        return bm;
+      }
+      block_t prev = (idx > 0) ? refs[idx - 1] : 0;
+      bhead_t *bha = (d == 1) ? iballoc(inode, prev ? prev + 1 : 0) : balloc(inode->fs);
       if (bha == NULL) {
         brelse(bh);
         return bm;
       }
       b = refs[idx] = bha->block;
+      bm.newblock = (d == 1);
       brelse(bha);
-      bh->dwrite = true;
-      bwrite(bh);
+      bdwrite(bh, BMINODE);
     }
-    if (++idx < NREFSPERBLOCK)
-      bm.rdablock = refs[idx];
+    bm.rdablock = (++idx < nrefs) ? refs[idx] : 0;
     brelse(bh);
-    lblock %= d;
-    d /= NREFSPERBLOCK;
+    off %= d;
+    d /= nrefs;
   } while (d > 0);
   
   bm.fsblock = b;
+  inode->bmlblock = lblock;
+  inode->bmfsblock = b;
+  inode->bmrdablock = bm.rdablock;
   return bm;
 }
 
 
 
+/**
+ * @brief mapping from file position to block in fs and allocates new blocks if necessary
+ * 
+ * @param inode 
+ * @param pos 
+ * @return bmap_t 
+ */
+bmap_t bmap(iinode_t *inode, fsize_t pos)
+{
+  return bmapi(inode, pos, true);
+}
+
+
+
+void bmapinvalidate(iinode_t *inode)
+{
+  ASSERT(inode);
+  inode->bmfsblock = 0;
+  inode->bmleaf = 0;
+}
+
+
+
+/**
+ * @brief mapping from file position to block in fs without allocating blocks
+ * 
+ * @param inode 
+ * @param pos 
+ * @return bmap_t   fsblock is 0 if pos is not backed by a block
+ */
+bmap_t bmaplookup(iinode_t *inode, fsize_t pos)
+{
+  return bmapi(inode, pos, false);
+}
+
+
+
 /**
  * @brief finds inode which path points to and returns inode and parent inode id
  * 
@@ -493,15 +847,13 @@ bmap_t bmap(iinode_t *inode, fsize_t pos)
  */
 namei_t namei(const char *p)
 {
-  namei_t rtn = {NULL, 0, 0};
+  namei_t rtn = {NULL, 0, 0, DIRNOFREE};
   iinode_t *wi = NULL;    // working inode
-  dword_t i, n;           // index and number of directory entries 
   int ps;                 // size of current path name part
-  bmap_t bm;
-  bhead_t *bh;
+  diriter_t it;
   dirent_t *de;
   fsnum_t fs;
-  int found;
+  ninode_t cinum;         // inode of current path name part
 
   ASSERT(p);
   ASSERT(active);
@@ -524,7 +876,7 @@ namei_t namei(const char *p)
       return rtn;
     }
     int skip = false;
-    if (sncmp(p, "..", ps) == 0) {
+    if ((ps == 2) && (sncmp(p, "..", ps) == 0)) {
       if (wi == active->u->fsroot) {  // if *p is ".." and wi is root then continue with next path part
         /// @todo potentional error when active->u->fsroot is root of a mounted fs (chroot("/mnt"); mount /dev/hddb1 /mnt)
         skip = true;
@@ -544,37 +896,31 @@ namei_t namei(const char *p)
         return rtn;
       }
       /// @todo check permission
-      ASSERT(wi->dinode.fsize % sizeof(dirent_t) == 0);
-      n = wi->dinode.fsize / sizeof(dirent_t);
       fs = wi->fs;
-      found = false;
-      for ( i = 0 ; !found && i < n ; ++i ) {
-        /// @todo optimize algorithm, is quick and dirty
-        bm = bmap(wi, i * sizeof(dirent_t));
-        if (bm.fsblock == 0) {  // no block assigned, error should be set by balloc in bmap
-          iput(wi);
-          return rtn;
-        }
-        bh = breada(LDEVFROMFS(fs), bm.fsblock, bm.rdablock);
-        de = (dirent_t*)&bh->buf->mem[bm.offblock];
-        if (de->inum > 0 && sncmp(p, de->name, ps) == 0) {
-          rtn.p = wi->inum;       // parent inode
-          rtn.fs = wi->fs;
-          iput(wi);
-          wi = iget(fs, de->inum);  // iget take care of mounted fs
-          found = true;
-        }
-        brelse(bh);
-      }
-      if (!found) {
-        if (p[ps] == 0) {     // file was not found but parent dir was found
-          rtn.p = wi->inum;   // parent inode
-          rtn.fs = wi->fs;
-        }
+      int cache = !((ps == 1) && (*p == '.')) && !((ps == 2) && (sncmp(p, "..", 2) == 0));
+      int hit = cache && dnlc_lookup(fs, wi->inum, p, ps, &cinum);
+      TRACE(TRNAMEI, hit, wi->inum, (byte_t)p[0] | ((ps > 1) ? (byte_t)p[1] << 8 : 0));
+      if (!hit) {
+        diropen(&it, wi);
+        de = dirfind(&it, p, ps);
+        cinum = de ? de->inum : 0;
+        dirclose(&it);
+        if (cache)
+          dnlc_enter(fs, wi->inum, p, ps, cinum);
+        rtn.pfree = it.freepos;
+      } else
+        rtn.pfree = DIRNOFREE;    // not scanned
+      rtn.p = wi->inum;           // parent inode
+      rtn.fs = wi->fs;
+      if (!cinum) {
         /// @todo error entry not found
+        if (p[ps] != 0)           // not the last path name part, parent dir was not found
+          rtn.p = 0;
         iput(wi);
         return rtn;
       }
+      iput(wi);
+      wi = iget(fs, cinum);       // iget take care of mounted fs
     }
     p += ps;
     if (*p == '/')
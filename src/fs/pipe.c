@@ -0,0 +1,149 @@
+/**
+ * @file pipe.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief FIFOs, data is kept in a clist of the inode and never goes to disk
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "fs.h"
+#include "inode.h"
+#include "clist.h"
+#include "pc.h"
+#include "utils.h"
+
+#define FIFORCHAN(ii) ((const char *)(ii) + 1)    ///< readers sleep on it till data arrives or the last writer leaves
+#define FIFOWCHAN(ii) ((const char *)(ii) + 2)    ///< writers sleep on it till space gets free or the last reader leaves
+
+
+
+int fifoopen(iinode_t *ii, omode_t omode)
+{
+  ASSERT(ii && (ii->dinode.ftype == FIFO));
+  if (!ii->rclist) {
+    ii->rclist = clist_create();
+    if (!ii->rclist) {
+      /// @todo error no free clist
+      return -1;
+    }
+  }
+  if (omode & OREAD)
+    ++ii->nreaders;
+  if (omode & OWRITE)
+    ++ii->nwriters;
+  return 0;
+}
+
+
+
+void fifoclose(iinode_t *ii, omode_t omode)
+{
+  ASSERT(ii && (ii->dinode.ftype == FIFO));
+  if (omode & OREAD) {
+    ASSERT(ii->nreaders > 0);
+    --ii->nreaders;
+  }
+  if (omode & OWRITE) {
+    ASSERT(ii->nwriters > 0);
+    --ii->nwriters;
+  }
+  wakeupon(FIFORCHAN(ii));     // readers see end of file, writers a broken pipe
+  wakeupon(FIFOWCHAN(ii));
+  if (!ii->nreaders && !ii->nwriters && ii->rclist) {
+    clist_destroy(ii->rclist);
+    ii->rclist = 0;
+  }
+}
+
+
+
+/**
+ * @brief read what is buffered in FIFO ii, up to the size of the segments
+ *
+ * Blocks while the FIFO is empty and open for writing.
+ *
+ * @param ii
+ * @param iov       segments
+ * @param iovcnt    number of segments
+ * @param nonblock  return -1 instead of blocking
+ * @return int      number of bytes read, 0 at end of file, -1 on error
+ */
+int fiforead(iinode_t *ii, const iovec_t *iov, int iovcnt, int nonblock)
+{
+  ASSERT(ii && (ii->dinode.ftype == FIFO) && ii->rclist);
+  int done = 0;
+  while (clist_size(ii->rclist) == 0) {
+    if (!ii->nwriters)
+      return 0;
+    if (nonblock) {
+      /// @todo error again
+      return -1;
+    }
+    sleepon(FIFORCHAN(ii), FIFOEMPTY);
+  }
+  for ( int v = 0 ; v < iovcnt ; ++v ) {
+    sizem_t n = MIN((sizem_t)iov[v].len, (sizem_t)clist_size(ii->rclist));
+    if (n == 0)
+      break;
+    clist_pop(ii->rclist, (char *)iov[v].base, n);
+    done += n;
+  }
+  wakeupon(FIFOWCHAN(ii));
+  return done;
+}
+
+
+
+/**
+ * @brief write the segments to FIFO ii
+ *
+ * Blocks while the FIFO holds PIPESIZE bytes. Readers are woken when a clist
+ * node got filled, before the writer blocks and when the write is done.
+ *
+ * @param ii
+ * @param iov       segments
+ * @param iovcnt    number of segments
+ * @param nonblock  return instead of blocking
+ * @return int      number of bytes written, -1 on error
+ */
+int fifowrite(iinode_t *ii, const iovec_t *iov, int iovcnt, int nonblock)
+{
+  ASSERT(ii && (ii->dinode.ftype == FIFO) && ii->rclist);
+  int done = 0;
+  for ( int v = 0 ; v < iovcnt ; ++v ) {
+    char *buf = (char *)iov[v].base;
+    sizem_t len = iov[v].len;
+    while (len) {
+      if (!ii->nreaders) {
+        /// @todo error broken pipe
+        return done ? done : -1;
+      }
+      sizem_t before = clist_size(ii->rclist);
+      if (before < PIPESIZE) {
+        clist_push(ii->rclist, buf, MIN(len, PIPESIZE - before));    // short if clist nodes run out
+      }
+      sizem_t n = clist_size(ii->rclist) - before;
+      if (n == 0) {
+        if (done)
+          wakeupon(FIFORCHAN(ii));
+        if (nonblock) {
+          /// @todo error again
+          return done ? done : -1;
+        }
+        sleepon(FIFOWCHAN(ii), FIFOFULL);
+        continue;
+      }
+      if ((before / MAXNODEDATA) != ((before + n) / MAXNODEDATA))
+        wakeupon(FIFORCHAN(ii));
+      buf += n;
+      len -= n;
+      done += n;
+    }
+  }
+  if (done)
+    wakeupon(FIFORCHAN(ii));
+  return done;
+}
@@ -15,9 +15,20 @@
 #include "buf.h"
 #include "inode.h"
 #include "tdefs.h"
+#include "config.h"
 
-#define NFREEINODES 50
-#define NFREEBLOCKS 50
+#define SBVERSION 5     ///< superblocks of older versions get their free counts recomputed at mount
+
+#define IMAPBYTES 32    ///< size of free inode group summary in superblock
+
+#define SBFHASHDIR 0x0001   ///< feature: new directories use the hashed layout
+
+#define SBSECTOR 1      ///< sector of the superblock, whatever the block size of the fs
+#define SBBLOCK(bshift)   (SBSECTOR >> (bshift))                              ///< block of the superblock
+#define SBOFFSET(bshift)  ((SBSECTOR * BLOCKSIZE) % (BLOCKSIZE << (bshift)))  ///< offset of the superblock in its block
+
+#define SBBSIZE(isbk) ((word_t)BLOCKSIZE << (isbk)->dsblock.bshift)  ///< bytes per block of the fs of isbk
+#define FSBSIZE(fs)   SBBSIZE(getisblock(fs))                         ///< bytes per block of fs
 
 #define LDEVFROMFS(fs)  (getisblock(fs)->dev)        ///< ldev of fs from super block
 #define LDEVFROMINODE(i)  (getisblock(i->fs)->dev)   ///< ldev of fs from inode
@@ -33,6 +44,12 @@ typedef struct superblock {
     block_t firstblock;
     ninode_t ninodes;
     block_t nblocks;
+    block_t nfreeblocks;    ///< number of free blocks
+    word_t bmapfree;        ///< bit i set if bitmap block i may have a free bit, cleared lazily
+    ninode_t nfreeinodes;   ///< number of free inodes
+    byte_t imapfree[IMAPBYTES];   ///< bit g set if inode group g may have a free inode, cleared lazily
+    word_t features;        ///< SBF... feature flags
+    byte_t bshift;          ///< blocks are BLOCKSIZE << bshift bytes, 0 .. MAXBSHIFT
 } _STRUCTATTR_ superblock_t;
 
 typedef struct isuperblock {
@@ -40,6 +57,7 @@ typedef struct isuperblock {
     word_t locked : 1;
     word_t modified : 1;
     word_t inuse : 1;
+    word_t wanted : 1;  ///< a process sleeps till the superblock is unlocked
     int mflags;
     fsnum_t fs;
     ldev_t dev;
@@ -52,14 +70,113 @@ typedef struct isuperblock {
     word_t nfblocks;
     block_t fblocks[NFREEBLOCKS];
     block_t lastfblock;
+    block_t nreserved;  ///< free blocks reserved by in core inodes, not marked in the bitmap, @see iballoc
 } _STRUCTATTR_ isuperblock_t;
 
+#ifndef NBFREEQ
+#define NBFREEQ 32      ///< blocks collected before they are freed in one pass over the bitmap
+#endif
+
+/// @brief blocks to be freed, @see bfreeq_flush
+typedef struct bfreeq_t {
+    fsnum_t fs;
+    word_t n;
+    block_t bl[NBFREEQ];
+} bfreeq_t;
+
 fsnum_t init_isblock(ldev_t dev);
 
 isuperblock_t *getisblock(fsnum_t fs);
 
+/**
+ * @brief lock in core superblock, sleeps on it while another process holds the lock
+ * 
+ * @param isbk 
+ */
+void slock(isuperblock_t *isbk);
+
+/**
+ * @brief unlock in core superblock and wake the processes sleeping on it, if any
+ * 
+ * @param isbk 
+ */
+void sunlock(isuperblock_t *isbk);
+
 bhead_t *balloc(fsnum_t fs);
 
+/**
+ * @brief find a run of up to *n contiguous free blocks, starting at goal if it is free, and allocate its first block
+ * 
+ * Without a free goal the free list is searched for a complete run first,
+ * else the run ends at the first used or reserved block or at the end of the
+ * bitmap block. The other blocks of the run are reserved for the caller, they
+ * stay free in the bitmap till bclaim() takes them, so a crash loses none of
+ * them. When only reserved blocks are left, the reservations of all inodes
+ * are dropped, @see idropprealloc.
+ * 
+ * @param fs 
+ * @param goal      wanted first block, 0 for the next free one
+ * @param n         number of blocks wanted, set to the length of the run
+ * @return block_t  first block of the run, 0 if no block is left
+ */
+block_t brun(fsnum_t fs, block_t goal, word_t *n);
+
+/**
+ * @brief allocate block bl the caller reserved with brun() and gave up its reservation of
+ * 
+ * @param fs 
+ * @param bl 
+ * @return int      0 on success, -1 if bl got allocated by somebody else in the meantime
+ */
+int bclaim(fsnum_t fs, block_t bl);
+
+/**
+ * @brief get a zeroed buffer marked for delayed write for the newly allocated block bl
+ * 
+ * @param fs 
+ * @param bl 
+ * @return bhead_t* 
+ */
+bhead_t *bclear(fsnum_t fs, block_t bl);
+
 void bfree(fsnum_t fs, block_t  bl);
 
+/**
+ * @brief start collecting blocks of fs to be freed
+ * 
+ * @param q 
+ * @param fs 
+ */
+void bfreeq_init(bfreeq_t *q, fsnum_t fs);
+
+/**
+ * @brief queue block bl to be freed, a full queue is flushed first
+ * 
+ * @param q 
+ * @param bl 
+ */
+void bfreeq_add(bfreeq_t *q, block_t bl);
+
+/**
+ * @brief free all queued blocks
+ * 
+ * @param q 
+ */
+void bfreeq_flush(bfreeq_t *q);
+
+void count_free_inodes(isuperblock_t *isbk);                // recompute free inode summary in inode.c
+
+/**
+ * @brief write in core superblock to disk
+ * 
+ * @param isbk 
+ */
+void update_sblock_on_disk(isuperblock_t *isbk);
+
+/**
+ * @brief write all modified in core superblocks to disk
+ * 
+ */
+void sync_sblocks(void);
+
 #endif
@@ -13,14 +13,46 @@
 #define _BUF_H
 
 #include "tdefs.h"
+#include "config.h"
 
-#define BLOCKSIZE 512
+#define BLOCKSIZE 512   ///< sector, the unit of the drivers and the smallest block
 
+#define MAXBLOCKSIZE (BLOCKSIZE << MAXBSHIFT)
 
-#define NBUFFER 32
+#ifndef NBDEVSHIFT
+#define NBDEVSHIFT 4    ///< number of devices with blocks larger than BLOCKSIZE
+#endif
+
+#ifndef MAXCLUSTER
+#define MAXCLUSTER 8    ///< max number of contiguous blocks in one driver transaction
+#endif
+
+#ifndef BFLUSHAGE
+#define BFLUSHAGE 30    ///< ticks a delayed write may stay in core before bflush() writes it
+#endif
+
+#ifndef BUFSLRU
+#define BUFSLRU 1       ///< segmented LRU replacement (probationary and protected list), 0 for a single LRU free list
+#endif
+
+#ifndef NBUFPROT
+#define NBUFPROT (NBUFFER / 2)  ///< max number of free buffers in the protected list
+#endif
+
+#ifndef BFLUSHBATCH
+#define BFLUSHBATCH 4   ///< max number of clusters written by one bflush() call
+#endif
+
+#ifndef BCOMMITAGE
+#define BCOMMITAGE 10   ///< ticks metadata may wait for the group commit
+#endif
+
+#ifndef BCOMMITMAX
+#define BCOMMITMAX (NBUFFER / 4)  ///< dirty metadata buffers which start the group commit at once
+#endif
 
 typedef struct buffer_t {
-  byte_t mem[BLOCKSIZE];
+  byte_t mem[MAXBLOCKSIZE];
 } buffer_t;
 
 typedef struct bhead_t {
@@ -35,10 +67,72 @@ typedef struct bhead_t {
   byte_t written : 1;
   byte_t infreelist : 1;
   byte_t error : 1;
+  byte_t async : 1;       ///< I/O in flight nobody waits for, buffer_synced() releases it
+  byte_t rahead : 1;      ///< read ahead and not yet asked for by getblk()
+  byte_t wanted : 1;      ///< a process sleeps on the buffer till it is released or its transfer is done
+  byte_t prot : 1;        ///< free buffer is in the protected list
+  byte_t reused : 1;      ///< getblk() found the block in core since it was read, promotes it at release
+  byte_t hint : 2;        ///< bhint_t of the current use, reset by getblk()
+  byte_t meta : 2;        ///< bmeta_t of a delayed write, written by the group commit, @see bdwrite
+  byte_t commit : 1;      ///< taken by the running group commit, busy till its class is written
   ldev_t dev;
   block_t block;
+  byte_t bshift;          ///< block is BLOCKSIZE << bshift bytes, the one of dev
+  word_t dtime;           ///< ticks when buffer was taken clean, age of a delayed write
 } _STRUCTATTR_ bhead_t;
 
+#define BSIZE(b)    ((word_t)BLOCKSIZE << (b)->bshift)     ///< bytes of the block of buffer b
+#define BSECTOR(b)  ((dword_t)(b)->block << (b)->bshift)   ///< first sector of the block of buffer b, for the drivers
+
+/// @brief how a buffer is used, decides where brelse() puts it, @see bhint
+typedef enum bhint_t {
+  BHNONE,                 ///< probationary till it is used a second time
+  BHMETA,                 ///< metadata (superblock, inodes, directories, indirect blocks), protected at once
+  BHSTREAM,               ///< data used once, first to be reclaimed
+} bhint_t;
+
+/// @brief class of a metadata delayed write, the group commit writes the classes in this order
+typedef enum bmeta_t {
+  BMNONE,                 ///< data, written back by age with bflush()
+  BMBITMAP,               ///< free block bitmap and superblock
+  BMINODE,                ///< inodes and indirect blocks
+  BMDIR,                  ///< directory blocks
+} bmeta_t;
+
+/// @brief lookup statistics of one buffer hash chain
+typedef struct bhashstat_t {
+  word_t len;         ///< number of buffers in chain
+  dword_t lookups;    ///< number of lookups hashed to this chain
+  dword_t probes;     ///< number of buffer headers compared during these lookups
+} bhashstat_t;
+
+#ifndef NBSTATDEV
+#define NBSTATDEV 4     ///< number of devices with own block counters
+#endif
+
+/// @brief buffer cache counters
+typedef struct bstat_t {
+  dword_t hits;           ///< getblk() found block in cache
+  dword_t misses;         ///< getblk() had to reclaim a buffer
+  dword_t nofreestalls;   ///< waits for NOFREEBLOCKS
+  dword_t busywaits;      ///< waits for BLOCKBUSY
+  dword_t forcedwrites;   ///< delayed write clusters forced out by reclaim
+  dword_t rahits;         ///< read ahead blocks asked for later
+  dword_t rawasted;       ///< read ahead blocks reclaimed without being asked for
+  dword_t promotions;     ///< buffers moved to the protected list
+  dword_t demotions;      ///< buffers moved back from the protected to the probationary list
+  dword_t commits;        ///< group commits
+  dword_t commitbufs;     ///< metadata buffers written by group commits
+} bstat_t;
+
+/// @brief block counters of one device
+typedef struct bdevstat_t {
+  ldev_t dev;
+  byte_t inuse;
+  dword_t reads;          ///< blocks read from device
+  dword_t writes;         ///< blocks written to device
+} bdevstat_t;
+
 
 /**
  * @brief initialize file system buffers
@@ -49,16 +143,124 @@ void check_bfreelist(void);
 
 
 
+/**
+ * @brief set the block size of device dev to BLOCKSIZE << bshift
+ * 
+ * Delayed writes of dev are written and its cached blocks are invalidated,
+ * their block numbers no longer mean the same sectors.
+ * 
+ * @param dev 
+ * @param bshift    0 .. MAXBSHIFT
+ * @return int      0 on success, -1 if bshift is too large or the table of devices is full
+ */
+int bsetshift(ldev_t dev, byte_t bshift);
+
+/**
+ * @brief block size of device dev
+ * 
+ * @param dev 
+ * @return byte_t   blocks are BLOCKSIZE << bshift bytes, 0 unless set by bsetshift()
+ */
+byte_t bgetshift(ldev_t dev);
+
+
+
+/**
+ * @brief number of chains in the buffer hash table
+ * 
+ * @return word_t 
+ */
+word_t bhashsize(void);
+
+/**
+ * @brief get lookup statistics of a hash chain
+ * 
+ * @param chain   index of chain, 0 .. bhashsize() - 1
+ * @return const bhashstat_t* 
+ */
+const bhashstat_t *getbhashstat(word_t chain);
+
+/**
+ * @brief print chain lengths and lookup/probe counters of buffer hash
+ * 
+ */
+void dump_bhashstat(void);
+
+/**
+ * @brief zero lookup/probe counters of buffer hash (chain lengths are kept)
+ * 
+ */
+void reset_bhashstat(void);
+
+
+
+/**
+ * @brief get buffer cache counters
+ * 
+ * @return const bstat_t* 
+ */
+const bstat_t *getbstat(void);
+
+/**
+ * @brief get block counters of device dev
+ * 
+ * @param dev 
+ * @return const bdevstat_t*  counters or NULL if there was no I/O on dev or the table is full
+ */
+const bdevstat_t *getbdevstat(ldev_t dev);
+
+/**
+ * @brief print buffer cache and per device counters
+ * 
+ */
+void dump_bstat(void);
+
+/**
+ * @brief zero buffer cache and per device counters
+ * 
+ */
+void reset_bstat(void);
+
+
+
 /**
  * @brief add block to free list
  * 
+ * With BUFSLRU valid buffers used a second time or hinted as metadata go to
+ * the tail of the protected list, pushing its least recently used buffer back
+ * to the probationary list when it is full. Streaming buffers go to the head
+ * of the probationary list, they are reclaimed before anything else.
+ * 
  * @param b 
- * @param asFirst 
+ * @param asFirst   true to reclaim it next, e.g. if it is invalid
  */
 void add_buf_to_freelist(bhead_t *b, int asFirst);
 
 
 
+/**
+ * @brief tell the replacement policy how the buffer b is used, b is held by the caller
+ * 
+ * The hint holds till b is released, without BUFSLRU it is ignored.
+ * 
+ * @param b 
+ * @param hint 
+ */
+void bhint(bhead_t *b, bhint_t hint);
+
+
+
+/**
+ * @brief look up block in buffer hash without claiming it
+ * 
+ * @param dev 
+ * @param block 
+ * @return bhead_t*   buffer containing block or NULL if not in core
+ */
+bhead_t *findblk(ldev_t dev, block_t block);
+
+
+
 /**
  * @brief get block from free list
  * 
@@ -75,6 +277,37 @@ bhead_t *getblk(ldev_t dev, block_t block);
  */
 void syncall_buffers(int async);
 
+/**
+ * @brief sync all buffers of device dev to disk, e.g. before unmount
+ * 
+ * @param dev 
+ * @param async   if true, sync buffers asynchronously
+ */
+void syncdev_buffers(ldev_t dev, int async);
+
+/**
+ * @brief background write-back, starts async write of delayed writes older than BFLUSHAGE
+ * 
+ * Called from the clock tick, writes at most BFLUSHBATCH clusters of data per call.
+ * Starts the group commit once metadata waited BCOMMITAGE ticks or BCOMMITMAX
+ * metadata buffers are dirty.
+ */
+void bflush(void);
+
+/**
+ * @brief group commit, write all metadata delayed writes ordered by class
+ * 
+ * The free metadata buffers are taken at once and written class by class,
+ * bitmap, then inodes, then directories, each class after the previous one
+ * completed. Buffers taken stay busy till written, updates made meanwhile go
+ * to the next commit. A held buffer ends the commit at its class, the later
+ * classes might depend on it and wait for the next commit.
+ * 
+ * @param async   if false wait for a running commit and for this one to complete,
+ *                if true return at once, nothing is started while a commit runs
+ */
+void bcommit(int async);
+
 
 
 /**
@@ -86,12 +319,32 @@ void syncall_buffers(int async);
  */
 bhead_t *bread(ldev_t dev, block_t block);
 
+/**
+ * @brief read block and cluster up to n - 1 following blocks into the same driver transaction
+ * 
+ * @param dev       device to read from
+ * @param block     block to read
+ * @param n         number of physically contiguous blocks wanted
+ * @return bhead_t* pointer to block header of block
+ */
+bhead_t *breadn(ldev_t dev, block_t block, word_t n);
+
+/**
+ * @brief start async read of n blocks, the caller never waits for them
+ * 
+ * @param dev       device to read from
+ * @param block     first block
+ * @param n         number of blocks
+ * @return word_t   number of blocks in core or being read, less than n if no buffer was left
+ */
+word_t breadahead(ldev_t dev, block_t block, word_t n);
+
 /**
  * @brief reads bl1 and pre loads bl2
  * 
  * @param dev 
  * @param bl1 
- * @param bl2 
+ * @param bl2         block to pre load, 0 for none
  * @return bhead_t*   buffer for bl1
  */
 bhead_t *breada(ldev_t dev, block_t bl1, block_t bl2);
@@ -103,6 +356,29 @@ bhead_t *breada(ldev_t dev, block_t bl1, block_t bl2);
  */
 void bwrite(bhead_t *b);
 
+/**
+ * @brief mark held buffer b as delayed write of metadata class meta, it goes to disk with the next group commit
+ * 
+ * @param b 
+ * @param meta  BMNONE for data, written back by bflush()
+ */
+void bdwrite(bhead_t *b, bmeta_t meta);
+
+/**
+ * @brief raw transfer of n blocks of the size of dev between mem and dev, bypassing the buffer cache
+ * 
+ * Up to MAXCLUSTER blocks go to the driver in one transaction, straight from or
+ * into mem. Cached copies of the blocks are synced before and invalidated by a write.
+ * 
+ * @param dev 
+ * @param block     first block
+ * @param mem       n blocks of the caller, @see bgetshift
+ * @param n         number of blocks
+ * @param iswrite   true to write mem to the device
+ * @return word_t   number of blocks transferred before the first error
+ */
+word_t physio(ldev_t dev, block_t block, byte_t *mem, word_t n, int iswrite);
+
 /**
  * @brief release buffer 
  * 
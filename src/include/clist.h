@@ -14,6 +14,7 @@
 #define CLIST_H
 
 #include <tdefs.h>
+#include "config.h"
 
 #define MAXNODEDATA 16  ///< max size of node data
 
@@ -47,5 +48,10 @@ void clist_destroy(byte_t clisti);
 int clist_size(byte_t clisti);
 int clist_push(byte_t clisti, char *data, sizem_t size);
 int clist_pop(byte_t clisti, char *data, sizem_t size);
+int clist_splice(byte_t dsti, byte_t srci);
+int clist_peek(byte_t clisti, sizem_t offset, char *data, sizem_t size);
+int clist_find(byte_t clisti, char c);
+int clist_getblock(byte_t clisti, char **data);
+void clist_drop(byte_t clisti, sizem_t size);
 
 #endif /* CLIST_H */
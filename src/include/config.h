@@ -0,0 +1,129 @@
+/**
+ * @file config.h
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief sizes of the kernel tables, selected by a memory profile
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * MEMPROFILE picks a set of table sizes, each of them can still be set on
+ * its own with -D. tools/memreport.c prints what the tables cost and fails
+ * the build if they exceed RAMBUDGET.
+ */
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#define MEMTINY 1         ///< smallest working set, 512 byte blocks only
+#define MEMDEFAULT 2
+#define MEMLARGE 3        ///< larger caches and blocks up to 2K for boards with more RAM
+
+#ifndef MEMPROFILE
+#define MEMPROFILE MEMDEFAULT ///< memory profile, set by MEMPROFILE of CMakeLists.txt
+#endif
+
+#if MEMPROFILE == MEMTINY
+
+#ifndef NBUFFER
+#define NBUFFER 8
+#endif
+#ifndef MAXBSHIFT
+#define MAXBSHIFT 0
+#endif
+#ifndef NINODES
+#define NINODES 16
+#endif
+#ifndef MAXFILETAB
+#define MAXFILETAB 16
+#endif
+#ifndef MAXNODES
+#define MAXNODES 32
+#endif
+#ifndef MAXCLISTS
+#define MAXCLISTS 8
+#endif
+#ifndef NFREEINODES
+#define NFREEINODES 16
+#endif
+#ifndef NFREEBLOCKS
+#define NFREEBLOCKS 16
+#endif
+#ifndef NDNLC
+#define NDNLC 16
+#endif
+#ifndef RAMBUDGET
+#define RAMBUDGET 10240
+#endif
+
+#elif MEMPROFILE == MEMDEFAULT
+
+#ifndef NBUFFER
+#define NBUFFER 32        ///< number of buffers of the buffer cache
+#endif
+#ifndef MAXBSHIFT
+#define MAXBSHIFT 0       ///< largest block is BLOCKSIZE << MAXBSHIFT bytes, the size of every buffer
+#endif
+#ifndef NINODES
+#define NINODES 50        ///< number of inodes in system
+#endif
+#ifndef MAXFILETAB
+#define MAXFILETAB 100    ///< maximum number of open files system wide
+#endif
+#ifndef MAXNODES
+#define MAXNODES 100      ///< max number of clist nodes
+#endif
+#ifndef MAXCLISTS
+#define MAXCLISTS 20      ///< max number of clists
+#endif
+#ifndef NFREEINODES
+#define NFREEINODES 50    ///< free inodes cached per file system
+#endif
+#ifndef NFREEBLOCKS
+#define NFREEBLOCKS 50    ///< free blocks cached per file system
+#endif
+#ifndef NDNLC
+#define NDNLC 32          ///< number of cached names
+#endif
+#ifndef RAMBUDGET
+#define RAMBUDGET 36864   ///< bytes the tables of tools/memreport.c may take
+#endif
+
+#elif MEMPROFILE == MEMLARGE
+
+#ifndef NBUFFER
+#define NBUFFER 64
+#endif
+#ifndef MAXBSHIFT
+#define MAXBSHIFT 2
+#endif
+#ifndef NINODES
+#define NINODES 100
+#endif
+#ifndef MAXFILETAB
+#define MAXFILETAB 200
+#endif
+#ifndef MAXNODES
+#define MAXNODES 200
+#endif
+#ifndef MAXCLISTS
+#define MAXCLISTS 40
+#endif
+#ifndef NFREEINODES
+#define NFREEINODES 50
+#endif
+#ifndef NFREEBLOCKS
+#define NFREEBLOCKS 50
+#endif
+#ifndef NDNLC
+#define NDNLC 64
+#endif
+#ifndef RAMBUDGET
+#define RAMBUDGET 180224
+#endif
+
+#else
+#error unknown MEMPROFILE
+#endif
+
+#endif
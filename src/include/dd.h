@@ -17,11 +17,29 @@
 
 #define BLOCKSIZE 512
 
+#define NBQUEUES 4        ///< number of block device majors with a request queue
+#define NBDEVOPEN 8       ///< number of block devices open at the same time
+
+/**
+ * @brief request queue of a block device major (one drive, minors are its partitions)
+ * 
+ * Pending buffers are linked by fnext (a busy buffer is never in the free list)
+ * and sorted by minor and block, the next request is picked C-LOOK style.
+ */
+typedef struct bqueue_t {
+  bhead_t *head;            ///< pending requests in ascending order
+  dword_t pos;              ///< elevator position, next request starts at or above it
+  word_t ninflight;         ///< buffers handed to the driver and not completed yet
+  byte_t running : 1;       ///< queue is being dispatched
+} bqueue_t;
+
 typedef struct bdev_t {
   void (*init)(void);  
   void (*open)(ldevminor_t minor);
   void (*close)(ldevminor_t minor);
   void (*strategy)(ldevminor_t minor, bhead_t *bh);
+  /// optional, transfers n buffers of contiguous blocks (same direction) as one command, NULL if not supported
+  void (*strategyv)(ldevminor_t minor, bhead_t **bhv, word_t n);
 } bdev_t;
 
 typedef struct cdev_t {
@@ -35,9 +53,14 @@ typedef struct cdev_t {
 
 void init_dd(void);
 
-void bdevopen(ldev_t ldev);
+int bdevvalid(ldev_t ldev);
+int bdevopen(ldev_t ldev);
 void bdevclose(ldev_t ldev);
 void bdevstrategy(ldev_t ldev, bhead_t *bh);
+void bdevstrategyv(ldev_t ldev, bhead_t **bhv, word_t n);
+void bdevdone(ldev_t ldev);
+void bdevplug(void);
+void bdevunplug(void);
 
 void cdevopen(ldev_t ldev);
 void cdevclose(ldev_t ldev);
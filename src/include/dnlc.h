@@ -0,0 +1,103 @@
+/**
+ * @file dnlc.h
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief directory name lookup cache
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef _DNLC_H
+#define _DNLC_H
+
+#include "tdefs.h"
+#include "fs.h"
+#include "config.h"
+
+#ifndef DNLCHASHBITS
+#define DNLCHASHBITS 3
+#endif
+
+/// @brief cached directory entry, inum 0 is a negative entry (name does not exist)
+typedef struct dnlcent_t {
+  struct dnlcent_t *hnext;    ///< next in hash chain
+  struct dnlcent_t *lprev;    ///< LRU list, head is least recently used
+  struct dnlcent_t *lnext;
+  fsnum_t fs;                 ///< 0 if unused
+  ninode_t pinum;             ///< inode of directory
+  ninode_t inum;              ///< inode of entry or 0
+  byte_t nlen;
+  char name[DIRNAMEENTRY];
+} _STRUCTATTR_ dnlcent_t;
+
+/// @brief lookup counters of name cache
+typedef struct dnlcstat_t {
+  dword_t hits;               ///< positive hits
+  dword_t neghits;            ///< negative hits
+  dword_t misses;
+} dnlcstat_t;
+
+
+/**
+ * @brief initialize name cache
+ *
+ */
+void init_dnlc(void);
+
+/**
+ * @brief look up name in directory pinum of fs
+ *
+ * @param fs
+ * @param pinum   inode of directory
+ * @param name    name, need not be 0 terminated
+ * @param nlen    length of name
+ * @param inum    set to inode of entry, 0 if name is known not to exist
+ * @return int    true if found in cache
+ */
+int dnlc_lookup(fsnum_t fs, ninode_t pinum, const char *name, int nlen, ninode_t *inum);
+
+/**
+ * @brief enter result of a directory scan, replaces the least recently used entry
+ *
+ * @param fs
+ * @param pinum
+ * @param name
+ * @param nlen
+ * @param inum    inode of entry, 0 for a name that does not exist
+ */
+void dnlc_enter(fsnum_t fs, ninode_t pinum, const char *name, int nlen, ninode_t inum);
+
+/**
+ * @brief forget name in directory pinum, must be called when a directory entry is added or removed
+ *
+ * @param fs
+ * @param pinum
+ * @param name    0 terminated name
+ */
+void dnlc_remove(fsnum_t fs, ninode_t pinum, const char *name);
+
+/**
+ * @brief forget all names in directory pinum
+ *
+ * @param fs
+ * @param pinum
+ */
+void dnlc_purgedir(fsnum_t fs, ninode_t pinum);
+
+/**
+ * @brief forget all names of file system fs
+ *
+ * @param fs
+ */
+void dnlc_purgefs(fsnum_t fs);
+
+/**
+ * @brief get lookup counters
+ *
+ * @return const dnlcstat_t*
+ */
+const dnlcstat_t *getdnlcstat(void);
+
+#endif
@@ -14,12 +14,15 @@
 
 #include "tdefs.h"
 #include "inode.h"
+#include "config.h"
 
 #define MAXFS 6           ///< maximum number of file systems
 #define MAXOPENFILES 10   ///< maximum number of open files per process
-#define MAXFILETAB 100    ///< maximum number of open files system wide
+#define PIPESIZE 256      ///< maximum number of bytes buffered in a FIFO
+#define MAXIOV 16         ///< maximum number of segments of readv() and writev()
 #define DIRNAMEENTRY 14   ///< maximum length of directory entry name
 #define MAXPATH 256       ///< maximum length of path name
+#define MAXREADAHEAD 8    ///< maximum read-ahead window of sequentially read files in blocks
 
 typedef enum omode_t {
   OREAD = 0x0001,       ///< open for reading
@@ -40,6 +43,12 @@ typedef enum seek_t {
   SEEKEND          ///< seek from end of file
 } seek_t;
 
+/// @brief segment of readv() and writev()
+typedef struct iovec_t {
+  byte_t *base;
+  fsize_t len;
+} iovec_t;
+
 typedef struct dirent_t {
   ninode_t inum;
   char name[DIRNAMEENTRY];
@@ -50,15 +59,73 @@ typedef struct filetab_t {
   iinode_t *inode;
   word_t refs;
   fsize_t offset;
-  int flags;
+  int flags;          ///< omode the entry was opened with
+  fsize_t raoffset;   ///< offset a sequential read() continues at
+  dword_t ralblock;   ///< next logical block not read ahead yet
+  byte_t rawin;       ///< current read-ahead window in blocks, 0 for random access
+  struct filetab_t *fnext;  ///< next free entry while inode is NULL
 } filetab_t;
 
+#define DIRNOFREE ((fsize_t)~0ul)    ///< position of free directory slot is not known
+
+#ifndef DIRHASHBUCKETS
+#define DIRHASHBUCKETS 16   ///< number of bucket blocks of a new hashed directory
+#endif
+
+/**
+ * @brief last entry of each block of a hashed directory
+ * 
+ * Hashed directories keep . and .. in block 0 followed by DIRHASHBUCKETS bucket
+ * blocks, which are allocated when the first name hashes to them. Full buckets
+ * get overflow blocks appended at the end of the directory and chained via
+ * next. The tail of block 0 holds the number of buckets.
+ */
+typedef struct dirtail_t {
+  ninode_t zero;      ///< always 0, looks like an unused entry
+  dword_t next;       ///< logical block of next overflow block, 0 if none
+  word_t nbuckets;    ///< number of buckets, only in block 0
+  byte_t pad[DIRNAMEENTRY - sizeof(dword_t) - sizeof(word_t)];
+} _STRUCTATTR_ dirtail_t;
+
+/// @brief directory iterator, maps and pins one directory block at a time
+typedef struct diriter_t {
+  iinode_t *dir;      ///< directory
+  fsize_t pos;        ///< position of current entry
+  bhead_t *bh;        ///< pinned block of current entry or NULL
+  dirent_t *de;       ///< current entry or NULL
+  fsize_t freepos;    ///< position of first unused entry passed, DIRNOFREE if none
+} diriter_t;
+
+void diropen(diriter_t *it, iinode_t *dir);                 // directory iterator in dir.c
+dirent_t *dirnext(diriter_t *it);
+dirent_t *dirfind(diriter_t *it, const char *name, int nlen);
+void dirdirty(diriter_t *it);
+void dirclose(diriter_t *it);
+int dirempty(iinode_t *dir);
+word_t dirhash(const char *name, int nlen);
+fsize_t dirslot(iinode_t *dir, const char *name);
+void dirinithash(iinode_t *dir, dirent_t *block0);
+
+extern word_t nsgen;      ///< changes when directories are removed, mounted on or unmounted, invalidates cached paths
+
+int fifoopen(iinode_t *ii, omode_t omode);                   // FIFOs in pipe.c
+void fifoclose(iinode_t *ii, omode_t omode);
+int fiforead(iinode_t *ii, const iovec_t *iov, int iovcnt, int nonblock);
+int fifowrite(iinode_t *ii, const iovec_t *iov, int iovcnt, int nonblock);
+
 void init_fs(void);
 int mknode(const char *path, ftype_t ftype, fmode_t fmode);
+int mknodedev(const char *path, ftype_t ftype, fmode_t fmode, ldev_t dev);
 int open(const char *fname, omode_t omode, fmode_t fmode);
 int close(int fd);
+int dup(int fdesc);
 int read(int fdesc, byte_t *buf, fsize_t nbytes);
 int write(int fdesc, byte_t *buf, fsize_t nbytes);
+int pread(int fdesc, byte_t *buf, fsize_t nbytes, fsize_t offset);
+int pwrite(int fdesc, byte_t *buf, fsize_t nbytes, fsize_t offset);
+int readv(int fdesc, const iovec_t *iov, int iovcnt);
+int writev(int fdesc, const iovec_t *iov, int iovcnt);
+int pipe(int fdesc[2]);
 int lseek(int fdesc, fsize_t offset, seek_t whence);
 int unlink(const char *path);
 int mkdir(const char *path, fmode_t fmode);
@@ -75,12 +142,12 @@ char *getcwd(char *buf, sizem_t size);
 int mount(const char *src, const char *dst, int mflags);    // mount file system in blocks.c
 int umount(const char *path);                               // umount file system in blocks.c
 int sync(void);                                             // sync file system 
+int fsync(int fd);
 // int opendir(const char *path);
 // int closedir(int fd);
 // int readdir(int fd, dirent_t *buf);
-// int fsync(int fd);
-// int ftruncate(int fd, fsize_t length);
-// int truncate(const char *path, fsize_t length);
+int ftruncate(int fd, fsize_t length);
+int truncate(const char *path, fsize_t length);
 
 
 #endif
@@ -15,8 +15,15 @@
 #include "tdefs.h"
 #include "dd.h"
 #include "clist.h"
+#include "config.h"
 
-#define NINODES 50          ///< number of inodes in system
+#ifndef IKEEPDIRS
+#define IKEEPDIRS 1         ///< reuse cached directory inodes only if no other inode is free
+#endif
+
+#ifndef NPREALLOC
+#define NPREALLOC 8         ///< blocks allocated at once for a regular file written sequentially, 1 to disable
+#endif
 
 #define NBLOCKREFS 21       ///< number of block references in inode
 #define STARTREFSLEVEL 19   ///< index of start of reference levels > 0
@@ -33,6 +40,8 @@ enum ftype {
 
 typedef word_t ftype_t;
 
+#define FHASHDIR 0x8000     ///< fmode flag of directories with hashed layout, not visible to users
+
 /// @brief inode stored on disk
 typedef struct dinode_t {
   ftype_t ftype;
@@ -55,16 +64,26 @@ typedef struct iinode_t
   dinode_t dinode;
   byte_t locked : 1;
   byte_t modified : 1;
+  byte_t wanted : 1;      ///< a process sleeps till the inode is unlocked
   fsnum_t fs;
   ninode_t inum;
   nref_t nref;
-  clist_t *rclist;
-  clist_t *wclist;
+  byte_t rclist;          ///< clist index of data of FIFO, 0 if none
+  byte_t wclist;
+  byte_t nreaders;        ///< FIFO open for reading
+  byte_t nwriters;        ///< FIFO open for writing
   fsnum_t fsmnt;
   struct iinode_t *hprev;
   struct iinode_t *hnext;
   struct iinode_t *fprev;
   struct iinode_t *fnext;
+  dword_t bmlblock;       ///< logical block of last indirect mapping
+  block_t bmfsblock;      ///< fs block of last indirect mapping, 0 if none cached
+  block_t bmrdablock;     ///< read ahead block of last indirect mapping
+  dword_t bmleafbase;     ///< first indirect reference index covered by bmleaf
+  block_t bmleaf;         ///< last leaf indirect block, 0 if none cached
+  block_t prealloc;       ///< next of the blocks reserved for the file, @see iballoc
+  byte_t nprealloc;       ///< number of blocks reserved
 } _STRUCTATTR_ iinode_t;
 
 typedef struct stat_t {
@@ -84,15 +103,24 @@ typedef struct bmap_t {
   fsize_t offblock;
   fsize_t nbytesleft;
   block_t rdablock;
+  byte_t newblock;        ///< fsblock was allocated by this call and is zeroed
 } _STRUCTATTR_ bmap_t;
 
 typedef struct namei_t {
   iinode_t *i;
   ninode_t p;
   fsnum_t fs;
+  fsize_t pfree;          ///< if i is NULL, position of first free entry in parent p (fsize to append, ~0 unknown)
 } _STRUCTATTR_ namei_t;
 
-#define NINODESBLOCK  ((block_t)( BLOCKSIZE / sizeof(dinode_t) ))
+/// @brief counters of in core inode cache
+typedef struct istat_t {
+  dword_t hits;           ///< iget found the inode in core
+  dword_t misses;         ///< iget read the inode from disk
+  dword_t evictions;      ///< misses which replaced a cached inode
+} istat_t;
+
+#define NINODESBLOCK  ((block_t)( BLOCKSIZE / sizeof(dinode_t) ))   ///< inodes per sector, a block of a fs with larger blocks holds more
 
 
 /**
@@ -121,11 +149,92 @@ iinode_t *iget(fsnum_t fs, ninode_t inum);
  */
 void iput(iinode_t *inode);
 
+/**
+ * @brief lock inode, sleeps on the inode while another process holds the lock
+ * 
+ * @param inode 
+ */
+void ilock(iinode_t *inode);
+
+/**
+ * @brief unlock inode and wake the processes sleeping on it, if any
+ * 
+ * @param inode 
+ */
+void iunlock(iinode_t *inode);
+
 namei_t namei(const char *p);
 bmap_t bmap(iinode_t *inode, fsize_t pos);
+bmap_t bmaplookup(iinode_t *inode, fsize_t pos);
+
+/**
+ * @brief drop cached block mappings of inode, must be called when blocks of inode are freed
+ * 
+ * @param inode 
+ */
+void bmapinvalidate(iinode_t *inode);
 
 void free_all_blocks(iinode_t *inode);
 
+/**
+ * @brief allocate a data block for inode, goal if possible
+ * 
+ * Regular files get a run of NPREALLOC contiguous blocks at once, the rest is
+ * reserved in the in core inode for the next blocks of the file. So files
+ * written at the same time do not interleave their blocks. A reserved block is
+ * marked in the bitmap only when it is taken, @see bclaim. The run is dropped
+ * when the file is not written sequentially, @see ifreeprealloc.
+ * 
+ * @param inode 
+ * @param goal        block following the previous block of the file, 0 if unknown
+ * @return bhead_t*   zeroed buffer of the block or NULL if no block is left
+ */
+bhead_t *iballoc(iinode_t *inode, block_t goal);
+
+/**
+ * @brief give up the blocks reserved for inode, done when it is truncated or released
+ * 
+ * @param inode 
+ */
+void ifreeprealloc(iinode_t *inode);
+
+/**
+ * @brief give up the blocks reserved by all inodes of fs, done when only reserved blocks are left
+ * 
+ * @param fs 
+ */
+void idropprealloc(fsnum_t fs);
+
+/**
+ * @brief number of blocks from bl on not reserved by an inode, one pass over the in core inodes
+ * 
+ * Called for the candidates the bitmap found free, not per bit.
+ * 
+ * @param fs 
+ * @param bl 
+ * @param n         blocks wanted
+ * @return block_t  0 .. n, 0 if bl is reserved
+ */
+block_t iunreserved(fsnum_t fs, block_t bl, block_t n);
+
+/**
+ * @brief set size of inode to length, blocks past length are freed, caller locks inode
+ * 
+ * A longer size leaves a hole, which reads as zeros.
+ * 
+ * @param inode 
+ * @param length 
+ */
+void itrunc(iinode_t *inode, fsize_t length);
+void update_inode_on_disk(iinode_t *inode);
+
 int activeinodes(fsnum_t fs);
 
+/**
+ * @brief get counters of in core inode cache
+ * 
+ * @return const istat_t* 
+ */
+const istat_t *getistat(void);
+
 #endif
@@ -15,18 +15,26 @@
 #include "inode.h"
 #include "fs.h"
 
+/// @brief reasons a process waits, X(id), one wait queue each, decoded by tools/tracedec.c
+#define WAITREASONS(X) \
+  X(RUNHIGH) \
+  X(RUNMID) \
+  X(RUNLOW) \
+  X(SBLOCKBUSY) \
+  X(BLOCKBUSY) \
+  X(NOFREEBLOCKS) \
+  X(BLOCKREAD) \
+  X(BLOCKWRITE) \
+  X(INODELOCKED) \
+  X(SWAPIN) \
+  X(SWAPOUT) \
+  X(FIFOEMPTY) \
+  X(FIFOFULL)
+
+#define WAITENUM(id) id,
+
 enum waitfor {
-  RUNHIGH,
-  RUNMID,
-  RUNLOW,
-  SBLOCKBUSY,
-  BLOCKBUSY,
-  NOFREEBLOCKS,
-  BLOCKREAD,
-  BLOCKWRITE,
-  INODELOCKED,
-  SWAPIN,
-  SWAPOUT,
+  WAITREASONS(WAITENUM)
   NQUEUES
 };
 
@@ -87,7 +95,10 @@ typedef struct userspace_t {
   iinode_t *fsroot;
   iinode_t *workdir;
   fdesctab_t fdesc[MAXOPENFILES];
+  word_t fdused;          ///< bit i set if fdesc[i] is in use, @see freefdesc
   errno_t err;
+  char cwd[MAXPATH];      ///< path of workdir, empty if not known
+  word_t cwdgen;          ///< nsgen cwd was valid for
 } u_t;
 
 
@@ -95,12 +106,22 @@ typedef struct process_t {
   int pid;
   byte_t isswapped : 1;
   waitfor_t iswaitingfor;
+  const void *wchan;          ///< object slept on, NULL if not sleeping on a channel
   struct process_t *queue;
+  struct process_t *wnext;    ///< next process sleeping on a channel of the same hash chain
   u_t *u;
 } process_t;
 
 extern process_t *active;
 
+extern word_t ticks;      ///< clock ticks since start
+
+/**
+ * @brief called by timer, advances ticks and runs periodic kernel work
+ * 
+ */
+void clocktick(void);
+
 /**
  * @brief waitfor puts process to sleep till reason is no longer valid
  * 
@@ -115,4 +136,22 @@ void waitfor(waitfor_t w);
  */
 void wakeall(waitfor_t w);
 
+/**
+ * @brief puts process to sleep till wakeupon(chan) is called for the object chan
+ * 
+ * Callers set a wanted flag in the object before, so the releasing side only
+ * calls wakeupon() if somebody sleeps.
+ * 
+ * @param chan  address of the object waited for
+ * @param w     reason to wait
+ */
+void sleepon(const void *chan, waitfor_t w);
+
+/**
+ * @brief wakes the processes sleeping on object chan only
+ * 
+ * @param chan  address of the object
+ */
+void wakeupon(const void *chan);
+
 #endif
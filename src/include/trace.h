@@ -0,0 +1,99 @@
+/**
+ * @file trace.h
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief event trace ring of buffer, inode, block and sleep events
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Tracepoints record a binary event into a fixed ring, tools/tracedec.c
+ * turns a dump of the ring (a file written by the mockup or a memory dump
+ * of a bochs run) into a timeline. Without KTRACE the tracepoints are
+ * compiled out, their arguments are not evaluated.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "tdefs.h"
+
+#ifndef KTRACE
+#define KTRACE 0          ///< 1 to compile in the trace ring and the tracepoints
+#endif
+
+#ifndef NTRACE
+#define NTRACE 256        ///< records in the ring, older ones are overwritten
+#endif
+
+#define TRACEMAGIC 0x45435254   ///< "TRCE", marks the ring in a memory dump
+
+/**
+ * @brief the events, X(id, name, name of a, name of b, name of c), an empty name is an unused argument
+ *
+ */
+#define TRACEEVENTS(X) \
+  X(TRGETBLK,  "getblk",  "hit",   "dev",   "block") \
+  X(TREVICT,   "evict",   "minor", "block", "for") \
+  X(TRREAD,    "read",    "n",     "dev",   "block") \
+  X(TRWRITE,   "write",   "n",     "dev",   "block") \
+  X(TRCOMMIT,  "commit",  "class", "n",     "") \
+  X(TRIGET,    "iget",    "hit",   "fs",    "inum") \
+  X(TRNAMEI,   "namei",   "hit",   "dir",   "name") \
+  X(TRBALLOC,  "balloc",  "n",     "fs",    "block") \
+  X(TRBFREE,   "bfree",   "",      "fs",    "block") \
+  X(TRSLEEP,   "sleep",   "wait",  "pid",   "chan") \
+  X(TRRUN,     "run",     "wait",  "pid",   "chan") \
+  X(TRWAKEUP,  "wakeup",  "",      "",      "chan")
+
+#define TRACEENUM(id, name, a, b, c) id,
+
+/// @brief event id of a record
+typedef enum traceev_t {
+  TRACEEVENTS(TRACEENUM)
+  NTRACEEV
+} traceev_t;
+
+/// @brief one event
+typedef struct trace_t {
+  word_t time;        ///< ticks
+  byte_t event;       ///< traceev_t
+  byte_t a;           ///< small argument, e.g. a flag or a count
+  word_t b;
+  word_t c;
+} _STRUCTATTR_ trace_t;
+
+/// @brief the ring with a header the decoder finds in a memory dump
+typedef struct tracebuf_t {
+  dword_t magic;      ///< TRACEMAGIC
+  word_t nrec;        ///< NTRACE
+  word_t recsize;     ///< sizeof(trace_t)
+  dword_t next;       ///< records written, the ring holds the last nrec of them
+  trace_t rec[NTRACE];
+} _STRUCTATTR_ tracebuf_t;
+
+#define TRACECHAN(chan) ((word_t)(unsigned long)(chan))   ///< low word of a channel address
+
+#if KTRACE
+
+extern tracebuf_t tracebuf;
+
+/**
+ * @brief record one event stamped with ticks, use TRACE()
+ *
+ * @param event   traceev_t
+ * @param a
+ * @param b
+ * @param c
+ */
+void traceev(byte_t event, byte_t a, word_t b, word_t c);
+
+#define TRACE(event, a, b, c) traceev((event), (byte_t)(a), (word_t)(b), (word_t)(c))
+
+#else
+
+#define TRACE(event, a, b, c) ((void)0)
+
+#endif
+
+#endif
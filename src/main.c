@@ -15,6 +15,12 @@
 #include "buf.h"
 #include "fs.h"
 #include "clist.h"
+#include "dnlc.h"
+#include "trace.h"
+
+#if KTRACE
+#include <stdio.h>
+#endif
 
 bdev_t *bdevtable[] = {
   NULL
@@ -38,8 +44,16 @@ int main(void)
   init_dd();
   init_buffers();
   init_inodes();
+  init_dnlc();
   init_fs(); 
   
+#if KTRACE
+  FILE *f = fopen("mockup.trace", "wb");    // decoded by tracedec
+  if (f) {
+    fwrite(&tracebuf, sizeof(tracebuf), 1, f);
+    fclose(f);
+  }
+#endif
   
   return 0;
 }
@@ -10,14 +10,22 @@
  */
 
 #include "pc.h"
+#include "buf.h"
 #include "utils.h"
+#include "trace.h"
 
 
 
+#define NWCHAN 16     ///< hash chains of processes sleeping on a channel
+#define WCHANHASH(chan) ((((unsigned long)(chan)) >> 4) % NWCHAN)
+
 process_t *waitforq[NQUEUES];
+process_t *wchanq[NWCHAN];
 
 process_t *active = NULL;
 
+word_t ticks = 0;
+
 void waitfor(waitfor_t w)
 {
   ASSERT(w < NQUEUES);
@@ -28,3 +36,54 @@ void wakeall(waitfor_t w)
 {
   ASSERT(w < NQUEUES);
 }
+
+
+
+void sleepon(const void *chan, waitfor_t w)
+{
+  ASSERT(chan);
+  ASSERT(w < NQUEUES);
+  ASSERT(active);
+  process_t **q = &wchanq[WCHANHASH(chan)];
+  TRACE(TRSLEEP, w, active->pid, TRACECHAN(chan));
+  active->wchan = chan;
+  active->iswaitingfor = w;
+  active->wnext = *q;
+  *q = active;
+  /// @todo switch to next runnable process, wakeupon() has unlinked active when it runs again
+  for ( ; *q ; q = &(*q)->wnext )     // no scheduler yet, do not stay in the chain
+    if (*q == active) {
+      *q = active->wnext;
+      break;
+    }
+  active->wchan = NULL;
+  active->wnext = NULL;
+  TRACE(TRRUN, w, active->pid, TRACECHAN(chan));
+}
+
+
+
+void wakeupon(const void *chan)
+{
+  ASSERT(chan);
+  TRACE(TRWAKEUP, 0, 0, TRACECHAN(chan));
+  process_t **q = &wchanq[WCHANHASH(chan)];
+  while (*q) {
+    process_t *p = *q;
+    if (p->wchan == chan) {
+      *q = p->wnext;
+      p->wchan = NULL;
+      p->wnext = NULL;
+      /// @todo make p runnable
+    } else
+      q = &p->wnext;
+  }
+}
+
+
+
+void clocktick(void)
+{
+  ++ticks;
+  bflush();
+}
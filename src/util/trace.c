@@ -0,0 +1,36 @@
+/**
+ * @file trace.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief event trace ring
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "trace.h"
+#include "pc.h"
+
+#if KTRACE
+
+tracebuf_t tracebuf = { TRACEMAGIC, NTRACE, sizeof(trace_t), 0, { { 0, 0, 0, 0, 0 } } };
+
+
+
+void traceev(byte_t event, byte_t a, word_t b, word_t c)
+{
+  trace_t *t = &tracebuf.rec[tracebuf.next % NTRACE];
+  t->time = ticks;
+  t->event = event;
+  t->a = a;
+  t->b = b;
+  t->c = c;
+  ++tracebuf.next;
+}
+
+#else
+
+typedef int trace_unused_t;   ///< ISO C wants a declaration in every translation unit
+
+#endif
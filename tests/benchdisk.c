@@ -0,0 +1,165 @@
+/**
+ * @file benchdisk.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief RAM disk of configurable size for fsbench, modelled on tstdisk.c
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+
+#include "buf.h"
+#include "inode.h"
+#include "blocks.h"
+#include "fs.h"
+#include "utils.h"
+#include "dd.h"
+#include "pc.h"
+#include "disksim.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BENCHNBLOCKS
+#define BENCHNBLOCKS 8192     ///< default size of the disk in blocks
+#endif
+
+#ifndef BENCHNINODES
+#define BENCHNINODES 1024     ///< default number of inodes
+#endif
+
+
+
+void benchdisk_open(ldevminor_t minor);
+void benchdisk_close(ldevminor_t minor);
+void benchdisk_strategy(ldevminor_t minor, bhead_t *bh);
+void benchdisk_strategyv(ldevminor_t minor, bhead_t **bhv, word_t n);
+void benchdisk_transfer(ldevminor_t minor, bhead_t *bh);
+
+bdev_t benchdisk = {
+  NULL,
+  benchdisk_open,
+  benchdisk_close,
+  benchdisk_strategy,
+  benchdisk_strategyv
+};
+
+block_t benchdisk_nblocks = BENCHNBLOCKS;   ///< size of the disk, set before it is opened
+ninode_t benchdisk_ninodes = BENCHNINODES;  ///< number of inodes, set before it is opened
+word_t benchdisk_features = 0;              ///< SBF... feature flags of the new file system
+byte_t benchdisk_bshift = 0;                ///< blocks of the new file system are BLOCKSIZE << bshift bytes
+
+dword_t benchdisk_ncmds = 0;    ///< number of driver transactions (strategy/strategyv calls)
+dword_t benchdisk_nblocksio = 0;  ///< number of blocks transferred
+
+byte_t *benchdisk_mem = NULL;
+
+disksim_t benchdisk_sim;   ///< latency model, set up when the disk is opened
+
+
+
+/**
+ * @brief open the bench disk and put an empty file system on it
+ *
+ * Same layout as the test disk: block 0 reserved, superblock, inodes,
+ * bitmap and the root directory in the first data block. With blocks
+ * larger than a sector the superblock is in block 0. The superblock
+ * is marked not clean so the free counts are computed at mount.
+ *
+ * @param minor
+ */
+void benchdisk_open(ldevminor_t minor)
+{
+  ASSERT(minor < 1);
+  ASSERT(benchdisk_nblocks > 0);
+  ASSERT(benchdisk_bshift <= MAXBSHIFT);
+  sizem_t bsize = (sizem_t)BLOCKSIZE << benchdisk_bshift;
+  benchdisk_mem = malloc((sizem_t)benchdisk_nblocks * bsize);
+  ASSERT(benchdisk_mem);
+  memset(benchdisk_mem, 0, (sizem_t)benchdisk_nblocks * bsize);
+
+  block_t ninodesblock = NINODESBLOCK << benchdisk_bshift;
+  block_t ninodeblocks = (benchdisk_ninodes + ninodesblock - 1) / ninodesblock;
+  block_t nbmapblocks = (benchdisk_nblocks + bsize * 8 - 1) / (bsize * 8);
+  superblock_t *sb = (superblock_t *)(benchdisk_mem + SBSECTOR * BLOCKSIZE);
+  sb->version = SBVERSION;
+  sb->notclean = true;
+  sb->type = 0;
+  sb->bshift = benchdisk_bshift;
+  sb->inodes = SBBLOCK(benchdisk_bshift) + 1;
+  sb->bbitmap = sb->inodes + ninodeblocks;
+  sb->firstblock = sb->bbitmap + nbmapblocks;
+  sb->ninodes = ninodeblocks * ninodesblock;
+  sb->nblocks = benchdisk_nblocks;
+  sb->features = benchdisk_features;
+  ASSERT(sb->firstblock < benchdisk_nblocks);
+
+  dinode_t *root = (dinode_t *)(benchdisk_mem + sb->inodes * bsize);
+  root->ftype = DIRECTORY;
+  root->nlinks = 2;
+  root->fsize = 2 * sizeof(dirent_t);
+  root->blockrefs[0] = sb->firstblock;
+
+  dirent_t *rootdir = (dirent_t *)(benchdisk_mem + sb->firstblock * bsize);
+  rootdir[0].inum = 1;
+  strncpy(rootdir[0].name, ".", DIRNAMEENTRY);
+  rootdir[1].inum = 1;
+  strncpy(rootdir[1].name, "..", DIRNAMEENTRY);
+
+  byte_t *bmap = benchdisk_mem + sb->bbitmap * bsize;
+  for ( block_t b = 0 ; b <= sb->firstblock ; ++b )
+    bmap[b / 8] |= 1 << (b % 8);
+
+  disksim_init(&benchdisk_sim, benchdisk_transfer);
+}
+
+void benchdisk_close(ldevminor_t minor)
+{
+  ASSERT(minor < 1);
+  free(benchdisk_mem);
+  benchdisk_mem = NULL;
+}
+
+void benchdisk_transfer(ldevminor_t minor, bhead_t *bh)
+{
+  ASSERT(minor < 1);
+  ASSERT(bh);
+
+  int wr = bh->valid;
+  byte_t *mem = benchdisk_mem + BSECTOR(bh) * BLOCKSIZE;
+
+  ++benchdisk_nblocksio;
+  if ((BSECTOR(bh) >> benchdisk_bshift) >= benchdisk_nblocks) {
+    bh->valid = false;
+    bh->error = true;
+    buffer_synced(bh, 1);
+    wakeall(wr ? BLOCKWRITE : BLOCKREAD);
+    return;
+  }
+
+  if (wr) {
+    memcpy(mem, bh->buf->mem, BSIZE(bh));
+    bh->written = true;
+  } else {
+    memcpy(bh->buf->mem, mem, BSIZE(bh));
+    bh->valid = true;
+  }
+
+  buffer_synced(bh, 0);
+
+  wakeall(wr ? BLOCKWRITE : BLOCKREAD);
+}
+
+void benchdisk_strategy(ldevminor_t minor, bhead_t *bh)
+{
+  ++benchdisk_ncmds;
+  disksim_strategy(&benchdisk_sim, minor, &bh, 1);
+}
+
+void benchdisk_strategyv(ldevminor_t minor, bhead_t **bhv, word_t n)
+{
+  ASSERT(bhv);
+  ++benchdisk_ncmds;
+  disksim_strategy(&benchdisk_sim, minor, bhv, n);
+}
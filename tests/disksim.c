@@ -0,0 +1,124 @@
+/**
+ * @file disksim.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief latency model and asynchronous completion for the simulated disks
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "disksim.h"
+#include "utils.h"
+
+disksim_t *disksims[DISKSIMMAX];
+int ndisksims = 0;
+
+
+
+void disksim_init(disksim_t *d, void (*transfer)(ldevminor_t minor, bhead_t *bh))
+{
+  ASSERT(d && transfer);
+  mset(d, 0, sizeof(disksim_t));
+  d->transfer = transfer;
+  d->seek = DISKSIMSEEK;
+  d->seektrack = DISKSIMSEEKTRACK;
+  d->rotation = DISKSIMROTATION;
+  d->xfer = DISKSIMXFER;
+  for ( int i = 0 ; i < ndisksims ; ++i )
+    if (disksims[i] == d)
+      return;
+  ASSERT(ndisksims < DISKSIMMAX);
+  disksims[ndisksims++] = d;
+}
+
+
+
+/**
+ * @brief time to transfer n sectors from sector on, moves the head
+ *
+ * @param d
+ * @param sector
+ * @param n
+ * @return dword_t
+ */
+dword_t disksim_cost(disksim_t *d, dword_t sector, dword_t n)
+{
+  dword_t cost = 0;
+  if (sector != d->head) {
+    dword_t dist = (sector > d->head) ? sector - d->head : d->head - sector;
+    cost = d->seek + d->seektrack * (dist / DISKSIMTRACK) + d->rotation / 2;
+  }
+  cost += n * d->xfer;
+  d->head = sector + n;
+  return cost;
+}
+
+
+
+/**
+ * @brief complete the command in flight
+ *
+ * The command is taken off the disk first, completing its last buffer
+ * starts the next request of the queue and that may come back to d.
+ *
+ * @param d
+ */
+void disksim_intr(disksim_t *d)
+{
+  bhead_t *bv[MAXCLUSTER];
+  word_t n = d->n;
+
+  ASSERT(n > 0);
+  mcpy(bv, d->bv, n * sizeof(bhead_t *));
+  d->n = 0;
+  for ( word_t i = 0 ; i < n ; ++i )
+    d->transfer(d->minor, bv[i]);
+}
+
+
+
+void disksim_strategy(disksim_t *d, ldevminor_t minor, bhead_t **bv, word_t n)
+{
+  ASSERT(d && bv);
+  ASSERT((n > 0) && (n <= MAXCLUSTER));
+  ASSERT(d->n == 0);
+  dword_t cost = disksim_cost(d, BSECTOR(bv[0]), (dword_t)n << bv[0]->bshift);
+  ++d->ncmds;
+  d->busy += cost;
+  d->minor = minor;
+  d->n = n;
+  mcpy(d->bv, bv, n * sizeof(bhead_t *));
+  if (d->async) {
+    d->done = simtime + cost;
+  } else {
+    simtime += cost;
+    disksim_intr(d);
+  }
+}
+
+
+
+void disksim_tick(void)
+{
+  for ( int i = 0 ; i < ndisksims ; ++i )
+    while (disksims[i]->n && (disksims[i]->done <= simtime))
+      disksim_intr(disksims[i]);
+}
+
+
+
+int disksim_idle(void)
+{
+  disksim_t *next = NULL;
+  for ( int i = 0 ; i < ndisksims ; ++i )
+    if (disksims[i]->n && (!next || (disksims[i]->done < next->done)))
+      next = disksims[i];
+  if (!next)
+    return false;
+  if (next->done > simtime)
+    simtime = next->done;
+  disksim_intr(next);
+  return true;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file disksim.h
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief latency model and asynchronous completion for the simulated disks
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef _DISKSIM_H
+#define _DISKSIM_H
+
+#include "tdefs.h"
+#include "buf.h"
+
+#ifndef DISKSIMMAX
+#define DISKSIMMAX 4            ///< number of simulated disks
+#endif
+
+#define DISKSIMTRACK 32         ///< sectors per track
+
+#define DISKSIMSEEK 2000        ///< default time to position the head, in simulated microseconds
+#define DISKSIMSEEKTRACK 50     ///< default additional seek time per track of distance
+#define DISKSIMROTATION 8000    ///< default time of one rotation
+#define DISKSIMXFER 100         ///< default transfer time of one sector
+
+/**
+ * @brief a simulated disk, one command is in flight at a time (the request queue of dd.c keeps it so)
+ *
+ * A command not continuing at the sector following the previous one pays
+ * seek + seektrack * tracks + rotation / 2, every sector pays xfer.
+ */
+typedef struct disksim_t {
+  void (*transfer)(ldevminor_t minor, bhead_t *bh);  ///< copies one buffer and completes it with buffer_synced()
+  byte_t async;           ///< complete commands from disksim_tick()/disksim_idle() instead of within the strategy call
+  dword_t seek;
+  dword_t seektrack;
+  dword_t rotation;
+  dword_t xfer;
+  dword_t head;           ///< sector following the last transfer
+  dword_t ncmds;          ///< commands issued
+  dword_t busy;           ///< simulated time spent on commands
+  ldevminor_t minor;      ///< minor of the command in flight
+  word_t n;               ///< buffers of the command in flight, 0 if idle
+  dword_t done;           ///< simulated time the command in flight completes
+  bhead_t *bv[MAXCLUSTER];
+} disksim_t;
+
+extern dword_t simtime;   ///< simulated time in microseconds, advanced by pc.mockup.c
+
+/**
+ * @brief set up disk d with the default model, synchronous, and register it for disksim_tick()
+ *
+ * @param d
+ * @param transfer
+ */
+void disksim_init(disksim_t *d, void (*transfer)(ldevminor_t minor, bhead_t *bh));
+
+/**
+ * @brief issue a command of n buffers of contiguous blocks of the same size
+ *
+ * A synchronous disk advances simtime by the cost and completes the buffers at once.
+ *
+ * @param d
+ * @param minor
+ * @param bv
+ * @param n
+ */
+void disksim_strategy(disksim_t *d, ldevminor_t minor, bhead_t **bv, word_t n);
+
+/**
+ * @brief interrupt: complete the commands of all disks which are done at simtime
+ *
+ */
+void disksim_tick(void);
+
+/**
+ * @brief idle loop: advance simtime to the next completion and run it
+ *
+ * @return int  false if no command is in flight
+ */
+int disksim_idle(void);
+
+#endif
@@ -0,0 +1,376 @@
+/**
+ * @file fsbench.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief file system benchmark on the RAM disk of benchdisk.c
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Runs repeatable workloads and reports for each of them operations per
+ * second, driver calls and blocks transferred per operation and the hit
+ * rate of the buffer cache.
+ *
+ * usage: fsbench [-b nblocks] [-B bshift] [-i ninodes] [-n scale] [-H] [-a] [-S seek] [-R rotation] [-X xfer]
+ *
+ *   -b   size of the disk in blocks
+ *   -B   blocks of the file system are BLOCKSIZE << bshift bytes, operations stay BLOCKSIZE bytes
+ *   -i   number of inodes
+ *   -n   scale of the workloads, e.g. blocks of the sequential file
+ *   -H   new directories use the hashed layout
+ *   -a   the disk completes commands asynchronously, @see disksim.h
+ *   -S, -R, -X   seek, rotation and sector transfer time of the disk model in microseconds
+ */
+
+#include "inode.h"
+#include "blocks.h"
+#include "fs.h"
+#include "utils.h"
+#include "buf.h"
+#include "pc.h"
+#include "dd.h"
+#include "clist.h"
+#include "dnlc.h"
+#include "disksim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCHDEPTH 32     ///< levels of the deep namei walk
+#define BENCHSYNCBLOCKS 16  ///< blocks written between two syncs
+
+extern process_t *active;
+
+extern bdev_t benchdisk;
+extern block_t benchdisk_nblocks;
+extern ninode_t benchdisk_ninodes;
+extern word_t benchdisk_features;
+extern byte_t benchdisk_bshift;
+extern dword_t benchdisk_ncmds;
+extern dword_t benchdisk_nblocksio;
+extern disksim_t benchdisk_sim;
+
+bdev_t *bdevtable[] = {
+  &benchdisk,
+  NULL
+};
+
+cdev_t *cdevtable[] = {
+  NULL
+};
+
+/// @brief a workload, returns the number of operations done after bench_start()
+typedef struct workload_t {
+  const char *name;
+  dword_t (*run)(dword_t n);
+} workload_t;
+
+byte_t benchbuf[BLOCKSIZE];
+dword_t benchseed;
+clock_t benchclock;
+dword_t benchcmds;
+dword_t benchblocks;
+dword_t benchsimtime;
+
+
+
+/**
+ * @brief repeatable pseudo random numbers
+ *
+ * @return dword_t
+ */
+dword_t bench_rand(void)
+{
+  benchseed = benchseed * 1103515245 + 12345;
+  return benchseed >> 8;
+}
+
+
+
+/**
+ * @brief start measuring, everything before is set up of the workload
+ *
+ */
+void bench_start(void)
+{
+  reset_bstat();
+  benchcmds = benchdisk_ncmds;
+  benchblocks = benchdisk_nblocksio;
+  benchsimtime = simtime;
+  benchclock = clock();
+}
+
+
+
+/**
+ * @brief fail the benchmark
+ *
+ * @param what
+ */
+void bench_fail(const char *what)
+{
+  fprintf(stderr, "fsbench: %s failed\n", what);
+  exit(1);
+}
+
+
+
+dword_t bench_seqwrite(dword_t n)
+{
+  int fd = open("/seq", OCREATE | OWRITE | OTRUNC, 0644);
+  if (fd < 0)
+    bench_fail("open /seq");
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i ) {
+    benchbuf[0] = (byte_t)i;
+    if (write(fd, benchbuf, BLOCKSIZE) != BLOCKSIZE)
+      bench_fail("write");
+  }
+  close(fd);
+  return n;
+}
+
+
+
+dword_t bench_seqread(dword_t n)
+{
+  int fd = open("/seq", OREAD, 0);
+  if (fd < 0)
+    bench_fail("open /seq");
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i )
+    if (read(fd, benchbuf, BLOCKSIZE) != BLOCKSIZE)
+      bench_fail("read");
+  close(fd);
+  return n;
+}
+
+
+
+dword_t bench_randread(dword_t n)
+{
+  int fd = open("/seq", OREAD, 0);
+  if (fd < 0)
+    bench_fail("open /seq");
+  benchseed = 1;
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i )
+    if (pread(fd, benchbuf, BLOCKSIZE, (bench_rand() % n) * BLOCKSIZE) != BLOCKSIZE)
+      bench_fail("pread");
+  close(fd);
+  return n;
+}
+
+
+
+dword_t bench_randwrite(dword_t n)
+{
+  int fd = open("/seq", OWRITE, 0);
+  if (fd < 0)
+    bench_fail("open /seq");
+  benchseed = 2;
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i )
+    if (pwrite(fd, benchbuf, BLOCKSIZE, (bench_rand() % n) * BLOCKSIZE) != BLOCKSIZE)
+      bench_fail("pwrite");
+  close(fd);
+  unlink("/seq");
+  return n;
+}
+
+
+
+dword_t bench_churn(dword_t n)
+{
+  char name[16];
+
+  if (mkdir("/churn", 0755) < 0)
+    bench_fail("mkdir /churn");
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i ) {
+    snprintf(name, sizeof(name), "/churn/c%lu", (unsigned long)(i % 8));
+    int fd = open(name, OCREATE | OWRITE, 0644);
+    if ((fd < 0) || (write(fd, benchbuf, BLOCKSIZE) != BLOCKSIZE))
+      bench_fail("create");
+    close(fd);
+    if (unlink(name) < 0)
+      bench_fail("unlink");
+  }
+  return n;
+}
+
+
+
+dword_t bench_namei(dword_t n)
+{
+  char path[MAXPATH];
+  stat_t st;
+
+  path[0] = 0;
+  for ( int d = 0 ; d < BENCHDEPTH ; ++d ) {
+    strcat(path, "/d");
+    if (mkdir(path, 0755) < 0)
+      bench_fail("mkdir");
+  }
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i )
+    if (stat(path, &st) < 0)
+      bench_fail("stat");
+  return n;
+}
+
+
+
+dword_t bench_bigdir(dword_t n)
+{
+  char name[16];
+  stat_t st;
+  dword_t nfiles = MIN(n, (dword_t)benchdisk_ninodes / 2);
+
+  if (mkdir("/big", 0755) < 0)
+    bench_fail("mkdir /big");
+  for ( dword_t i = 0 ; i < nfiles ; ++i ) {
+    snprintf(name, sizeof(name), "/big/f%lu", (unsigned long)i);
+    if (mknode(name, REGULAR, 0644) < 0)
+      bench_fail("mknode");
+  }
+  benchseed = 3;
+  bench_start();
+  for ( dword_t i = 0 ; i < n ; ++i ) {
+    snprintf(name, sizeof(name), "/big/f%lu", (unsigned long)(bench_rand() % nfiles));
+    if (stat(name, &st) < 0)
+      bench_fail("stat");
+  }
+  return n;
+}
+
+
+
+dword_t bench_sync(dword_t n)
+{
+  dword_t rounds = MAX(n / BENCHSYNCBLOCKS, (dword_t)1);
+  int fd = open("/sync", OCREATE | OWRITE, 0644);
+  if (fd < 0)
+    bench_fail("open /sync");
+  bench_start();
+  for ( dword_t r = 0 ; r < rounds ; ++r ) {
+    for ( dword_t i = 0 ; i < BENCHSYNCBLOCKS ; ++i )
+      if (pwrite(fd, benchbuf, BLOCKSIZE, i * BLOCKSIZE) != BLOCKSIZE)
+        bench_fail("pwrite");
+    sync();
+  }
+  close(fd);
+  unlink("/sync");
+  return rounds;
+}
+
+
+
+workload_t workloads[] = {
+  { "seqwrite", bench_seqwrite },
+  { "seqread", bench_seqread },
+  { "randread", bench_randread },
+  { "randwrite", bench_randwrite },
+  { "churn", bench_churn },
+  { "namei", bench_namei },
+  { "bigdir", bench_bigdir },
+  { "sync", bench_sync },
+  { NULL, NULL }
+};
+
+
+
+/**
+ * @brief print the results of a workload
+ *
+ * @param w
+ * @param ops   number of operations
+ */
+void bench_report(const workload_t *w, dword_t ops)
+{
+  double sec = (double)(clock() - benchclock) / CLOCKS_PER_SEC;
+  const bstat_t *bs = getbstat();
+  dword_t lookups = bs->hits + bs->misses;
+
+  if (ops == 0)
+    ops = 1;
+  printf("%-10s %8lu %12.0f %10.2f %10.2f %7.1f %10.1f\n", w->name, (unsigned long)ops,
+    (sec > 0) ? ops / sec : 0.0,
+    (double)(benchdisk_ncmds - benchcmds) / ops,
+    (double)(benchdisk_nblocksio - benchblocks) / ops,
+    lookups ? 100.0 * bs->hits / lookups : 100.0,
+    (double)(simtime - benchsimtime) / ops);
+}
+
+
+
+int main(int argc, char *argv[])
+{
+  dword_t n = 1024;
+  int async = false;
+  long seek = DISKSIMSEEK, rotation = DISKSIMROTATION, xfer = DISKSIMXFER;
+
+  for ( int a = 1 ; a < argc ; ++a ) {
+    if ((strcmp(argv[a], "-b") == 0) && (a + 1 < argc))
+      benchdisk_nblocks = (block_t)atol(argv[++a]);
+    else if ((strcmp(argv[a], "-B") == 0) && (a + 1 < argc))
+      benchdisk_bshift = (byte_t)atoi(argv[++a]);
+    else if ((strcmp(argv[a], "-i") == 0) && (a + 1 < argc))
+      benchdisk_ninodes = (ninode_t)atol(argv[++a]);
+    else if ((strcmp(argv[a], "-n") == 0) && (a + 1 < argc))
+      n = (dword_t)atol(argv[++a]);
+    else if (strcmp(argv[a], "-H") == 0)
+      benchdisk_features |= SBFHASHDIR;
+    else if (strcmp(argv[a], "-a") == 0)
+      async = true;
+    else if ((strcmp(argv[a], "-S") == 0) && (a + 1 < argc))
+      seek = atol(argv[++a]);
+    else if ((strcmp(argv[a], "-R") == 0) && (a + 1 < argc))
+      rotation = atol(argv[++a]);
+    else if ((strcmp(argv[a], "-X") == 0) && (a + 1 < argc))
+      xfer = atol(argv[++a]);
+    else {
+      fprintf(stderr, "usage: fsbench [-b nblocks] [-B bshift] [-i ninodes] [-n scale] [-H] [-a] [-S seek] [-R rotation] [-X xfer]\n");
+      return 2;
+    }
+  }
+  if (benchdisk_bshift > MAXBSHIFT) {
+    fprintf(stderr, "fsbench: bshift is at most %d\n", MAXBSHIFT);
+    return 2;
+  }
+  if (n == 0)
+    n = 1;
+
+  init_dd();
+  init_buffers();
+  init_inodes();
+  init_dnlc();
+  init_fs();
+  init_clist();
+  bdevopen((ldev_t){{0, 0}});
+  benchdisk_sim.async = async;
+  benchdisk_sim.seek = seek;
+  benchdisk_sim.rotation = rotation;
+  benchdisk_sim.xfer = xfer;
+  fsnum_t fs = init_isblock((ldev_t){{0, 0}});
+  if (fs == 0)
+    bench_fail("mount");
+  active->u->fsroot = iget(fs, 1);
+  active->u->workdir = iget(fs, 1);
+
+  printf("fsbench: %u blocks of %u bytes, %u inodes, %u buffers, scale %lu%s\n", benchdisk_nblocks,
+    BLOCKSIZE << benchdisk_bshift, benchdisk_ninodes, NBUFFER, (unsigned long)n,
+    (benchdisk_features & SBFHASHDIR) ? ", hashed dirs" : "");
+  printf("disk: %s, seek %ld rotation %ld transfer %ld us\n", async ? "async" : "sync", seek, rotation, xfer);
+  printf("%-10s %8s %12s %10s %10s %7s %10s\n", "workload", "ops", "ops/sec", "drv/op", "blk/op", "hit%", "sim us/op");
+  for ( const workload_t *w = workloads ; w->name ; ++w ) {
+    dword_t ops = w->run(n);
+    bench_report(w, ops);
+  }
+  syncall_buffers(false);
+  while (disksim_idle())
+    ;
+  bdevclose((ldev_t){{0, 0}});
+  return 0;
+}
@@ -10,7 +10,10 @@
  */
 
 #include "pc.h"
+#include "buf.h"
 #include "utils.h"
+#include "trace.h"
+#include "disksim.h"
 
 u_t u1 = {
   .fsroot = NULL,
@@ -27,12 +30,19 @@ process_t p1 = {
 
 process_t *active = &p1;
 
+word_t ticks = 0;
+
+#define MOCKUPTICK 10000     ///< simulated microseconds per clock tick
+
+dword_t simtime = 0;      ///< simulated time in microseconds
+
 waitfor_t wokenup = 0;
 
 void waitfor(waitfor_t w)
 {
   ASSERT(w < NQUEUES);
   ASSERT(w != wokenup);
+  disksim_idle();
 }
 
 
@@ -41,3 +51,35 @@ void wakeall(waitfor_t w)
   ASSERT(w < NQUEUES);
   wokenup = w;
 }
+
+
+
+dword_t nwakeupon = 0;      ///< calls of wakeupon(), seen by tests
+
+void sleepon(const void *chan, waitfor_t w)
+{
+  ASSERT(chan);
+  ASSERT(w < NQUEUES);
+  TRACE(TRSLEEP, w, active->pid, TRACECHAN(chan));
+  disksim_idle();     // nothing else to run, time passes till the next interrupt
+  TRACE(TRRUN, w, active->pid, TRACECHAN(chan));
+}
+
+
+
+void wakeupon(const void *chan)
+{
+  ASSERT(chan);
+  ++nwakeupon;
+  TRACE(TRWAKEUP, 0, 0, TRACECHAN(chan));
+}
+
+
+
+void clocktick(void)
+{
+  ++ticks;
+  simtime += MOCKUPTICK;
+  disksim_tick();
+  bflush();
+}
@@ -21,6 +21,10 @@
 #include "pc.h"
 #include "dd.h"
 #include "clist.h"
+#include "dnlc.h"
+#include "disksim.h"
+#include "trace.h"
+#include <stdio.h>
 
 
 extern process_t *active;
@@ -28,6 +32,10 @@ extern process_t *active;
 char *tstdisk_getblock(ldevminor_t minor, block_t bidx);
 
 extern bdev_t tstdisk;
+extern int tstdisk_ncmds;
+extern block_t tstdisk_trace[];
+extern int tstdisk_ntrace;
+extern disksim_t tstdisk_sim;
 
 bdev_t *bdevtable[] = {
   &tstdisk,
@@ -49,6 +57,7 @@ CU_SUITE_SETUP() {
   init_dd();
   init_buffers();
   init_inodes();
+  init_dnlc();
   init_fs(); 
   init_clist();
   bdevopen((ldev_t){{0, 0}});
@@ -121,6 +130,248 @@ static void test_buffer_pass(void) {
  
 
 
+static void test_bhash_pass(void) {
+  ldev_t dev = {{0, 0}};
+  word_t n = bhashsize();
+  dword_t lookups = 0, len = 0;
+
+  CU_ASSERT_EQUAL_FATAL(n & (n - 1), 0);    // power of 2
+  reset_bhashstat();
+  brelse(bread(dev, 1));
+  for (word_t i = 0; i < n; i++) {
+    lookups += getbhashstat(i)->lookups;
+    len += getbhashstat(i)->len;
+  }
+  CU_ASSERT_EQUAL(lookups, 1);
+  CU_ASSERT_TRUE(len > 0 && len <= NBUFFER);
+  CU_ASSERT_PTR_NOT_NULL(findblk(dev, 1));
+  CU_ASSERT_PTR_NULL(findblk((ldev_t){{0, 1}}, 1));
+}
+ 
+
+
+static void test_cluster_pass(void) {
+  ldev_t dev = {{0, 0}};
+
+  int ncmds = tstdisk_ncmds;
+  bhead_t *b = breadn(dev, 100, 4);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+  CU_ASSERT_TRUE(b->valid);
+  CU_ASSERT_EQUAL(tstdisk_ncmds, ncmds + 1);
+  for (block_t bl = 101; bl < 104; bl++) {
+    bhead_t *ba = findblk(dev, bl);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ba);
+    CU_ASSERT_TRUE(ba->valid);
+    CU_ASSERT_FALSE(ba->busy);
+  }
+  brelse(b);
+
+  for (block_t bl = 100; bl < 104; bl++) {
+    b = bread(dev, bl);
+    b->buf->mem[0] = (byte_t)bl;
+    b->dwrite = true;
+    bwrite(b);
+    brelse(b);
+  }
+  ncmds = tstdisk_ncmds;
+  syncall_buffers(false);
+  CU_ASSERT_EQUAL(tstdisk_ncmds, ncmds + 1);
+  CU_ASSERT_EQUAL(tstdisk_getblock(0, 102)[0], 102);
+}
+ 
+
+
+static void test_readahead_pass(void) {
+  ldev_t dev = {{0, 0}};
+
+  int ncmds = tstdisk_ncmds;
+  breadahead(dev, 110, 3);
+  CU_ASSERT_EQUAL(tstdisk_ncmds, ncmds + 1);
+  for (block_t bl = 110; bl < 113; bl++) {
+    bhead_t *b = findblk(dev, bl);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+    CU_ASSERT_TRUE(b->valid);
+    CU_ASSERT_FALSE(b->busy);
+  }
+  ncmds = tstdisk_ncmds;
+  breadahead(dev, 110, 3);      // all in core, nothing to do
+  CU_ASSERT_EQUAL(tstdisk_ncmds, ncmds);
+}
+ 
+
+
+static void test_bqueue_pass(void) {
+  ldev_t dev = {{0, 0}};
+  block_t order[] = { 120, 116, 124, 114, 121, 118 };
+
+  for (int j = 0; j < 6; j++) {
+    bhead_t *b = bread(dev, order[j]);
+    b->dwrite = true;
+    bwrite(b);
+    brelse(b);
+  }
+  tstdisk_ntrace = 0;
+  syncall_buffers(false);
+  CU_ASSERT_EQUAL_FATAL(tstdisk_ntrace, 5);       // 120 and 121 merged
+  int sweeps = 0;                                 // C-LOOK, one ascending sweep plus at most one wrap around
+  for (int j = 1; j < tstdisk_ntrace; j++)
+    if (tstdisk_trace[j - 1] > tstdisk_trace[j])
+      sweeps++;
+  CU_ASSERT_TRUE(sweeps <= 1);
+}
+ 
+
+
+static void test_writeback_pass(void) {
+  ldev_t dev = {{0, 0}};
+  bhead_t *b;
+
+  b = bread(dev, 126);
+  strcpy((char *)b->buf->mem, "aged");
+  b->dwrite = true;
+  bwrite(b);
+  brelse(b);
+  tstdisk_ntrace = 0;
+  for (int j = 1; j < BFLUSHAGE; j++)
+    clocktick();
+  CU_ASSERT_EQUAL(tstdisk_ntrace, 0);             // still too young
+  clocktick();
+  CU_ASSERT_EQUAL_FATAL(tstdisk_ntrace, 1);
+  CU_ASSERT_EQUAL(tstdisk_trace[0], 126);
+  CU_ASSERT_EQUAL(strcmp(tstdisk_getblock(0, 126), "aged"), 0);
+
+  for (int j = 0; j < NBUFFER; j++) {             // every buffer dirty, no clean one left
+    b = bread(dev, 64 + j);
+    b->dwrite = true;
+    bwrite(b);
+    brelse(b);
+  }
+  tstdisk_ntrace = 0;
+  b = bread(dev, 127);                            // forces write-back of the oldest cluster
+  CU_ASSERT_TRUE(tstdisk_ntrace >= 2);
+  CU_ASSERT_EQUAL(tstdisk_trace[0], 64);
+  brelse(b);
+  syncall_buffers(false);
+  for (int j = 0; j < NBUFFER; j++)
+    CU_ASSERT_FALSE(findblk(dev, 64 + j) && findblk(dev, 64 + j)->dwrite);
+}
+ 
+
+
+static void test_asyncdisk_pass(void) {
+  ldev_t dev = {{0, 0}};
+  bhead_t *b;
+  dword_t t0, seek = DISKSIMSEEK + DISKSIMSEEKTRACK * (100 / DISKSIMTRACK) + DISKSIMROTATION / 2;
+
+  syncall_buffers(false);
+  tstdisk_sim.async = true;
+  tstdisk_sim.head = 0;
+  t0 = simtime;
+  b = bread(dev, 100);                            // sleeps till the disk interrupts
+  CU_ASSERT_TRUE(b->valid);
+  CU_ASSERT_EQUAL(simtime - t0, seek + DISKSIMXFER);
+  brelse(b);
+
+  t0 = simtime;
+  breadahead(dev, 101, 4);                        // queued, nobody waits
+  CU_ASSERT_EQUAL(simtime, t0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(findblk(dev, 101));
+  CU_ASSERT_TRUE(findblk(dev, 101)->busy);
+  clocktick();                                    // the transfer overlaps with computing
+  CU_ASSERT_FALSE(findblk(dev, 101)->busy);
+  CU_ASSERT_TRUE(findblk(dev, 104)->valid);
+  t0 = simtime;
+  for (int j = 101; j < 104; j++)
+    brelse(bread(dev, j));
+  b = bread(dev, 104);                            // read ahead, no waiting
+  CU_ASSERT_EQUAL(simtime, t0);
+
+  bwrite(b);                                      // synchronous write, waits for the interrupt
+  CU_ASSERT_TRUE(b->written);
+  CU_ASSERT_TRUE(simtime > t0);
+  brelse(b);
+  for (int j = 105; j < 108; j++) {
+    b = bread(dev, j);
+    b->dwrite = true;
+    bwrite(b);
+    brelse(b);
+  }
+  t0 = simtime;
+  dword_t busy = tstdisk_sim.busy;
+  syncall_buffers(false);                         // one clustered command, waited for
+  for (int j = 105; j < 108; j++)
+    CU_ASSERT_FALSE(findblk(dev, j)->dwrite || findblk(dev, j)->busy);
+  CU_ASSERT_EQUAL(simtime - t0, tstdisk_sim.busy - busy);
+  CU_ASSERT_EQUAL(tstdisk_sim.n, 0);
+  tstdisk_sim.async = false;
+}
+ 
+
+
+static void test_bstat_pass(void) {
+  ldev_t dev = {{0, 0}};
+
+  reset_bstat();
+  brelse(bread(dev, 96));
+  brelse(bread(dev, 96));
+  CU_ASSERT_EQUAL(getbstat()->misses, 1);
+  CU_ASSERT_EQUAL(getbstat()->hits, 1);
+  breadahead(dev, 97, 2);
+  brelse(bread(dev, 97));
+  CU_ASSERT_EQUAL(getbstat()->rahits, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(getbdevstat(dev));
+  CU_ASSERT_EQUAL(getbdevstat(dev)->reads, 3);
+  CU_ASSERT_EQUAL(getbdevstat(dev)->writes, 0);
+  for (int j = 0; j < NBUFFER; j++)               // evicts read ahead block 98
+    brelse(bread(dev, 30 + j));
+  CU_ASSERT_EQUAL(getbstat()->rawasted, 1);
+  CU_ASSERT_EQUAL(getbstat()->nofreestalls, 0);
+  dump_bstat();
+  reset_bstat();
+  CU_ASSERT_EQUAL(getbstat()->hits, 0);
+  CU_ASSERT_PTR_NULL(getbdevstat(dev));
+}
+ 
+
+
+static void test_slru_pass(void) {
+#if BUFSLRU
+  ldev_t dev = {{0, 0}};
+  bhead_t *b;
+
+  syncall_buffers(false);
+  reset_bstat();
+  brelse(bread(dev, 90));
+  brelse(bread(dev, 90));                         // second use, promoted
+  b = bread(dev, 91);
+  bhint(b, BHMETA);                               // metadata, protected at once
+  brelse(b);
+  CU_ASSERT_EQUAL(getbstat()->promotions, 2);
+  for (int j = 0; j < 2 * NBUFFER; j++)           // scan does not push them out
+    brelse(bread(dev, 20 + j));
+  CU_ASSERT_PTR_NOT_NULL(findblk(dev, 90));
+  CU_ASSERT_PTR_NOT_NULL(findblk(dev, 91));
+  CU_ASSERT_PTR_NULL(findblk(dev, 20));
+
+  b = bread(dev, 92);
+  bhint(b, BHSTREAM);
+  brelse(b);
+  brelse(bread(dev, 93));                         // takes the buffer of the streamed block
+  CU_ASSERT_PTR_NULL(findblk(dev, 92));
+  CU_ASSERT_PTR_NOT_NULL(findblk(dev, 20 + 2 * NBUFFER - 1));
+
+  for (int j = 0; j < NBUFPROT + 1; j++) {        // overflowing protected list demotes the oldest
+    brelse(bread(dev, 100 + j));
+    brelse(bread(dev, 100 + j));
+  }
+  CU_ASSERT_TRUE(getbstat()->demotions >= 2);
+  CU_ASSERT_FALSE(findblk(dev, 90) && findblk(dev, 90)->prot);
+  check_bfreelist();
+#endif
+}
+ 
+
+
 static void test_block_pass(void) {
   fs1 = init_isblock((ldev_t){{0, 0}});  // init superblock device = 0, should return fs1 = 1
   CU_ASSERT_EQUAL(fs1, 1);
@@ -133,6 +384,30 @@ static void test_block_pass(void) {
   CU_ASSERT_EQUAL(b->block, 6);
   bfree(fs1, b->block);
   brelse(b);
+
+  isuperblock_t *isbk = getisblock(fs1);
+  CU_ASSERT_EQUAL(isbk->dsblock.version, SBVERSION);
+  block_t nfree = isbk->dsblock.nfreeblocks;
+  CU_ASSERT_EQUAL(nfree, isbk->dsblock.nblocks - 6);
+  static block_t used[128];
+  block_t n = 0;
+  while ((b = balloc(fs1)) != NULL) {             // fill up the file system
+    CU_ASSERT_TRUE_FATAL(n < 128);
+    used[n++] = b->block;
+    brelse(b);
+  }
+  CU_ASSERT_EQUAL(n, nfree);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.bmapfree, 0);
+  bfree(fs1, used[n / 2]);
+  b = balloc(fs1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+  CU_ASSERT_EQUAL(b->block, used[n / 2]);
+  brelse(b);
+  while (n > 0)
+    bfree(fs1, used[--n]);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree);
+  syncall_buffers(false);
 }
  
 
@@ -166,6 +441,55 @@ static void test_inode_pass(void) {
   iput(i.i);
   CU_ASSERT_EQUAL(i.i, active->u->fsroot);
   CU_ASSERT_EQUAL(active->u->fsroot->nref, 2);
+
+  iinode_t *ii = ialloc(fs1, REGULAR, 0644);      // bmap cache of indirect blocks
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ii);
+  bmap_t bm1 = bmap(ii, STARTREFSLEVEL * BLOCKSIZE);
+  CU_ASSERT_NOT_EQUAL_FATAL(bm1.fsblock, 0);
+  CU_ASSERT_NOT_EQUAL(ii->bmleaf, 0);
+  block_t leaf = ii->bmleaf;
+  bmap_t bm2 = bmap(ii, (STARTREFSLEVEL + 1) * BLOCKSIZE + 10);
+  CU_ASSERT_NOT_EQUAL_FATAL(bm2.fsblock, 0);
+  CU_ASSERT_NOT_EQUAL(bm2.fsblock, bm1.fsblock);
+  CU_ASSERT_EQUAL(bm2.offblock, 10);
+  CU_ASSERT_EQUAL(ii->bmleaf, leaf);
+  CU_ASSERT_EQUAL(bmaplookup(ii, STARTREFSLEVEL * BLOCKSIZE).rdablock, bm2.fsblock);
+  bmapinvalidate(ii);
+  CU_ASSERT_EQUAL(bmaplookup(ii, (STARTREFSLEVEL + 1) * BLOCKSIZE).fsblock, bm2.fsblock);
+  CU_ASSERT_EQUAL(bmaplookup(ii, (STARTREFSLEVEL + 2) * BLOCKSIZE).fsblock, 0);
+  iput(ii);                                       // no links, frees blocks and inode
+  CU_ASSERT_EQUAL(ii->bmleaf, 0);
+
+  isuperblock_t *isbk = getisblock(fs1);          // free inode summary
+  ninode_t nfree = isbk->dsblock.nfreeinodes;
+  CU_ASSERT_EQUAL(nfree, isbk->dsblock.ninodes - 2);   // inode 1 is root directory
+  static iinode_t *iv[NINODES];
+  int n = 0;
+  while ((ii = ialloc(fs1, REGULAR, 0644)) != NULL) {
+    CU_ASSERT_TRUE_FATAL(n < NINODES);
+    iv[n++] = ii;
+  }
+  CU_ASSERT_EQUAL(n, nfree);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeinodes, 0);
+  while (n > 0)
+    iput(iv[--n]);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeinodes, nfree);
+  ii = ialloc(fs1, REGULAR, 0644);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ii);
+  iput(ii);
+
+  const istat_t *is = getistat();                 // every cached inode is found again
+  for ( ninode_t inum = 1 ; inum < isbk->dsblock.ninodes ; ++inum )
+    iput(iget(fs1, inum));
+  dword_t misses = is->misses;
+  dword_t hits = is->hits;
+  for ( ninode_t inum = 1 ; inum < isbk->dsblock.ninodes ; ++inum ) {
+    ii = iget(fs1, inum);
+    CU_ASSERT_EQUAL(ii->inum, inum);
+    iput(ii);
+  }
+  CU_ASSERT_EQUAL(is->misses, misses);
+  CU_ASSERT_EQUAL(is->hits, hits + isbk->dsblock.ninodes - 1);
 }
 
 
@@ -191,6 +515,63 @@ static void test_file_pass(void) {
 
   CU_ASSERT_EQUAL(open("/test", ORDWR, 0777), -1);
 
+  byte_t blk[BLOCKSIZE];
+  memset(blk, 'x', sizeof(blk));
+  fd = open("/test/seq.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_EQUAL(fd, 0);
+  for (int j = 0; j < 8; j++)
+    CU_ASSERT_EQUAL(write(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  syncall_buffers(false);
+  for (int j = 0; j < NBUFFER; j++)               // nothing of seq.txt left in cache
+    brelse(bread((ldev_t){{0, 0}}, 30 + j));
+  fd = open("/test/seq.txt", OWRITE, 0777);
+  CU_ASSERT_EQUAL(fd, 0);
+  reset_bstat();
+  for (int j = 0; j < 2; j++)                     // full block overwrite, no read
+    CU_ASSERT_EQUAL(write(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_PTR_NULL(getbdevstat((ldev_t){{0, 0}}));
+  CU_ASSERT_EQUAL(close(fd), 0);
+  fd = open("/test/seq.txt", OREAD, 0777);
+  CU_ASSERT_EQUAL(fd, 0);
+  filetab_t *ft = active->u->fdesc[fd].ftabent;
+  CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(ft->rawin, 1);
+  CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(ft->rawin, 2);
+  CU_ASSERT_EQUAL(ft->ralblock, 4);
+  CU_ASSERT_EQUAL(pread(fd, blk, BLOCKSIZE, 5 * BLOCKSIZE), BLOCKSIZE);   // leaves the window alone
+  CU_ASSERT_EQUAL(ft->rawin, 2);
+  CU_ASSERT_EQUAL(ft->ralblock, 4);
+  CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(ft->rawin, 4);
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEKSET), 0);
+  CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(ft->rawin, 0);
+  CU_ASSERT_EQUAL(blk[BLOCKSIZE - 1], 'x');
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(unlink("/test/seq.txt"), 0);
+
+  fd = open("/test/seq.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_EQUAL(fd, 0);
+  for (int j = 0; j < 40; j++)
+    CU_ASSERT_EQUAL(write(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  syncall_buffers(false);
+  int fw = open("/test/dirty.txt", OCREATE | OWRITE, 0777);
+  CU_ASSERT_EQUAL(fw, 1);
+  for (int j = 0; j < NBUFFER - 12; j++)         // delayed writes hold most buffers
+    CU_ASSERT_EQUAL(write(fw, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEKSET), 0);
+  reset_bstat();
+  for (int j = 0; j < 40; j++)
+    CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_NOT_EQUAL(getbstat()->rahits, 0);
+  CU_ASSERT_EQUAL(getbstat()->rawasted, 0);
+  CU_ASSERT_EQUAL(close(fw), 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(unlink("/test/dirty.txt"), 0);
+  CU_ASSERT_EQUAL(unlink("/test/seq.txt"), 0);
+
   CU_ASSERT_EQUAL(unlink("/test/test.txt"), 0);
   CU_ASSERT_EQUAL(rmdir("/test"), 0);
 
@@ -209,6 +590,635 @@ static void test_file_pass(void) {
  
 
 
+static void test_trunc_pass(void) {
+  byte_t blk[BLOCKSIZE];
+  stat_t st;
+  isuperblock_t *isbk = getisblock(fs1);
+  block_t nfree = isbk->dsblock.nfreeblocks;
+
+  mset(blk, 'x', sizeof(blk));
+  int fd = open("/trunc.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  iinode_t *ii = active->u->fdesc[fd].ftabent->inode;
+  for ( int i = 0 ; i < STARTREFSLEVEL + 4 ; ++i )     // uses the single indirect block
+    CU_ASSERT_EQUAL(write(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - (STARTREFSLEVEL + 5));   // reserved blocks are not counted
+  CU_ASSERT_EQUAL(isbk->nreserved, ii->nprealloc);
+  CU_ASSERT_EQUAL(ftruncate(fd, BLOCKSIZE + 10), 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2);
+  CU_ASSERT_EQUAL(fstat(fd, &st), 0);
+  CU_ASSERT_EQUAL(st.fsize, BLOCKSIZE + 10);
+
+  CU_ASSERT_EQUAL(truncate("/trunc.txt", 4 * BLOCKSIZE), 0);     // extend leaves a hole
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2);
+  CU_ASSERT_EQUAL(lseek(fd, BLOCKSIZE, SEEKSET), BLOCKSIZE);
+  CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(blk[9], 'x');
+  CU_ASSERT_EQUAL(blk[10], 0);                    // cleared when truncated
+  CU_ASSERT_EQUAL(read(fd, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(blk[0], 0);
+  CU_ASSERT_EQUAL(blk[BLOCKSIZE - 1], 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2);   // reading a hole allocates nothing
+  CU_ASSERT_EQUAL(close(fd), 0);
+
+  fd = open("/trunc.txt", OTRUNC | ORDWR, 0777);
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree);
+  CU_ASSERT_EQUAL(fstat(fd, &st), 0);
+  CU_ASSERT_EQUAL(st.fsize, 0);
+  CU_ASSERT_EQUAL(write(fd, blk, 10), 10);        // no stale block references left
+  ii = active->u->fdesc[fd].ftabent->inode;
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 1);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(unlink("/trunc.txt"), 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree);
+}
+ 
+
+
+void count_free_blocks(isuperblock_t *isbk);
+
+static void test_prealloc_pass(void) {
+  byte_t blk[BLOCKSIZE];
+  isuperblock_t *isbk = getisblock(fs1);
+  block_t nfree = isbk->dsblock.nfreeblocks;
+
+  mset(blk, 'p', sizeof(blk));
+  int fa = open("/pa.txt", OCREATE | ORDWR, 0777);
+  int fb = open("/pb.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_TRUE_FATAL((fa >= 0) && (fb >= 0));
+  iinode_t *ia = active->u->fdesc[fa].ftabent->inode;
+  iinode_t *ib = active->u->fdesc[fb].ftabent->inode;
+  for ( int i = 0 ; i < NPREALLOC ; ++i ) {          // written at the same time
+    CU_ASSERT_EQUAL(write(fa, blk, BLOCKSIZE), BLOCKSIZE);
+    CU_ASSERT_EQUAL(write(fb, blk, BLOCKSIZE), BLOCKSIZE);
+  }
+  for ( int i = 1 ; i < NPREALLOC ; ++i ) {          // but each laid out contiguously
+    CU_ASSERT_EQUAL(ia->dinode.blockrefs[i], ia->dinode.blockrefs[0] + i);
+    CU_ASSERT_EQUAL(ib->dinode.blockrefs[i], ib->dinode.blockrefs[0] + i);
+  }
+  CU_ASSERT_EQUAL(write(fa, blk, BLOCKSIZE), BLOCKSIZE);   // next run continues behind the first if free
+  CU_ASSERT_TRUE(ia->nprealloc > 0);
+  CU_ASSERT_EQUAL(isbk->nreserved, ia->nprealloc);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2 * NPREALLOC - 1);   // reserved blocks stay free in the bitmap
+  count_free_blocks(isbk);                        // so a recount after a crash loses none
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2 * NPREALLOC - 1);
+  CU_ASSERT_EQUAL(pwrite(fb, blk, BLOCKSIZE, 12 * BLOCKSIZE), BLOCKSIZE);   // a hole starts a new run
+  CU_ASSERT_EQUAL(ib->nprealloc, NPREALLOC - 1);
+  block_t run = ib->prealloc;
+  CU_ASSERT_EQUAL(iunreserved(fs1, run, 1), 0);
+  CU_ASSERT_EQUAL(iunreserved(fs1, run - 1, NPREALLOC), 1);   // the block taken before the run is not reserved
+  CU_ASSERT_EQUAL(pwrite(fb, blk, BLOCKSIZE, NPREALLOC * BLOCKSIZE), BLOCKSIZE);   // not sequential, run is dropped
+  CU_ASSERT_NOT_EQUAL(ib->dinode.blockrefs[NPREALLOC], run);
+  CU_ASSERT_TRUE(iunreserved(fs1, run, 1) || (ib->prealloc == run));
+  CU_ASSERT_EQUAL(isbk->nreserved, ia->nprealloc + ib->nprealloc);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2 * NPREALLOC - 3);
+  CU_ASSERT_EQUAL(close(fa), 0);                  // unused blocks are given back
+  CU_ASSERT_EQUAL(close(fb), 0);
+  CU_ASSERT_EQUAL(isbk->nreserved, 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree - 2 * NPREALLOC - 3);
+  CU_ASSERT_EQUAL(unlink("/pa.txt"), 0);
+  CU_ASSERT_EQUAL(unlink("/pb.txt"), 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree);
+
+  fa = open("/pa.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_TRUE_FATAL(fa >= 0);
+  ia = active->u->fdesc[fa].ftabent->inode;
+  CU_ASSERT_EQUAL(write(fa, blk, BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(ia->nprealloc, NPREALLOC - 1);
+  fb = open("/pb.txt", OCREATE | ORDWR, 0777);
+  while (write(fb, blk, BLOCKSIZE) == BLOCKSIZE)  // takes the blocks reserved for pa.txt too
+    ;
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, 0);
+  CU_ASSERT_EQUAL(ia->nprealloc, 0);
+  CU_ASSERT_EQUAL(isbk->nreserved, 0);
+  CU_ASSERT_EQUAL(close(fa), 0);
+  CU_ASSERT_EQUAL(close(fb), 0);
+  CU_ASSERT_EQUAL(unlink("/pa.txt"), 0);
+  CU_ASSERT_EQUAL(unlink("/pb.txt"), 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree);
+}
+ 
+
+
+static void test_rwv_pass(void) {
+  char a[4] = "abc", b[8] = "defghij", c[2] = "k";
+  char x[4], y[8];
+  iovec_t out[3] = {{(byte_t *)a, 3}, {(byte_t *)b, 7}, {(byte_t *)c, 1}};
+  iovec_t in[2] = {{(byte_t *)x, 4}, {(byte_t *)y, 8}};
+
+  int fd = open("/rwv.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  CU_ASSERT_EQUAL(writev(fd, out, 3), 11);
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEKCUR), 11);
+  CU_ASSERT_EQUAL(pwrite(fd, (byte_t *)"D", 1, 3), 1);
+  CU_ASSERT_EQUAL(pread(fd, (byte_t *)x, 2, 2), 2);
+  CU_ASSERT_EQUAL(sncmp(x, "cD", 2), 0);
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEKCUR), 11);        // file pointer did not move
+  CU_ASSERT_EQUAL(pread(fd, (byte_t *)x, 2, 20), 0);   // past end of file
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEKSET), 0);
+  CU_ASSERT_EQUAL(readv(fd, in, 2), 11);             // short second segment at end of file
+  CU_ASSERT_EQUAL(sncmp(x, "abcD", 4), 0);
+  CU_ASSERT_EQUAL(sncmp(y, "efghijk", 7), 0);
+  CU_ASSERT_EQUAL(readv(fd, in, MAXIOV + 1), -1);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(unlink("/rwv.txt"), 0);
+}
+ 
+
+
+static void test_physio_pass(void) {
+  ldev_t dev = {{0, 0}};
+  static byte_t raw[10 * BLOCKSIZE];
+  bhead_t *b;
+
+  CU_ASSERT_EQUAL(mknodedev("/hd0", BLOCK, 0600, dev), 0);
+  int fd = open("/hd0", ORDWR, 0);
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+
+  brelse(bread(dev, 112));                        // stale copy in cache
+  b = bread(dev, 120);                            // delayed write is synced before a raw read
+  strcpy((char *)b->buf->mem, "cached");
+  b->dwrite = true;
+  bwrite(b);
+  brelse(b);
+  CU_ASSERT_EQUAL(pread(fd, raw, 2 * BLOCKSIZE, 120 * BLOCKSIZE), 2 * BLOCKSIZE);
+  CU_ASSERT_EQUAL(strcmp((char *)raw, "cached"), 0);
+  CU_ASSERT_FALSE(findblk(dev, 120)->dwrite);
+
+  for (int j = 0; j < 10; j++)
+    raw[j * BLOCKSIZE] = 'a' + j;
+  reset_bstat();
+  tstdisk_ntrace = 0;
+  CU_ASSERT_EQUAL(pwrite(fd, raw, 10 * BLOCKSIZE, 110 * BLOCKSIZE), 10 * BLOCKSIZE);
+  CU_ASSERT_EQUAL(tstdisk_ntrace, 2);             // MAXCLUSTER blocks per transaction
+  CU_ASSERT_EQUAL(tstdisk_trace[0], 110);
+  CU_ASSERT_EQUAL(tstdisk_trace[1], 110 + MAXCLUSTER);
+  CU_ASSERT_EQUAL(getbstat()->misses + getbstat()->hits, 0);   // no buffer was used
+  CU_ASSERT_PTR_NULL(findblk(dev, 111));
+  CU_ASSERT_EQUAL(tstdisk_getblock(0, 119)[0], 'j');
+  b = bread(dev, 112);
+  CU_ASSERT_EQUAL(b->buf->mem[0], 'c');
+  brelse(b);
+
+  CU_ASSERT_EQUAL(lseek(fd, 115 * BLOCKSIZE + 10, SEEKSET), 115 * BLOCKSIZE + 10);
+  CU_ASSERT_EQUAL(write(fd, (byte_t *)"xyz", 3), 3);   // partial block through the cache
+  CU_ASSERT_EQUAL(lseek(fd, 0, SEEKCUR), 115 * BLOCKSIZE + 13);
+  CU_ASSERT_EQUAL(pread(fd, raw, BLOCKSIZE, 115 * BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(raw[0], 'f');
+  CU_ASSERT_EQUAL(sncmp((char *)raw + 10, "xyz", 3), 0);
+  CU_ASSERT_EQUAL(pread(fd, raw, 3, 115 * BLOCKSIZE + 9), 3);
+  CU_ASSERT_EQUAL(raw[1], 'x');
+  CU_ASSERT_EQUAL(pread(fd, raw, BLOCKSIZE, 200 * BLOCKSIZE), -1);  // past end of device
+  mcpy(raw, tstdisk_getblock(0, SBSECTOR), BLOCKSIZE);
+  CU_ASSERT_EQUAL(pwrite(fd, raw + BLOCKSIZE, BLOCKSIZE, (65536ul + SBSECTOR) * BLOCKSIZE), -1);   // past the last block number
+  CU_ASSERT_EQUAL(memcmp(raw, tstdisk_getblock(0, SBSECTOR), BLOCKSIZE), 0);    // did not wrap to the superblock
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(unlink("/hd0"), 0);
+
+  CU_ASSERT_EQUAL(mknodedev("/hd9", BLOCK, 0600, (ldev_t){{9, 0}}), -1);   // no such driver
+  CU_ASSERT_NOT_EQUAL(stat("/hd9", &(stat_t){0}), 0);
+  CU_ASSERT_EQUAL(mknodedev("/hd1", BLOCK, 0600, (ldev_t){{0, 1}}), 0);    // not mounted, opened by open()
+  fd = open("/hd1", OREAD, 0);
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  CU_ASSERT_EQUAL(pread(fd, raw, BLOCKSIZE, SBSECTOR * BLOCKSIZE), BLOCKSIZE);
+  CU_ASSERT_EQUAL(((superblock_t *)raw)->bshift, 1);
+  CU_ASSERT_EQUAL(close(fd), 0);                  // last close closes the driver
+  CU_ASSERT_EQUAL(unlink("/hd1"), 0);
+}
+ 
+
+
+static void test_bigblock_pass(void) {
+  ldev_t dev = {{0, 1}};
+  static byte_t data[(STARTREFSLEVEL + 2) * 1024];
+  byte_t back[3000];
+  stat_t st;
+
+  bdevopen(dev);
+  fsnum_t fs2 = init_isblock(dev);
+  CU_ASSERT_TRUE_FATAL(fs2 != 0);
+  isuperblock_t *isbk = getisblock(fs2);
+  CU_ASSERT_EQUAL(FSBSIZE(fs2), 1024);
+  CU_ASSERT_EQUAL(bgetshift(dev), 1);
+  CU_ASSERT_EQUAL(bgetshift((ldev_t){{0, 0}}), 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, 64 - 4);
+  block_t nfree = isbk->dsblock.nfreeblocks;
+
+  iinode_t *root = active->u->fsroot;             // run the calls on the fs of minor 1
+  active->u->fsroot = iget(fs2, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(active->u->fsroot);
+  for ( int j = 0 ; j < (int)sizeof(data) ; ++j )
+    data[j] = (byte_t)(j / 7);
+  int fd = open("/big.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_TRUE_FATAL(fd >= 0);
+  iinode_t *ii = active->u->fdesc[fd].ftabent->inode;
+  CU_ASSERT_EQUAL(write(fd, data, 3000), 3000);   // three blocks
+  CU_ASSERT_TRUE(ii->dinode.blockrefs[2] != 0);
+  CU_ASSERT_EQUAL(ii->dinode.blockrefs[3], 0);
+  CU_ASSERT_EQUAL(pread(fd, back, 3000, 0), 3000);
+  CU_ASSERT_EQUAL(memcmp(back, data, 3000), 0);
+  CU_ASSERT_EQUAL(pwrite(fd, data, sizeof(data), 0), (int)sizeof(data));   // into the indirect block
+  CU_ASSERT_TRUE(ii->dinode.blockrefs[STARTREFSLEVEL] != 0);
+  CU_ASSERT_EQUAL(pread(fd, back, 1000, STARTREFSLEVEL * 1024 + 100), 1000);
+  CU_ASSERT_EQUAL(memcmp(back, data + STARTREFSLEVEL * 1024 + 100, 1000), 0);
+  syncall_buffers(false);
+  block_t bl = ii->dinode.blockrefs[1];           // block 1 of the file is sectors 2 bl and 2 bl + 1
+  CU_ASSERT_EQUAL(memcmp(tstdisk_getblock(1, 2 * bl + 1), data + 1024 + BLOCKSIZE, BLOCKSIZE), 0);
+  CU_ASSERT_EQUAL(fstat(fd, &st), 0);
+  CU_ASSERT_EQUAL(st.fsize, sizeof(data));
+  CU_ASSERT_EQUAL(close(fd), 0);
+
+  CU_ASSERT_EQUAL(mkdir("/sub", 0777), 0);
+  CU_ASSERT_EQUAL(mknode("/sub/f", REGULAR, 0777), 0);
+  CU_ASSERT_EQUAL(stat("/sub/f", &st), 0);
+  CU_ASSERT_EQUAL(unlink("/sub/f"), 0);
+  CU_ASSERT_EQUAL(rmdir("/sub"), 0);
+  CU_ASSERT_EQUAL(unlink("/big.txt"), 0);
+  CU_ASSERT_EQUAL(isbk->dsblock.nfreeblocks, nfree);
+  iput(active->u->fsroot);
+  active->u->fsroot = root;
+
+  sync_sblocks();
+  syncall_buffers(false);
+  superblock_t *sb = (superblock_t *)tstdisk_getblock(1, SBSECTOR);
+  CU_ASSERT_EQUAL(sb->bshift, 1);
+  CU_ASSERT_EQUAL(sb->nfreeblocks, nfree);
+}
+ 
+
+
+static void test_fifo_pass(void) {
+  byte_t buf[PIPESIZE + 50];
+  int pfd[2];
+
+  CU_ASSERT_EQUAL_FATAL(pipe(pfd), 0);
+  CU_ASSERT_EQUAL(write(pfd[1], (byte_t *)"hello", 5), 5);
+  CU_ASSERT_EQUAL(read(pfd[0], buf, sizeof(buf)), 5);
+  CU_ASSERT_EQUAL(sncmp((char *)buf, "hello", 5), 0);
+  CU_ASSERT_EQUAL(read(pfd[1], buf, 1), -1);       // wrong end
+  CU_ASSERT_EQUAL(close(pfd[1]), 0);
+  CU_ASSERT_EQUAL(read(pfd[0], buf, sizeof(buf)), 0);    // no writer left, end of file
+  CU_ASSERT_EQUAL(close(pfd[0]), 0);
+
+  CU_ASSERT_EQUAL_FATAL(pipe(pfd), 0);
+  mset(buf, 'p', sizeof(buf));
+  CU_ASSERT_EQUAL(write(pfd[1], buf, 40), 40);     // unread data of 3 clist nodes
+  CU_ASSERT_EQUAL(close(pfd[0]), 0);
+  CU_ASSERT_EQUAL(close(pfd[1]), 0);               // the nodes go back to the pool
+
+  CU_ASSERT_EQUAL_FATAL(mknode("/fifo", FIFO, 0666), 0);
+  int r = open("/fifo", OREAD | ONONBLOCK, 0);
+  CU_ASSERT_EQUAL_FATAL(r, 0);
+  int w = open("/fifo", OWRITE | ONONBLOCK, 0);
+  CU_ASSERT_EQUAL_FATAL(w, 1);
+  CU_ASSERT_EQUAL(read(r, buf, sizeof(buf)), -1);  // empty, would block
+  mset(buf, 'f', sizeof(buf));
+  CU_ASSERT_EQUAL(write(w, buf, sizeof(buf)), PIPESIZE);   // full, rest would block, needs the freed nodes
+  CU_ASSERT_EQUAL(write(w, buf, 1), -1);
+  mset(buf, 0, sizeof(buf));
+  CU_ASSERT_EQUAL(read(r, buf, 10), 10);
+  CU_ASSERT_EQUAL(read(r, buf, sizeof(buf)), PIPESIZE - 10);
+  CU_ASSERT_EQUAL(buf[PIPESIZE - 11], 'f');
+  CU_ASSERT_EQUAL(close(r), 0);
+  CU_ASSERT_EQUAL(write(w, buf, 1), -1);           // no reader left
+  CU_ASSERT_EQUAL(close(w), 0);
+  CU_ASSERT_EQUAL(unlink("/fifo"), 0);
+}
+ 
+
+
+static void test_dnlc_pass(void) {
+  stat_t st;
+  const dnlcstat_t *ds = getdnlcstat();
+
+  int fd = open("/dnlc.txt", OCREATE | ORDWR, 0777);
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(stat("/dnlc.txt", &st), 0);
+  dword_t hits = ds->hits;
+  CU_ASSERT_EQUAL(stat("/dnlc.txt", &st), 0);
+  CU_ASSERT_EQUAL(ds->hits, hits + 1);
+
+  CU_ASSERT_EQUAL(stat("/nofile", &st), -1);
+  dword_t neghits = ds->neghits;
+  CU_ASSERT_EQUAL(stat("/nofile", &st), -1);
+  CU_ASSERT_EQUAL(ds->neghits, neghits + 1);
+  fd = open("/nofile", OCREATE | ORDWR, 0777);    // creating drops the negative entry
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(stat("/nofile", &st), 0);
+
+  CU_ASSERT_EQUAL(unlink("/nofile"), 0);
+  CU_ASSERT_EQUAL(stat("/nofile", &st), -1);
+  CU_ASSERT_EQUAL(unlink("/dnlc.txt"), 0);
+  CU_ASSERT_EQUAL(stat("/dnlc.txt", &st), -1);
+  CU_ASSERT_EQUAL(mkdir("/dnlc", 0777), 0);
+  CU_ASSERT_EQUAL(stat("/dnlc/x", &st), -1);
+  CU_ASSERT_EQUAL(rmdir("/dnlc"), 0);
+  CU_ASSERT_EQUAL(stat("/dnlc", &st), -1);
+}
+ 
+
+
+static void test_dir_pass(void) {
+  stat_t st;
+  char cwd[MAXPATH];
+  int fd;
+
+  CU_ASSERT_EQUAL_FATAL(mkdir("/dir", 0777), 0);
+  CU_ASSERT_EQUAL_FATAL(fd = open("/dir/abcdef", OCREATE | ORDWR, 0777), 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(stat("/dir/abc", &st), -1);     // no prefix match
+  CU_ASSERT_EQUAL(rmdir("/dir"), -1);             // not empty
+  CU_ASSERT_EQUAL_FATAL(fd = open("/dir/b", OCREATE | ORDWR, 0777), 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(stat("/dir", &st), 0);
+  fsize_t size = st.fsize;
+  CU_ASSERT_EQUAL(unlink("/dir/abcdef"), 0);
+  CU_ASSERT_EQUAL(stat("/dir/b", &st), 0);
+  CU_ASSERT_EQUAL_FATAL(fd = open("/dir/c", OCREATE | ORDWR, 0777), 0);     // reuses slot of abcdef
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(stat("/dir", &st), 0);
+  CU_ASSERT_EQUAL(st.fsize, size);
+
+  CU_ASSERT_EQUAL(mkdir("/dir/sub", 0777), 0);
+  CU_ASSERT_EQUAL(chdir("/dir/sub"), 0);
+  CU_ASSERT_PTR_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+  CU_ASSERT_STRING_EQUAL(cwd, "/dir/sub");
+  const istat_t *is = getistat();                 // answered from the cached path
+  dword_t hits = is->hits, misses = is->misses;
+  CU_ASSERT_PTR_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+  CU_ASSERT_EQUAL(is->hits + is->misses, hits + misses);
+  CU_ASSERT_EQUAL(chdir("../sub/./.."), 0);
+  CU_ASSERT_PTR_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+  CU_ASSERT_STRING_EQUAL(cwd, "/dir");
+  CU_ASSERT_EQUAL(chdir("sub"), 0);
+  CU_ASSERT_EQUAL(mkdir("/dir/tmp", 0777), 0);
+  CU_ASSERT_EQUAL(rmdir("/dir/tmp"), 0);          // invalidates cached path
+  CU_ASSERT_PTR_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+  CU_ASSERT_STRING_EQUAL(cwd, "/dir/sub");
+  CU_ASSERT_PTR_NULL(getcwd(cwd, 5));             // buffer too small
+  CU_ASSERT_EQUAL(chdir("/"), 0);
+  CU_ASSERT_PTR_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+  CU_ASSERT_STRING_EQUAL(cwd, "/");
+  CU_ASSERT_EQUAL(rmdir("/dir/sub"), 0);
+  CU_ASSERT_EQUAL(unlink("/dir/b"), 0);
+  CU_ASSERT_EQUAL(unlink("/dir/c"), 0);
+  CU_ASSERT_EQUAL(rmdir("/dir"), 0);
+}
+ 
+
+
+static void hdirname(char *path, int i) {     // "/hdir/n" followed by 2 letters
+  sncpy(path, "/hdir/n", 8);
+  path[7] = 'a' + (i / 26) % 26;
+  path[8] = 'a' + i % 26;
+  path[9] = 0;
+}
+
+
+
+static void test_hashdir_pass(void) {
+  stat_t st;
+  char path[16];
+  int fd;
+
+  isuperblock_t *isbk = getisblock(fs1);
+  isbk->dsblock.features |= SBFHASHDIR;
+  CU_ASSERT_EQUAL_FATAL(mkdir("/hdir", 0777), 0);
+  isbk->dsblock.features &= ~SBFHASHDIR;
+  CU_ASSERT_EQUAL(stat("/hdir", &st), 0);
+  CU_ASSERT_EQUAL(st.fmode, 0777);                // layout flag is not visible
+  CU_ASSERT_EQUAL(st.fsize, (1 + DIRHASHBUCKETS) * BLOCKSIZE);
+  CU_ASSERT_EQUAL(chmod("/hdir", 0755), 0);
+  hdirname(path, 0);
+  CU_ASSERT_EQUAL_FATAL(fd = open(path, OCREATE | ORDWR, 0777), 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(stat("/hdir/naa", &st), 0);
+  CU_ASSERT_EQUAL(stat("/hdir/nab", &st), -1);
+  CU_ASSERT_EQUAL(rmdir("/hdir"), -1);            // not empty
+
+  word_t bucket = dirhash("naa", 3) % DIRHASHBUCKETS;
+  int nlinked = 0;
+  for ( int i = 1 ; nlinked < (int)(BLOCKSIZE / sizeof(dirent_t)) + 4 ; ++i ) {    // overflow the bucket of naa
+    hdirname(path, i);
+    if (dirhash(&path[6], 3) % DIRHASHBUCKETS != bucket)
+      continue;
+    CU_ASSERT_EQUAL(link("/hdir/naa", path), 0);
+    ++nlinked;
+  }
+  CU_ASSERT_EQUAL(stat("/hdir", &st), 0);
+  CU_ASSERT_EQUAL(st.fsize, (2 + DIRHASHBUCKETS) * BLOCKSIZE);    // one overflow block
+  CU_ASSERT_EQUAL(stat("/hdir/naa", &st), 0);
+  CU_ASSERT_EQUAL(st.nlinks, 1 + nlinked);
+  CU_ASSERT_EQUAL(stat(path, &st), 0);            // last one is in the overflow block
+  CU_ASSERT_EQUAL(chdir("/hdir"), 0);
+  CU_ASSERT_EQUAL(chdir(".."), 0);
+
+  for ( int i = 0 ; nlinked >= 0 ; ++i ) {
+    hdirname(path, i);
+    if (dirhash(&path[6], 3) % DIRHASHBUCKETS != bucket)
+      continue;
+    CU_ASSERT_EQUAL(unlink(path), 0);
+    --nlinked;
+  }
+  CU_ASSERT_EQUAL(stat(path, &st), -1);
+  CU_ASSERT_EQUAL(rmdir("/hdir"), 0);
+  CU_ASSERT_EQUAL(stat("/hdir", &st), -1);
+}
+ 
+
+
+/**
+ * @brief bmeta_t class of a block of the test disk, by its place in the layout
+ */
+static bmeta_t commitclass(isuperblock_t *isbk, block_t bl) {
+  if ((bl < isbk->dsblock.inodes) || ((bl >= isbk->dsblock.bbitmap) && (bl < isbk->dsblock.firstblock)))
+    return BMBITMAP;
+  return (bl < isbk->dsblock.bbitmap) ? BMINODE : BMDIR;
+}
+
+
+
+static void test_commit_pass(void) {
+  isuperblock_t *isbk = getisblock(fs1);
+  const bstat_t *bs = getbstat();
+  int fd;
+
+  syncall_buffers(false);
+  dword_t commits = bs->commits;
+  CU_ASSERT_EQUAL_FATAL(mkdir("/gc", 0777), 0);
+  CU_ASSERT_EQUAL_FATAL(fd = open("/gc/a", OCREATE | ORDWR, 0777), 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(bs->commits, commits);          // metadata waits for the commit
+  tstdisk_ntrace = 0;
+  bcommit(false);
+  CU_ASSERT_EQUAL(bs->commits, commits + 1);
+  CU_ASSERT_TRUE_FATAL(tstdisk_ntrace >= 3);
+  CU_ASSERT_EQUAL(commitclass(isbk, tstdisk_trace[0]), BMBITMAP);   // bitmap of the new dir block first
+  CU_ASSERT_EQUAL(commitclass(isbk, tstdisk_trace[tstdisk_ntrace - 1]), BMDIR);
+  for (int j = 1; j < tstdisk_ntrace; j++)        // bitmap, then inodes, then directories
+    CU_ASSERT_TRUE(commitclass(isbk, tstdisk_trace[j - 1]) <= commitclass(isbk, tstdisk_trace[j]));
+  bcommit(false);                                 // nothing left
+  CU_ASSERT_EQUAL(bs->commits, commits + 1);
+
+  CU_ASSERT_EQUAL_FATAL(fd = open("/gc/b", OCREATE | ORDWR, 0777), 0);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  bhead_t *hb = bread(isbk->dev, isbk->dsblock.bbitmap);
+  bdwrite(hb, BMBITMAP);                          // held bitmap, the inodes and directories wait for it
+  tstdisk_ntrace = 0;
+  bcommit(false);
+  for (int j = 0; j < tstdisk_ntrace; j++)
+    CU_ASSERT_EQUAL(commitclass(isbk, tstdisk_trace[j]), BMBITMAP);
+  brelse(hb);
+  tstdisk_ntrace = 0;
+  bcommit(false);
+  CU_ASSERT_TRUE_FATAL(tstdisk_ntrace >= 3);
+  CU_ASSERT_EQUAL(tstdisk_trace[0], isbk->dsblock.bbitmap);
+  CU_ASSERT_EQUAL(commitclass(isbk, tstdisk_trace[tstdisk_ntrace - 1]), BMDIR);
+  commits = bs->commits;
+  bcommit(false);                                 // nothing left
+  CU_ASSERT_EQUAL(bs->commits, commits);
+  CU_ASSERT_EQUAL(unlink("/gc/b"), 0);
+  syncall_buffers(false);
+  commits = bs->commits;
+
+  CU_ASSERT_EQUAL(unlink("/gc/a"), 0);
+  tstdisk_ntrace = 0;
+  for (int j = 1; j < BCOMMITAGE; j++)
+    clocktick();
+  CU_ASSERT_EQUAL(tstdisk_ntrace, 0);             // still too young
+  clocktick();
+  CU_ASSERT_TRUE(tstdisk_ntrace > 0);
+  CU_ASSERT_EQUAL(bs->commits, commits + 1);
+  CU_ASSERT_EQUAL(rmdir("/gc"), 0);
+  syncall_buffers(false);
+}
+
+
+#if KTRACE
+/**
+ * @brief first record since seq from of event ev with arguments b and c
+ *
+ * @return trace_t*   record or NULL if there is none
+ */
+static trace_t *tracefind(dword_t from, traceev_t ev, word_t b, word_t c) {
+  for (dword_t seq = from; seq < tracebuf.next; seq++) {
+    trace_t *t = &tracebuf.rec[seq % NTRACE];
+    if ((t->event == ev) && (t->b == b) && (t->c == c))
+      return t;
+  }
+  return NULL;
+}
+#endif
+
+
+
+static void test_trace_pass(void) {
+#if KTRACE                                        // tests1 is built with the trace ring, @see CMakeLists.txt
+  ldev_t dev = {{0, 0}};
+  stat_t st;
+  trace_t *t;
+
+  syncall_buffers(false);
+  dword_t start = tracebuf.next;
+  brelse(bread(dev, 90));
+  brelse(bread(dev, 90));
+  CU_ASSERT_PTR_NOT_NULL(tracefind(start, TRGETBLK, dev.ldev, 90));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(t = tracefind(start + 1, TRGETBLK, dev.ldev, 90));
+  CU_ASSERT_TRUE(t->a);                           // second one is a hit
+
+  CU_ASSERT_EQUAL(stat("/trx", &st), -1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(t = tracefind(start, TRNAMEI, 1, 't' | ('r' << 8)));
+  CU_ASSERT_FALSE(t->a);                          // not in the name cache yet
+
+  tstdisk_sim.async = true;
+  breadahead(dev, 91, 1);
+  dword_t from = tracebuf.next;
+  brelse(bread(dev, 91));                         // sleeps till the read ahead completes
+  tstdisk_sim.async = false;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(t = tracefind(from, TRSLEEP, active->pid, TRACECHAN(findblk(dev, 91))));
+  CU_ASSERT_EQUAL(t->a, BLOCKBUSY);
+  CU_ASSERT_PTR_NOT_NULL(tracefind(from, TRRUN, active->pid, TRACECHAN(findblk(dev, 91))));
+  CU_ASSERT_TRUE(tracebuf.next - start < NTRACE);
+
+  FILE *f = fopen("tests1.trace", "wb");          // input of the tracedec test
+  CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+  CU_ASSERT_EQUAL(fwrite(&tracebuf, sizeof(tracebuf), 1, f), 1);
+  fclose(f);
+#endif
+}
+
+
+int getftabent(iinode_t *ii);
+void putftabent(int f);
+extern filetab_t filetab[];
+
+static void test_ftab_pass(void) {
+  int fd[MAXOPENFILES];
+  int f[MAXFILETAB];
+  int n;
+
+  CU_ASSERT_EQUAL_FATAL(fd[0] = open("/ft", OCREATE | ORDWR, 0644), 0);
+  for (n = 1; n < MAXOPENFILES; n++)
+    CU_ASSERT_EQUAL(fd[n] = dup(fd[0]), n);       // lowest free descriptor first
+  CU_ASSERT_EQUAL(dup(fd[0]), -1);                // EMFILE
+  CU_ASSERT_EQUAL(open("/ft", ORDWR, 0), -1);
+  CU_ASSERT_EQUAL(close(fd[3]), 0);
+  CU_ASSERT_EQUAL(close(fd[1]), 0);
+  CU_ASSERT_EQUAL(open("/ft", ORDWR, 0), 1);
+  CU_ASSERT_EQUAL(dup(fd[0]), 3);
+  for (n = 0; n < MAXOPENFILES; n++)
+    CU_ASSERT_EQUAL(close(n), 0);
+  CU_ASSERT_EQUAL(close(0), -1);
+
+  iinode_t *root = active->u->fsroot;
+  for (n = 0; n < MAXFILETAB; n++) {              // fill the file table
+    ++root->nref;
+    if ((f[n] = getftabent(root)) < 0) {
+      --root->nref;
+      break;
+    }
+  }
+  CU_ASSERT_EQUAL(n, MAXFILETAB);                 // all entries were free
+  CU_ASSERT_EQUAL(open("/ft", ORDWR, 0), -1);     // ENFILE
+  putftabent(f[5]);
+  CU_ASSERT_EQUAL_FATAL(fd[0] = open("/ft", ORDWR, 0), 0);
+  CU_ASSERT_PTR_EQUAL(active->u->fdesc[fd[0]].ftabent, &filetab[f[5]]);   // last freed entry first
+  CU_ASSERT_EQUAL(close(fd[0]), 0);
+  for (int j = 0; j < n; j++)
+    if (j != 5)
+      putftabent(f[j]);
+  CU_ASSERT_EQUAL(unlink("/ft"), 0);
+}
+
+
+extern dword_t nwakeupon;
+
+static void test_wchan_pass(void) {
+  dword_t n = nwakeupon;
+  int fd = open("/wchan.txt", OCREATE | ORDWR, 0777);    // nobody sleeps, nobody is woken
+  CU_ASSERT_EQUAL_FATAL(fd, 0);
+  CU_ASSERT_EQUAL(write(fd, (byte_t *)"x", 1), 1);
+  CU_ASSERT_EQUAL(close(fd), 0);
+  CU_ASSERT_EQUAL(unlink("/wchan.txt"), 0);
+  CU_ASSERT_EQUAL(nwakeupon, n);
+
+  iinode_t *ii = iget(fs1, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ii);
+  ilock(ii);
+  CU_ASSERT_TRUE(ii->locked);
+  ii->wanted = true;                              // as set by a process sleeping in ilock()
+  iunlock(ii);
+  CU_ASSERT_FALSE(ii->locked);
+  CU_ASSERT_FALSE(ii->wanted);
+  CU_ASSERT_EQUAL(nwakeupon, n + 1);
+  iput(ii);
+}
+
+
+
 static void test_clist_pass(void) {
   byte_t i = clist_create();
   CU_ASSERT_NOT_EQUAL_FATAL(i, 0);
@@ -230,6 +1240,34 @@ static void test_clist_pass(void) {
   }
   CU_ASSERT_EQUAL(clist_push(i, buf, 100), 0);
   CU_ASSERT_EQUAL(clist_size(i), 100);
+
+  byte_t k = clist_create();                      // splice, peek and zero-copy access
+  CU_ASSERT_NOT_EQUAL_FATAL(k, 0);
+  CU_ASSERT_EQUAL(clist_push(k, "line\nrest", 9), 0);
+  CU_ASSERT_EQUAL(clist_find(k, '\n'), 4);
+  CU_ASSERT_EQUAL(clist_find(k, 'x'), -1);
+  CU_ASSERT_EQUAL(clist_splice(k, i), 100);
+  CU_ASSERT_EQUAL(clist_size(i), 0);
+  CU_ASSERT_EQUAL(clist_size(k), 109);
+  CU_ASSERT_EQUAL(clist_find(k, 50), 59);
+  CU_ASSERT_EQUAL(clist_peek(k, 7, buf, 4), 4);
+  CU_ASSERT_EQUAL(sncmp(buf, "st", 2), 0);
+  CU_ASSERT_EQUAL(buf[2], 0);
+  CU_ASSERT_EQUAL(buf[3], 1);
+  CU_ASSERT_EQUAL(clist_size(k), 109);
+  char *p;
+  int n = clist_getblock(k, &p);
+  CU_ASSERT_EQUAL(n, 9);
+  CU_ASSERT_EQUAL(sncmp(p, "line\nrest", 9), 0);
+  clist_drop(k, n + 1);
+  CU_ASSERT_EQUAL(clist_size(k), 99);
+  CU_ASSERT_EQUAL(clist_pop(k, buf, 99), 0);
+  CU_ASSERT_EQUAL(buf[0], 1);
+  CU_ASSERT_EQUAL(buf[98], 99);
+  CU_ASSERT_EQUAL(clist_getblock(k, &p), 0);
+  CU_ASSERT_EQUAL(clist_push(i, buf, 10), 0);     // spliced-from list is still usable
+  CU_ASSERT_EQUAL(clist_size(i), 10);
+  clist_destroy(k);
   clist_destroy(i);
 }
 
@@ -239,9 +1277,30 @@ CUNIT_CI_RUN(
   "my-suite",
   CUNIT_CI_TEST(test_typesize_pass),
   CUNIT_CI_TEST(test_buffer_pass),
+  CUNIT_CI_TEST(test_bhash_pass),
+  CUNIT_CI_TEST(test_cluster_pass),
+  CUNIT_CI_TEST(test_readahead_pass),
+  CUNIT_CI_TEST(test_bqueue_pass),
+  CUNIT_CI_TEST(test_writeback_pass),
+  CUNIT_CI_TEST(test_asyncdisk_pass),
+  CUNIT_CI_TEST(test_bstat_pass),
+  CUNIT_CI_TEST(test_slru_pass),
   CUNIT_CI_TEST(test_block_pass),
   CUNIT_CI_TEST(test_inode_pass),
   CUNIT_CI_TEST(test_file_pass),
+  CUNIT_CI_TEST(test_trunc_pass),
+  CUNIT_CI_TEST(test_prealloc_pass),
+  CUNIT_CI_TEST(test_rwv_pass),
+  CUNIT_CI_TEST(test_physio_pass),
+  CUNIT_CI_TEST(test_bigblock_pass),
+  CUNIT_CI_TEST(test_fifo_pass),
+  CUNIT_CI_TEST(test_dnlc_pass),
+  CUNIT_CI_TEST(test_dir_pass),
+  CUNIT_CI_TEST(test_hashdir_pass),
+  CUNIT_CI_TEST(test_commit_pass),
+  CUNIT_CI_TEST(test_trace_pass),
+  CUNIT_CI_TEST(test_ftab_pass),
+  CUNIT_CI_TEST(test_wchan_pass),
   CUNIT_CI_TEST(test_clist_pass)
 
 )
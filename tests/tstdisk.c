@@ -17,6 +17,7 @@
 #include "utils.h"
 #include "dd.h"
 #include "pc.h"
+#include "disksim.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,22 +30,28 @@
 
 #define SIMNMINOR 2
 
+#define SIMBSHIFT1 1    ///< minor 1 holds a fs with blocks of BLOCKSIZE << SIMBSHIFT1 bytes
+
+typedef struct simsector {
+  byte_t mem[BLOCKSIZE];
+} simsector_t;
+
 typedef struct simfs {
-  buffer_t block0;
+  simsector_t block0;
   union {
-    buffer_t b;
+    simsector_t b;
     superblock_t super;
   } sblock;
   union {
-    buffer_t b[SIMINODEBLOCKS];
+    simsector_t b[SIMINODEBLOCKS];
     dinode_t i[SIMNINODES];
   } inodes;
-  buffer_t bmap[SIMBMAPBLOCKS];
+  simsector_t bmap[SIMBMAPBLOCKS];
 } simfs_t;
 
 typedef union {
   simfs_t fs;
-  buffer_t block[SIMNBLOCKS];
+  simsector_t block[SIMNBLOCKS];
 } simpart_t;
 
 simpart_t *part[SIMNMINOR] =  { NULL, NULL };
@@ -53,14 +60,25 @@ simpart_t *part[SIMNMINOR] =  { NULL, NULL };
 void tstdisk_open(ldevminor_t minor);
 void tstdisk_close(ldevminor_t minor);
 void tstdisk_strategy(ldevminor_t minor, bhead_t *bh);
+void tstdisk_strategyv(ldevminor_t minor, bhead_t **bhv, word_t n);
+void tstdisk_transfer(ldevminor_t minor, bhead_t *bh);
 
 bdev_t tstdisk = {
   NULL,
   tstdisk_open,
   tstdisk_close,
-  tstdisk_strategy
+  tstdisk_strategy,
+  tstdisk_strategyv
 };
 
+int tstdisk_ncmds = 0;    ///< number of driver transactions (strategy/strategyv calls)
+
+#define TSTDISKTRACE 32
+block_t tstdisk_trace[TSTDISKTRACE];  ///< first block of each transaction, in blocks of its device
+int tstdisk_ntrace = 0;
+
+disksim_t tstdisk_sim;     ///< latency model, synchronous unless a test sets async
+
 
 char *tstdisk_getblock(ldevminor_t minor, block_t bidx)
 {
@@ -87,9 +105,54 @@ void testdiskread(byte_t *buf, ldevminor_t minor, block_t bidx)
 }
 
 
+/**
+ * @brief put an empty fs with blocks of BLOCKSIZE << bshift bytes on minor
+ * 
+ * Block 0 holds the reserved sector and the superblock, it is followed by
+ * the inodes, the bitmap and the root dir.
+ * 
+ * @param minor 
+ * @param bshift 
+ */
+void tstdisk_format(ldevminor_t minor, byte_t bshift)
+{
+  sizem_t bsize = (sizem_t)BLOCKSIZE << bshift;
+  byte_t *mem = (byte_t *)part[minor]->block;
+  superblock_t *sb = &part[minor]->fs.sblock.super;
+
+  sb->version = SBVERSION;
+  sb->bshift = bshift;
+  sb->inodes = 1;
+  sb->bbitmap = sb->inodes + (SIMNINODES * sizeof(dinode_t) + bsize - 1) / bsize;
+  sb->firstblock = sb->bbitmap + 1;
+  sb->ninodes = SIMNINODES;
+  sb->nblocks = SIMNBLOCKS >> bshift;
+  sb->notclean = true;
+
+  dinode_t *root = (dinode_t *)(mem + sb->inodes * bsize);
+  root->ftype = DIRECTORY;
+  root->nlinks = 2;
+  root->fsize = 2 * sizeof(dirent_t);
+  root->blockrefs[0] = sb->firstblock;
+
+  dirent_t *rootdir = (dirent_t *)(mem + sb->firstblock * bsize);
+  rootdir[0].inum = 1;
+  strncpy(rootdir[0].name, ".", DIRNAMEENTRY);
+  rootdir[1].inum = 1;
+  strncpy(rootdir[1].name, "..", DIRNAMEENTRY);
+
+  byte_t *bmap = mem + sb->bbitmap * bsize;
+  for ( block_t b = 0 ; b <= sb->firstblock ; ++b )
+    bmap[b / 8] |= 1 << (b % 8);
+}
+
+
+
 /**
  * @brief open the test disk
  * 
+ * Minor 1 holds a fs with larger blocks, @see tstdisk_format.
+ * 
  * @param minor 
  * 
  * @startuml
@@ -107,11 +170,15 @@ void testdiskread(byte_t *buf, ldevminor_t minor, block_t bidx)
  */
 void tstdisk_open(ldevminor_t minor)
 {
-  ASSERT(minor < 1);
+  ASSERT(minor < SIMNMINOR);
   part[minor] = malloc(sizeof(simpart_t));
   ASSERT(part[minor]);
 
   memset(part[minor], 0, sizeof(simpart_t));
+  if (minor == 1) {
+    tstdisk_format(minor, SIMBSHIFT1);
+    return;
+  }
   part[minor]->fs.sblock.super.version = 1;
   part[minor]->fs.sblock.super.type = 0;
   part[minor]->fs.sblock.super.inodes = 2; // start block of inodes
@@ -133,23 +200,28 @@ void tstdisk_open(ldevminor_t minor)
 
   byte_t *bmap = part[minor]->block[part[minor]->fs.sblock.super.bbitmap].mem;
   bmap[0] = 0x3F;  // first 6 bits of bitmap are set, 6 blocks are used
+
+  disksim_init(&tstdisk_sim, tstdisk_transfer);
 }
 
 void tstdisk_close(ldevminor_t minor)
 {
-  ASSERT(minor < 1);
+  ASSERT(minor < SIMNMINOR);
   if (part[minor])
     free(part[minor]);
+  part[minor] = NULL;
 }
 
-void tstdisk_strategy(ldevminor_t minor, bhead_t *bh)
+void tstdisk_transfer(ldevminor_t minor, bhead_t *bh)
 {
-  ASSERT(minor < 1);
+  ASSERT(minor < SIMNMINOR);
   ASSERT(bh);
 
   int wr = bh->valid;
+  dword_t sector = BSECTOR(bh);
+  word_t nsectors = 1 << bh->bshift;
 
-  if (bh->block >= SIMNBLOCKS) {
+  if (sector + nsectors > SIMNBLOCKS) {
     bh->valid = false;
     bh->error = true;
     buffer_synced(bh, 1);
@@ -157,17 +229,36 @@ void tstdisk_strategy(ldevminor_t minor, bhead_t *bh)
     return;
   }
 
-  if (wr) {
-    testdiskwrite(bh->buf->mem, minor, bh->block);
+  for ( word_t i = 0 ; i < nsectors ; ++i ) {
+    if (wr)
+      testdiskwrite(bh->buf->mem + i * BLOCKSIZE, minor, sector + i);
+    else
+      testdiskread(bh->buf->mem + i * BLOCKSIZE, minor, sector + i);
+  }
+  if (wr)
     bh->written = true;
-  } else {
-    testdiskread(bh->buf->mem, minor, bh->block);
+  else
     bh->valid = true;
-  }
   
   buffer_synced(bh, 0);
 
   wakeall(wr ? BLOCKWRITE : BLOCKREAD);
 }
 
+void tstdisk_strategy(ldevminor_t minor, bhead_t *bh)
+{
+  ++tstdisk_ncmds;
+  if (tstdisk_ntrace < TSTDISKTRACE)
+    tstdisk_trace[tstdisk_ntrace++] = bh->block;
+  disksim_strategy(&tstdisk_sim, minor, &bh, 1);
+}
+
+void tstdisk_strategyv(ldevminor_t minor, bhead_t **bhv, word_t n)
+{
+  ASSERT(bhv);
+  ++tstdisk_ncmds;
+  if (tstdisk_ntrace < TSTDISKTRACE)
+    tstdisk_trace[tstdisk_ntrace++] = bhv[0]->block;
+  disksim_strategy(&tstdisk_sim, minor, bhv, n);
+}
 
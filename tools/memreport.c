@@ -0,0 +1,75 @@
+/**
+ * @file memreport.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief static RAM footprint of the kernel tables of the selected memory profile
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Built with the flags of the kernel, prints sizeof x count of every
+ * table and their total against RAMBUDGET. A profile exceeding its budget
+ * does not compile. Sizes are the ones of the build host, a target with
+ * smaller pointers needs less. Hash tables and counters are not listed,
+ * they take a few hundred bytes.
+ *
+ * usage: memreport
+ */
+
+#include "config.h"
+#include "buf.h"
+#include "inode.h"
+#include "blocks.h"
+#include "fs.h"
+#include "dd.h"
+#include "clist.h"
+#include "dnlc.h"
+#include "trace.h"
+#include <stdio.h>
+
+#if KTRACE
+#define MEMTRACE(X) X(tracebuf, tracebuf_t, 1)
+#else
+#define MEMTRACE(X)
+#endif
+
+/**
+ * @brief the tables, X(name, type of an entry, number of entries)
+ *
+ */
+#define MEMTABLES(X) \
+  X(bufhead, bhead_t, NBUFFER) \
+  X(buf, buffer_t, NBUFFER) \
+  X(iinode, iinode_t, NINODES) \
+  X(filetab, filetab_t, MAXFILETAB) \
+  X(isblock, isuperblock_t, MAXFS) \
+  X(nodes, clist_node_t, MAXNODES) \
+  X(clists, clist_t, MAXCLISTS) \
+  X(dnlcent, dnlcent_t, NDNLC) \
+  X(bqueue, bqueue_t, NBQUEUES) \
+  MEMTRACE(X)
+
+#define MEMSUM(name, type, count) + sizeof(type) * (count)
+#define MEMTOTAL (0 MEMTABLES(MEMSUM))
+
+_Static_assert(MEMTOTAL <= RAMBUDGET, "kernel tables exceed RAMBUDGET of the memory profile, see config.h");
+
+#define MEMROW(name, type, count) \
+  printf("%-10s %-14s %6lu %-11s %5lu %8lu %5.1f%%\n", #name, #type, (unsigned long)sizeof(type), #count, \
+    (unsigned long)(count), (unsigned long)(sizeof(type) * (count)), 100.0 * sizeof(type) * (count) / total);
+
+const unsigned long total = MEMTOTAL;   ///< MEMROW cannot expand MEMTABLES again
+
+const char *profiles[] = { "", "tiny", "default", "large" };
+
+
+
+int main(void)
+{
+  printf("memory profile %s, blocks up to %u bytes\n", profiles[MEMPROFILE], MAXBLOCKSIZE);
+  printf("%-10s %-14s %6s %-11s %5s %8s %6s\n", "table", "entry", "size", "count", "", "bytes", "share");
+  MEMTABLES(MEMROW)
+  printf("%-10s %-14s %6s %-11s %5s %8lu of RAMBUDGET %u\n", "total", "", "", "", "",
+    total, RAMBUDGET);
+  return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file tracedec.c
+ * @author Thomas Boos (tboos70@gmail.com)
+ * @brief host side decoder of the event trace ring
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Reads a file holding a tracebuf_t, the image written by the mockup or a
+ * memory dump of a bochs run, searches it for the ring and prints its
+ * records oldest first, one line per event. The time a process slept is
+ * printed with the run event following its sleep event.
+ *
+ * usage: tracedec [dump]   (default stdin)
+ */
+
+#include "trace.h"
+#include "pc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXPID 64         ///< processes whose sleep is matched with their run event
+
+#define TRACENAME(id, name, a, b, c) { name, { a, b, c } },
+
+/// @brief names of an event and its arguments, indexed by traceev_t
+const struct {
+  const char *name;
+  const char *arg[3];
+} events[] = {
+  TRACEEVENTS(TRACENAME)
+};
+
+#define WAITNAME(id) #id,
+
+/// @brief names of the wait reasons, indexed by waitfor_t
+const char *waitnames[] = {
+  WAITREASONS(WAITNAME)
+};
+
+word_t sleepstart[MAXPID];      ///< time of the open sleep event of a pid
+byte_t sleeping[MAXPID];
+
+
+
+/**
+ * @brief read all of f
+ *
+ * @param f
+ * @param size    set to the number of bytes read
+ * @return byte_t*  contents, exits on error
+ */
+byte_t *readall(FILE *f, size_t *size)
+{
+  size_t cap = 1 << 16;
+  byte_t *mem = malloc(cap);
+  size_t n;
+
+  *size = 0;
+  while (mem && ((n = fread(mem + *size, 1, cap - *size, f)) > 0))
+    if ((*size += n) == cap)
+      mem = realloc(mem, cap *= 2);
+  if (!mem) {
+    fprintf(stderr, "tracedec: out of memory\n");
+    exit(1);
+  }
+  return mem;
+}
+
+
+
+/**
+ * @brief find the ring in a dump, the header must match this build
+ *
+ * @param mem
+ * @param size
+ * @return const tracebuf_t*  ring or NULL if there is none
+ */
+const tracebuf_t *findring(const byte_t *mem, size_t size)
+{
+  for ( size_t off = 0 ; off + sizeof(tracebuf_t) <= size ; ++off ) {
+    tracebuf_t hdr;
+    memcpy(&hdr, mem + off, sizeof(dword_t) + 2 * sizeof(word_t));
+    if ((hdr.magic == TRACEMAGIC) && (hdr.nrec == NTRACE) && (hdr.recsize == sizeof(trace_t)))
+      return (const tracebuf_t *)(mem + off);
+  }
+  return NULL;
+}
+
+
+
+/**
+ * @brief print one record
+ *
+ * @param seq   number of the record since the ring was started
+ * @param t
+ */
+void printrec(dword_t seq, const trace_t *t)
+{
+  word_t args[3] = { t->a, t->b, t->c };
+
+  printf("%8lu %6u ", (unsigned long)seq, t->time);
+  if (t->event >= NTRACEEV) {
+    printf("event %u %u %u %u\n", t->event, t->a, t->b, t->c);
+    return;
+  }
+  printf("%-8s", events[t->event].name);
+  for ( int i = 0 ; i < 3 ; ++i ) {
+    const char *an = events[t->event].arg[i];
+    if (!an[0])
+      continue;
+    if ((i == 0) && ((t->event == TRSLEEP) || (t->event == TRRUN)) && (t->a < sizeof(waitnames) / sizeof(waitnames[0])))
+      printf(" %s=%s", an, waitnames[t->a]);
+    else if ((i == 2) && (t->event == TRNAMEI))
+      printf(" %s=%c%c", an, (t->c & 0xff) ? t->c & 0xff : ' ', (t->c >> 8) ? t->c >> 8 : ' ');
+    else if ((strcmp(an, "dev") == 0) || (strcmp(an, "chan") == 0))
+      printf(" %s=%04x", an, args[i]);
+    else
+      printf(" %s=%u", an, args[i]);
+  }
+  if ((t->event == TRSLEEP) && (t->b < MAXPID)) {
+    sleeping[t->b] = true;
+    sleepstart[t->b] = t->time;
+  } else if ((t->event == TRRUN) && (t->b < MAXPID) && sleeping[t->b]) {
+    sleeping[t->b] = false;
+    printf(" slept=%u", (word_t)(t->time - sleepstart[t->b]));
+  }
+  printf("\n");
+}
+
+
+
+int main(int argc, char *argv[])
+{
+  FILE *f = stdin;
+  size_t size;
+
+  if (argc > 2) {
+    fprintf(stderr, "usage: tracedec [dump]\n");
+    return 2;
+  }
+  if ((argc == 2) && ((f = fopen(argv[1], "rb")) == NULL)) {
+    perror(argv[1]);
+    return 1;
+  }
+  byte_t *mem = readall(f, &size);
+  if (f != stdin)
+    fclose(f);
+  const tracebuf_t *tb = findring(mem, size);
+  if (!tb) {
+    fprintf(stderr, "tracedec: no trace ring of %u records found\n", NTRACE);
+    return 1;
+  }
+  dword_t next, first;
+  memcpy(&next, &tb->next, sizeof(next));
+  first = (next > NTRACE) ? next - NTRACE : 0;
+  printf("%8s %6s event\n", "seq", "ticks");
+  for ( dword_t seq = first ; seq < next ; ++seq ) {
+    trace_t t;
+    memcpy(&t, &tb->rec[seq % NTRACE], sizeof(t));
+    printrec(seq, &t);
+  }
+  if (first)
+    printf("%lu older records overwritten\n", (unsigned long)first);
+  free(mem);
+  return 0;
+}